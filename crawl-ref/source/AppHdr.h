@@ -40,8 +40,12 @@ static inline double pow(int x, double y) { return std::pow((double)x, y); }
  * The maximum total memory that the user-script Lua interpreter is
  * allowed to allocate, in kilobytes. This limit is enforced to prevent
  * badly-written or malicious user scripts from consuming too much memory.
+ * -lua-max-memory overrides it.
  */
 #define CLUA_MAX_MEMORY_USE (16 * 1024)
+// The least -lua-max-memory accepts: less than this won't hold the standard
+// libraries and our bindings.
+#define CLUA_MIN_MEMORY_USE 1024
 
 // Uncomment to prevent Crawl from looking for a list of saves when
 // asking the player to enter a name. This can speed up startup
@@ -103,6 +107,12 @@ static inline double pow(int x, double y) { return std::pow((double)x, y); }
     // a file.
     #define HAVE_UTIMES
 
+    // Games can be started from an already initialised process (see
+    // fork-server.cc). Not for local tiles, which own their window.
+#ifndef USE_TILE_LOCAL
+    #define USE_FORK_SERVER
+#endif
+
     // Use POSIX regular expressions
 #ifndef REGEX_PCRE
     #define REGEX_POSIX
@@ -167,16 +177,16 @@ static inline double pow(int x, double y) { return std::pow((double)x, y); }
     //
     #define DGL_CLEAR_SCREEN "\033[2J"
 
+    // Each of those clears makes curses repaint the whole screen, so send
+    // one at most this often (in seconds). Other screen clears just blank
+    // the screen and let curses send what changed.
+    #define DGL_CLEAR_SCREEN_INTERVAL 10
+
     // Create .des and database cache files in a directory named with the
     // game version so that multiple save-compatible Crawl versions can
     // share the same savedir.
     #define VERSIONED_CACHE_DIR
 
-    // Update (text) database files safely; when a Crawl process
-    // starts up and notices that a db file is out-of-date, it updates
-    // it in-place, instead of torching the old file.
-    #define DGL_REWRITE_PROTECT_DB_FILES
-
     // Startup preferences are saved by player name rather than uid,
     // since all players use the same uid in dgamelaunch.
     #ifndef DGL_NO_STARTUP_PREFS_BY_NAME
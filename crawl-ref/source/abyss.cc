@@ -897,8 +897,12 @@ static void _abyss_move_entities(coord_def target_centre,
             if (map_bounds_with_margin(dst, MAPGEN_BORDER))
             {
                 shift_area_mask->set(dst);
-                // Wipe the dstination clean before dropping things on it.
-                _abyss_wipe_square_at(dst);
+                // Wipe the destination clean before dropping things on it.
+                // Squares outside the original area were already wiped
+                // before the move started; only squares we've already
+                // moved out of still hold stale copies.
+                if (original_area_mask.get(dst))
+                    _abyss_wipe_square_at(dst);
                 _abyss_move_entities_at(src, dst);
                 _abyss_update_transporter(dst, source_centre, target_centre,
                                           original_area_mask);
@@ -948,6 +952,17 @@ static void _abyss_identify_area_to_shift(coord_def source, int radius,
         _abyss_expand_mask_to_cover_vault(mask, i);
 }
 
+// Wipes the squares that were part of the shifted area but were not
+// filled again by the move. Everything else outside the shifted area
+// was already wiped before the move, so there's no need to revisit it.
+static void _abyss_wipe_vacated_area(const map_bitmask &source_mask,
+                                     const map_bitmask &target_mask)
+{
+    for (rectangle_iterator ri(MAPGEN_BORDER); ri; ++ri)
+        if (source_mask(*ri) && !target_mask(*ri))
+            _abyss_wipe_square_at(*ri);
+}
+
 static void _abyss_invert_mask(map_bitmask *mask)
 {
     for (rectangle_iterator ri(0); ri; ++ri)
@@ -1004,6 +1019,7 @@ static void _abyss_shift_level_contents_around_player(
     _abyss_wipe_unmasked_area(abyss_destruction_mask);
 
     // Move stuff to its new home. This will also move the player.
+    const map_bitmask shift_source_mask = abyss_destruction_mask;
     _abyss_move_entities(target_centre, &abyss_destruction_mask);
 
     // [ds] Rezap everything except the shifted area. NOTE: the old
@@ -1011,7 +1027,10 @@ static void _abyss_shift_level_contents_around_player(
     // at the old location for every shift; discussions between Linley
     // and dpeg on IRC confirm that this (repeated swatch of terrain left
     // behind) was not intentional.
-    _abyss_wipe_unmasked_area(abyss_destruction_mask);
+    //
+    // Only the squares the shifted area was moved out of can be dirty at
+    // this point, so don't walk the whole level a second time.
+    _abyss_wipe_vacated_area(shift_source_mask, abyss_destruction_mask);
 
     // So far we've used the mask to track the portions of the level we're
     // preserving. The inverse of the mask represents the area to be filled
@@ -0,0 +1,639 @@
+/**
+ * @file
+ * @brief An indexed file of bones records, shared by every game.
+**/
+
+#include "AppHdr.h"
+
+#include "bones-store.h"
+
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(UNIX) || defined(TARGET_COMPILER_MINGW)
+#include <unistd.h>
+#endif
+
+#include "endianness.h"
+#include "mpr.h"
+#include "random.h"
+#include "syscalls.h"
+
+#define BONES_STORE_VERSION 1
+#define BONES_STORE_MAGIC   0x53424344 /* "DCBS" */
+#define BONES_RECORD_MAGIC  0x43455242 /* "BREC" */
+
+// Enough for every place that has bones, and its permastore, many times
+// over.
+#define BONES_STORE_SLOTS 512
+#define BONES_STORE_KEY_LENGTH 48
+
+// Don't bother compacting smaller files.
+#define BONES_STORE_COMPACT_SIZE (256 * 1024)
+
+// Single bytes of the header, locked to stand for the whole store:
+// shared while it is in use and exclusive while it is compacted; exclusive
+// while checking whether it needs creating; exclusive while appending.
+// These are fcntl() record locks, which belong to the process: they keep
+// games apart, but do nothing between threads of one game.
+#define LOCK_STORE 0
+#define LOCK_INIT  1
+#define LOCK_TAIL  2
+
+struct store_header
+{
+    uint32_t magic;
+    uint8_t version;
+    char padding[3];
+    uint32_t slots;
+    uint32_t live;      // bytes in records that are still reachable
+};
+
+struct store_slot
+{
+    char key[BONES_STORE_KEY_LENGTH];
+    uint32_t head;      // offset of the newest record, or 0
+    uint32_t count;
+    char padding[8];
+};
+
+struct record_header
+{
+    uint32_t magic;
+    uint32_t prev;      // offset of the next older record, or 0
+    uint32_t len;
+};
+
+#define SLOT_AT(i) (sizeof(store_header) + (i) * sizeof(store_slot))
+#define TABLE_END  SLOT_AT(BONES_STORE_SLOTS)
+
+static uint32_t _key_hash(const string &key)
+{
+    uint32_t hash = 2166136261U;
+    for (unsigned char c : key)
+        hash = (hash ^ c) * 16777619U;
+    return hash;
+}
+
+static bool _read_fully(int fd, uint32_t at, void *data, uint32_t len)
+{
+    if (lseek(fd, at, SEEK_SET) != (off_t)at)
+        return false;
+    char *buf = static_cast<char *>(data);
+    while (len)
+    {
+        ssize_t got = ::read(fd, buf, len);
+        if (got <= 0)
+            return false;
+        buf += got;
+        len -= got;
+    }
+    return true;
+}
+
+static bool _write_fully(int fd, uint32_t at, const void *data, uint32_t len)
+{
+    if (lseek(fd, at, SEEK_SET) != (off_t)at)
+        return false;
+    const char *buf = static_cast<const char *>(data);
+    while (len)
+    {
+        ssize_t done = ::write(fd, buf, len);
+        if (done <= 0)
+            return false;
+        buf += done;
+        len -= done;
+    }
+    return true;
+}
+
+// Make a rename of the file durable: on POSIX systems that means syncing the
+// directory that holds it.
+static void _sync_directory(const string &filename)
+{
+#ifdef UNIX
+    const string::size_type sep = filename.rfind(FILE_SEPARATOR);
+    const string dir = sep == string::npos ? "." : filename.substr(0, sep + 1);
+    const int dir_fd = open_u(dir.c_str(), O_RDONLY, 0);
+    if (dir_fd == -1)
+        return;
+    fsync(dir_fd);
+    close(dir_fd);
+#else
+    UNUSED(filename);
+#endif
+}
+
+static bool _write_empty_store(int fd)
+{
+    store_header head;
+    memset(&head, 0, sizeof(head));
+    head.magic   = htole32(BONES_STORE_MAGIC);
+    head.version = BONES_STORE_VERSION;
+    head.slots   = htole32(BONES_STORE_SLOTS);
+    head.live    = 0;
+
+    vector<char> table(TABLE_END, 0);
+    memcpy(&table[0], &head, sizeof(head));
+    return _write_fully(fd, 0, &table[0], table.size());
+}
+
+bones_store::bones_store(const string &_filename)
+    : filename(_filename), fd(-1), was_created(false)
+{
+    // Someone compacting the store replaces the file; try again if that
+    // happened while we were waiting for it.
+    for (int tries = 0; tries < 10 && !valid(); ++tries)
+        if (!open_store())
+            break;
+    if (!valid())
+        dprf("bones store: can't use %s", filename.c_str());
+}
+
+bones_store::~bones_store()
+{
+    if (valid())
+    {
+        maybe_compact();
+        close_store();
+    }
+}
+
+bool bones_store::is_store(const string &filename)
+{
+    const int file = open_u(filename.c_str(), O_RDONLY | O_BINARY, 0);
+    if (file == -1)
+        return false;
+    store_header head;
+    const bool ok = _read_fully(file, 0, &head, sizeof(head))
+                    && htole32(head.magic) == BONES_STORE_MAGIC;
+    close(file);
+    return ok;
+}
+
+bool bones_store::open_store()
+{
+    fd = open_u(filename.c_str(), O_RDWR | O_CREAT | O_BINARY, 0666);
+    if (fd == -1)
+    {
+        dprf("bones store: can't open %s", filename.c_str());
+        return false;
+    }
+
+    // Whoever gets here first creates the header.
+    if (!lock_file_range(fd, true, true, LOCK_INIT, 1))
+    {
+        close_store();
+        return false;
+    }
+    store_header head;
+    struct stat st;
+    bool ok = !fstat(fd, &st);
+    if (ok && !st.st_size)
+    {
+        ok = _write_empty_store(fd);
+        was_created = ok;
+    }
+    ok = ok && _read_fully(fd, 0, &head, sizeof(head))
+         && htole32(head.magic) == BONES_STORE_MAGIC
+         && head.version == BONES_STORE_VERSION
+         && htole32(head.slots) == BONES_STORE_SLOTS;
+    unlock_file_range(fd, LOCK_INIT, 1);
+    if (!ok)
+    {
+        dprf("bones store: %s is not a bones store", filename.c_str());
+        close_store();
+        return false;
+    }
+
+    if (!lock_file_range(fd, false, true, LOCK_STORE, 1))
+    {
+        close_store();
+        return false;
+    }
+
+#ifndef TARGET_OS_WINDOWS
+    struct stat now;
+    if (stat(filename.c_str(), &now) || fstat(fd, &st)
+        || now.st_ino != st.st_ino || now.st_dev != st.st_dev)
+    {
+        // Replaced by a compaction; worth another try.
+        close_store();
+        return true;
+    }
+#endif
+    return true;
+}
+
+void bones_store::close_store()
+{
+    // Closing drops all of our locks.
+    close(fd);
+    fd = -1;
+}
+
+bool bones_store::read_at(uint32_t at, void *data, uint32_t len)
+{
+    return _read_fully(fd, at, data, len);
+}
+
+bool bones_store::write_at(uint32_t at, const void *data, uint32_t len)
+{
+    return _write_fully(fd, at, data, len);
+}
+
+// Find the slot for a key, or claim an empty one if create is set, and lock
+// it. Keys are never removed (except by compaction), so probing only ever
+// needs to hold one slot at a time.
+bool bones_store::lock_slot(const string &key, bool create, slot &s)
+{
+    if (key.empty() || key.size() >= BONES_STORE_KEY_LENGTH)
+        return false;
+
+    const uint32_t hash = _key_hash(key);
+    for (int i = 0; i < BONES_STORE_SLOTS; ++i)
+    {
+        s.index = (hash + i) % BONES_STORE_SLOTS;
+        const uint32_t at = SLOT_AT(s.index);
+        if (!lock_file_range(fd, true, true, at, sizeof(store_slot)))
+            return false;
+
+        store_slot disk;
+        if (!read_at(at, &disk, sizeof(disk)))
+            break;
+        disk.key[BONES_STORE_KEY_LENGTH - 1] = 0;
+        s.head  = htole32(disk.head);
+        s.count = htole32(disk.count);
+
+        if (key == disk.key)
+            return true;
+        if (!*disk.key)
+        {
+            if (!create)
+                break;
+            memset(&disk, 0, sizeof(disk));
+            strcpy(disk.key, key.c_str());
+            if (!write_at(at, &disk, sizeof(disk)))
+                break;
+            s.head = s.count = 0;
+            return true;
+        }
+        unlock_file_range(fd, at, sizeof(store_slot));
+    }
+    unlock_slot(s);
+    return false;
+}
+
+void bones_store::unlock_slot(const slot &s)
+{
+    unlock_file_range(fd, SLOT_AT(s.index), sizeof(store_slot));
+}
+
+bool bones_store::write_slot(const slot &s)
+{
+    const uint32_t at = SLOT_AT(s.index) + BONES_STORE_KEY_LENGTH;
+    const uint32_t fields[2] = { htole32(s.head), htole32(s.count) };
+    return write_at(at, fields, sizeof(fields));
+}
+
+// The records under a locked slot, newest first.
+bool bones_store::read_chain(const slot &s, vector<record> &chain)
+{
+    struct stat st;
+    if (fstat(fd, &st))
+        return false;
+
+    for (uint32_t at = s.head; at; at = chain.back().prev)
+    {
+        record_header rh;
+        if (chain.size() >= s.count
+            || at < TABLE_END || at + sizeof(rh) > (uint32_t)st.st_size
+            || !read_at(at, &rh, sizeof(rh))
+            || htole32(rh.magic) != BONES_RECORD_MAGIC
+            || htole32(rh.len) > (uint32_t)st.st_size - at - sizeof(rh))
+        {
+            dprf("bones store: broken chain at %u", at);
+            return false;
+        }
+        chain.push_back({ at, htole32(rh.prev), htole32(rh.len) });
+    }
+    return chain.size() == s.count;
+}
+
+// The bytes of a chain's records, as counted in the header's live total.
+int64_t bones_store::chain_bytes(const vector<record> &chain)
+{
+    int64_t bytes = 0;
+    for (const record &r : chain)
+        bytes += sizeof(record_header) + r.len;
+    return bytes;
+}
+
+// Write a new record at the end of the file, returning where it went.
+// Until a slot points at it, a crash only leaves unreachable garbage.
+uint32_t bones_store::append(const vector<unsigned char> &data, uint32_t prev)
+{
+    if (!lock_file_range(fd, true, true, LOCK_TAIL, 1))
+        return 0;
+
+    uint32_t at = 0;
+    const off_t end = lseek(fd, 0, SEEK_END);
+    record_header rh;
+    rh.magic = htole32(BONES_RECORD_MAGIC);
+    rh.prev  = htole32(prev);
+    rh.len   = htole32(data.size());
+    if (end >= (off_t)TABLE_END && write_at(end, &rh, sizeof(rh))
+        && (data.empty() || write_at(end + sizeof(rh), &data[0], data.size())))
+    {
+        at = end;
+    }
+
+    unlock_file_range(fd, LOCK_TAIL, 1);
+    return at;
+}
+
+void bones_store::add_live(int64_t bytes)
+{
+    if (!lock_file_range(fd, true, true, LOCK_TAIL, 1))
+        return;
+    store_header head;
+    if (read_at(0, &head, sizeof(head)))
+    {
+        head.live = htole32(max<int64_t>(0, htole32(head.live) + bytes));
+        write_at(0, &head, sizeof(head));
+    }
+    unlock_file_range(fd, LOCK_TAIL, 1);
+}
+
+bool bones_store::add(const string &key, const vector<unsigned char> &data,
+                      size_t limit)
+{
+    slot s;
+    if (!valid() || !lock_slot(key, true, s))
+        return false;
+
+    bool added = false;
+    if (s.count < limit)
+    {
+        const uint32_t at = append(data, s.head);
+        if (at)
+        {
+            s.head = at;
+            ++s.count;
+            added = write_slot(s);
+            if (added)
+                add_live(sizeof(record_header) + data.size());
+        }
+    }
+    unlock_slot(s);
+    return added;
+}
+
+bool bones_store::take(const string &key, vector<unsigned char> &data,
+                  const function<bool(const vector<unsigned char> &)> &usable)
+{
+    slot s;
+    if (!valid() || !lock_slot(key, false, s))
+        return false;
+
+    vector<record> chain;
+    if (!read_chain(s, chain))
+    {
+        // Nothing to be done with the rest of a broken chain but drop it.
+        // Whatever lies past the break can't be counted; the next compaction
+        // recounts everything anyway.
+        s.head = s.count = 0;
+        if (write_slot(s))
+            add_live(-chain_bytes(chain));
+        unlock_slot(s);
+        return false;
+    }
+
+    vector<int> candidates;
+    for (int i = 0; i < (int)chain.size(); ++i)
+    {
+        data.resize(chain[i].len);
+        if (read_at(chain[i].at + sizeof(record_header), data.data(),
+                    data.size())
+            && usable(data))
+        {
+            candidates.push_back(i);
+        }
+    }
+
+    bool taken = false;
+    if (!candidates.empty())
+    {
+        const int i = candidates[random2(candidates.size())];
+        data.resize(chain[i].len);
+        taken = read_at(chain[i].at + sizeof(record_header), data.data(),
+                        data.size());
+        if (taken)
+        {
+            // Unlink it from whatever points at it.
+            bool unlinked;
+            if (!i)
+            {
+                s.head = chain[i].prev;
+                unlinked = true;
+            }
+            else
+            {
+                const uint32_t prev = htole32(chain[i].prev);
+                unlinked = write_at(chain[i - 1].at
+                                        + offsetof(record_header, prev),
+                                    &prev, sizeof(prev));
+            }
+            --s.count;
+            taken = unlinked && write_slot(s);
+            if (taken)
+                add_live(-(int64_t)(sizeof(record_header) + chain[i].len));
+        }
+    }
+    unlock_slot(s);
+    return taken;
+}
+
+bool bones_store::update(const string &key,
+                         const function<bool(vector<unsigned char> &)> &change)
+{
+    slot s;
+    if (!valid() || !lock_slot(key, true, s))
+        return false;
+
+    // A broken chain is replaced like any other, as if it were empty.
+    vector<record> chain;
+    vector<unsigned char> data;
+    if (read_chain(s, chain) && !chain.empty())
+    {
+        data.resize(chain[0].len);
+        if (!read_at(chain[0].at + sizeof(record_header), data.data(),
+                     data.size()))
+        {
+            data.clear();
+        }
+    }
+
+    bool updated = false;
+    if (change(data))
+    {
+        const uint32_t at = append(data, 0);
+        if (at)
+        {
+            s.head = at;
+            s.count = 1;
+            updated = write_slot(s);
+        }
+        if (updated)
+        {
+            add_live((int64_t)(sizeof(record_header) + data.size())
+                     - chain_bytes(chain));
+        }
+    }
+    unlock_slot(s);
+    return updated;
+}
+
+vector<string> bones_store::keys()
+{
+    vector<string> result;
+    if (!valid())
+        return result;
+
+    for (int i = 0; i < BONES_STORE_SLOTS; ++i)
+    {
+        const uint32_t at = SLOT_AT(i);
+        if (!lock_file_range(fd, false, true, at, sizeof(store_slot)))
+            break;
+        store_slot disk;
+        const bool ok = read_at(at, &disk, sizeof(disk));
+        unlock_file_range(fd, at, sizeof(store_slot));
+        if (!ok)
+            break;
+        disk.key[BONES_STORE_KEY_LENGTH - 1] = 0;
+        if (*disk.key && disk.count)
+            result.emplace_back(disk.key);
+    }
+    return result;
+}
+
+bool bones_store::records(const string &key,
+                          vector<vector<unsigned char>> &data)
+{
+    data.clear();
+    slot s;
+    if (!valid() || !lock_slot(key, false, s))
+        return false;
+
+    vector<record> chain;
+    bool ok = read_chain(s, chain);
+    for (const record &r : chain)
+    {
+        if (!ok)
+            break;
+        data.emplace_back(r.len);
+        ok = read_at(r.at + sizeof(record_header), data.back().data(),
+                     r.len);
+    }
+    unlock_slot(s);
+    return ok;
+}
+
+// Rewrite the store without its garbage, if nobody else is using it and
+// most of it is garbage. The new file replaces the old one, so anyone still
+// waiting on the old one reopens. Only for a store about to be closed: it
+// gives up our shared lock either way.
+void bones_store::maybe_compact()
+{
+    store_header head;
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < BONES_STORE_COMPACT_SIZE
+        || !read_at(0, &head, sizeof(head))
+        || (off_t)(TABLE_END + 2 * htole32(head.live)) > st.st_size)
+    {
+        return;
+    }
+    // Windows can't turn a shared lock into an exclusive one, so let go of
+    // ours first. Someone else may compact the store in between, in which
+    // case we're holding the old file and must leave it be.
+    unlock_file_range(fd, LOCK_STORE, 1);
+    if (!lock_file_range(fd, true, false, LOCK_STORE, 1))
+        return;
+#ifndef TARGET_OS_WINDOWS
+    struct stat now;
+    if (stat(filename.c_str(), &now) || fstat(fd, &st)
+        || now.st_ino != st.st_ino || now.st_dev != st.st_dev)
+    {
+        return;
+    }
+#endif
+
+    dprf("bones store: compacting %s", filename.c_str());
+
+    vector<char> out(TABLE_END, 0);
+    uint32_t live = 0;
+    for (int i = 0; i < BONES_STORE_SLOTS; ++i)
+    {
+        store_slot disk;
+        if (!read_at(SLOT_AT(i), &disk, sizeof(disk)))
+            return;
+        disk.key[BONES_STORE_KEY_LENGTH - 1] = 0;
+        slot s = { i, htole32(disk.head), htole32(disk.count) };
+        vector<record> chain;
+        if (!*disk.key || !s.count || !read_chain(s, chain))
+            continue;
+
+        // Keys have to be placed afresh, since empty ones are dropped.
+        const string key = disk.key;
+        const uint32_t hash = _key_hash(key);
+        int index = hash % BONES_STORE_SLOTS;
+        while (out[SLOT_AT(index)])
+            index = (index + 1) % BONES_STORE_SLOTS;
+
+        // Oldest first, so that each record's prev is already written.
+        uint32_t prev = 0;
+        for (auto r = chain.rbegin(); r != chain.rend(); ++r)
+        {
+            record_header rh;
+            rh.magic = htole32(BONES_RECORD_MAGIC);
+            rh.prev  = htole32(prev);
+            rh.len   = htole32(r->len);
+            prev = out.size();
+            out.insert(out.end(), (const char *)&rh,
+                       (const char *)&rh + sizeof(rh));
+            out.resize(out.size() + r->len);
+            if (!read_at(r->at + sizeof(rh), &out[prev + sizeof(rh)], r->len))
+                return;
+            live += sizeof(rh) + r->len;
+        }
+
+        store_slot ns;
+        memset(&ns, 0, sizeof(ns));
+        strcpy(ns.key, key.c_str());
+        ns.head  = htole32(prev);
+        ns.count = htole32(chain.size());
+        memcpy(&out[SLOT_AT(index)], &ns, sizeof(ns));
+    }
+
+    head.live = htole32(live);
+    memcpy(&out[0], &head, sizeof(head));
+
+    const string tmpname = filename + ".tmp";
+    int tmp = open_u(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+                     0666);
+    if (tmp == -1)
+        return;
+    // The new file must be on the disk before it replaces the old one, or a
+    // crash could leave an empty or partial store behind.
+    bool ok = _write_fully(tmp, 0, &out[0], out.size()) && !fdatasync(tmp);
+    if (close(tmp))
+        ok = false;
+    if (!ok || rename_u(tmpname.c_str(), filename.c_str()))
+    {
+        unlink_u(tmpname.c_str());
+        return;
+    }
+    _sync_directory(filename);
+}
@@ -0,0 +1,88 @@
+/**
+ * @file
+ * @brief An indexed file of bones records, shared by every game.
+**/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+using std::function;
+using std::string;
+using std::vector;
+
+// All the ghosts of a bones directory, in one file. A table at the start
+// maps each key (the name a bones file would have had, like "bones.D-5")
+// to a chain of records, each holding what used to be a whole bones file.
+// Records are only ever appended; the space of taken or replaced records
+// is reclaimed by compacting the file once it's mostly garbage.
+//
+// Games lock only the table entry of the key they use (and the end of the
+// file while appending), so games on different levels never wait for each
+// other. Each store should be short-lived: it holds a shared lock on the
+// whole file for as long as it is open.
+class bones_store
+{
+public:
+    bones_store(const string &filename);
+    ~bones_store();
+
+    // Whether filename is a bones store, rather than a bones file.
+    static bool is_store(const string &filename);
+
+    bool valid() const { return fd != -1; }
+    // Whether opening the store created the file.
+    bool created() const { return was_created; }
+
+    // Add a record under key, unless there are already limit of them.
+    bool add(const string &key, const vector<unsigned char> &data,
+             size_t limit);
+    // Remove a random record under key that usable() accepts, and return
+    // it in data.
+    bool take(const string &key, vector<unsigned char> &data,
+              const function<bool(const vector<unsigned char> &)> &usable);
+    // Pass the newest record under key (or nothing) to change(); if that
+    // returns true, what it left in data replaces every record under key.
+    // Nobody else can use the key in between.
+    bool update(const string &key,
+                const function<bool(vector<unsigned char> &)> &change);
+
+    // For tools: every key that has records, and all the records under a
+    // key, newest first.
+    vector<string> keys();
+    bool records(const string &key, vector<vector<unsigned char>> &data);
+
+private:
+    struct slot
+    {
+        int index;
+        uint32_t head;
+        uint32_t count;
+    };
+    struct record
+    {
+        uint32_t at;
+        uint32_t prev;
+        uint32_t len;
+    };
+
+    string filename;
+    int fd;
+    bool was_created;
+
+    bool open_store();
+    void close_store();
+    bool read_at(uint32_t at, void *data, uint32_t len);
+    bool write_at(uint32_t at, const void *data, uint32_t len);
+    bool lock_slot(const string &key, bool create, slot &s);
+    void unlock_slot(const slot &s);
+    bool write_slot(const slot &s);
+    bool read_chain(const slot &s, vector<record> &chain);
+    static int64_t chain_bytes(const vector<record> &chain);
+    uint32_t append(const vector<unsigned char> &data, uint32_t prev);
+    void add_live(int64_t bytes);
+    void maybe_compact();
+};
@@ -0,0 +1,108 @@
+#include "catch.hpp"
+
+#include "AppHdr.h"
+
+#include <cstdio>
+
+#include "hashdb.h"
+#include "stringutil.h"
+#include "syscalls.h"
+
+static const string TEST_DB = "test_hashdb.hdb";
+
+TEST_CASE( "hash_db finds every key it was built with", "[single-file]" ) {
+
+    hash_db_writer writer;
+    for (int i = 0; i < 5000; ++i)
+        writer.add(make_stringf("key %d", i), make_stringf("value %d", i));
+    writer.add("key 7", "replaced");
+    writer.add("", "empty key");
+    writer.add("no value", "");
+    REQUIRE(writer.write(TEST_DB));
+
+    hash_db db;
+    REQUIRE(db.open(TEST_DB));
+    REQUIRE(db.size() == 5002);
+
+    SECTION ("lookups return the last value added for the key") {
+        for (int i = 0; i < 5000; ++i)
+        {
+            const hash_db::entry value = db.find(make_stringf("key %d", i));
+            REQUIRE(value);
+            CHECK(value.str() == (i == 7 ? "replaced"
+                                         : make_stringf("value %d", i)));
+            CHECK(value.data[value.size] == '\0');
+        }
+        CHECK(db.find("").str() == "empty key");
+        CHECK(db.find("no value"));
+        CHECK(db.find("no value").size == 0);
+    }
+
+    SECTION ("other keys are not found") {
+        CHECK(!db.find("key 5000"));
+        CHECK(!db.find("key"));
+        CHECK(!db.find("key 12 "));
+        CHECK(!db.find("value 12"));
+    }
+
+    SECTION ("entries can be walked in key order") {
+        string last;
+        for (size_t i = 0; i < db.size(); ++i)
+        {
+            const string key = db.key(i).str();
+            if (i)
+                CHECK(last < key);
+            CHECK(db.find(key).data == db.value(i).data);
+            last = key;
+        }
+    }
+
+    db.close();
+    unlink_u(TEST_DB.c_str());
+}
+
+TEST_CASE( "hash_db copes with empty and damaged files", "[single-file]" ) {
+
+    SECTION ("an empty db has no entries") {
+        hash_db_writer writer;
+        REQUIRE(writer.write(TEST_DB));
+
+        hash_db db;
+        REQUIRE(db.open(TEST_DB));
+        CHECK(db.size() == 0);
+        CHECK(!db.find("anything"));
+    }
+
+    SECTION ("a truncated db is refused") {
+        hash_db_writer writer;
+        writer.add("a key", "a value");
+        REQUIRE(writer.write(TEST_DB));
+
+        FILE *f = fopen_u(TEST_DB.c_str(), "rb");
+        REQUIRE(f);
+        char buf[4096];
+        const size_t len = fread(buf, 1, sizeof(buf), f);
+        fclose(f);
+
+        f = fopen_u(TEST_DB.c_str(), "wb");
+        REQUIRE(f);
+        fwrite(buf, 1, len - 4, f);
+        fclose(f);
+
+        hash_db db;
+        CHECK(!db.open(TEST_DB));
+        CHECK(!db.is_open());
+    }
+
+    SECTION ("something else entirely is refused") {
+        FILE *f = fopen_u(TEST_DB.c_str(), "wb");
+        REQUIRE(f);
+        fputs("SQLite format 3, or some such thing", f);
+        fclose(f);
+
+        hash_db db;
+        CHECK(!db.open(TEST_DB));
+    }
+
+    unlink_u(TEST_DB.c_str());
+}
@@ -0,0 +1,95 @@
+#include "catch.hpp"
+
+#include "AppHdr.h"
+
+#include <cstring>
+
+#include "json.h"
+
+TEST_CASE( "JSON can be decoded into an arena", "[single-file]" ) {
+
+    JsonArena arena;
+
+    SECTION ("strings point into the input, unescaped") {
+        char input[] = "{\"msg\":\"key\",\"text\":\"a\\\"b\\u00e9\","
+                       "\"keycode\":27,\"list\":[true,null]}";
+        const char *end = input + strlen(input);
+
+        JsonNode *obj = json_decode_arena(&arena, input);
+        REQUIRE(obj != nullptr);
+        REQUIRE(obj->tag == JSON_OBJECT);
+
+        JsonNode *msg = json_find_member(obj, "msg");
+        REQUIRE(msg != nullptr);
+        CHECK(string(msg->string_) == "key");
+        CHECK(msg->string_ >= input);
+        CHECK(msg->string_ < end);
+
+        JsonNode *text = json_find_member(obj, "text");
+        REQUIRE(text != nullptr);
+        CHECK(string(text->string_) == "a\"b\xc3\xa9");
+        CHECK(text->string_ >= input);
+        CHECK(text->string_ < end);
+
+        JsonNode *keycode = json_find_member(obj, "keycode");
+        REQUIRE(keycode != nullptr);
+        CHECK(keycode->number_ == 27);
+
+        JsonNode *list = json_find_member(obj, "list");
+        REQUIRE(list != nullptr);
+        CHECK(json_find_element(list, 0)->bool_);
+        CHECK(json_find_element(list, 1)->tag == JSON_NULL);
+        CHECK(json_find_element(list, 2) == nullptr);
+    }
+
+    SECTION ("it decodes the same as json_decode") {
+        const char *text = "{\"a\":[1,2.5,\"x\\ny\"],\"b\":{\"c\":false}}";
+        string copy = text;
+
+        JsonNode *heap = json_decode(text);
+        JsonNode *in_arena = json_decode_arena(&arena, &copy[0]);
+        REQUIRE(heap != nullptr);
+        REQUIRE(in_arena != nullptr);
+
+        char *heap_json = json_encode(heap);
+        char *arena_json = json_encode(in_arena);
+        CHECK(string(heap_json) == arena_json);
+        free(heap_json);
+        free(arena_json);
+        json_delete(heap);
+    }
+
+    SECTION ("malformed input is rejected") {
+        char bad[] = "{\"msg\":\"key\",\"keycode\":}";
+        CHECK(json_decode_arena(&arena, bad) == nullptr);
+        char trailing[] = "{} x";
+        CHECK(json_decode_arena(&arena, trailing) == nullptr);
+    }
+
+    SECTION ("resetting to a mark reuses the memory after it") {
+        char first[] = "{\"msg\":\"first\"}";
+        JsonNode *outer = json_decode_arena(&arena, first);
+        REQUIRE(outer != nullptr);
+
+        const size_t mark = arena.mark();
+        char second[] = "[1,2,3]";
+        JsonNode *inner = json_decode_arena(&arena, second);
+        REQUIRE(inner != nullptr);
+        arena.reset(mark);
+
+        char third[] = "[4,5,6]";
+        CHECK(json_decode_arena(&arena, third) == inner);
+        CHECK(string(json_find_member(outer, "msg")->string_) == "first");
+    }
+
+    SECTION ("messages bigger than a block still decode") {
+        string big = "[";
+        for (int i = 0; i < 1000; ++i)
+            big += (i ? ",\"" : "\"") + to_string(i) + "\"";
+        big += "]";
+
+        JsonNode *list = json_decode_arena(&arena, &big[0]);
+        REQUIRE(list != nullptr);
+        CHECK(string(json_find_element(list, 999)->string_) == "999");
+    }
+}
@@ -0,0 +1,91 @@
+#include "catch.hpp"
+
+#include "AppHdr.h"
+
+#include <cstring>
+
+#include "lua-pool.h"
+
+static void _fill(void *block, size_t size, char c)
+{
+    memset(block, c, size);
+}
+
+static bool _holds(const void *block, size_t size, char c)
+{
+    const char *bytes = static_cast<const char *>(block);
+    for (size_t i = 0; i < size; ++i)
+        if (bytes[i] != c)
+            return false;
+    return true;
+}
+
+TEST_CASE( "lua_pool keeps count of the bytes in use", "[single-file]" ) {
+
+    lua_pool pool;
+
+    void *a = pool.realloc(nullptr, 0, 24);
+    void *b = pool.realloc(nullptr, 0, 1000);
+    REQUIRE(a);
+    REQUIRE(b);
+    CHECK(pool.used() == 1024);
+
+    a = pool.realloc(a, 24, 40);
+    REQUIRE(a);
+    CHECK(pool.used() == 1040);
+
+    CHECK(pool.realloc(b, 1000, 0) == nullptr);
+    CHECK(pool.used() == 40);
+    CHECK(pool.peak() == 1040);
+
+    pool.realloc(a, 40, 0);
+    CHECK(pool.used() == 0);
+    CHECK(pool.peak() == 1040);
+}
+
+TEST_CASE( "lua_pool keeps contents across size changes", "[single-file]" ) {
+
+    lua_pool pool;
+
+    // Within a size class, between classes, and to and from realloc().
+    const size_t sizes[] = { 1, 7, 8, 9, 100, 256, 257, 4000, 200, 16 };
+    size_t size = sizes[0];
+    void *block = pool.realloc(nullptr, 0, size);
+    REQUIRE(block);
+    _fill(block, size, 'x');
+    for (size_t next : sizes)
+    {
+        block = pool.realloc(block, size, next);
+        REQUIRE(block);
+        CHECK(_holds(block, min(size, next), 'x'));
+        size = next;
+        _fill(block, size, 'x');
+    }
+    pool.realloc(block, size, 0);
+    CHECK(pool.used() == 0);
+}
+
+TEST_CASE( "lua_pool recycles freed blocks", "[single-file]" ) {
+
+    lua_pool pool;
+
+    vector<void *> blocks;
+    for (int i = 0; i < 10000; ++i)
+    {
+        void *block = pool.realloc(nullptr, 0, 8 + i % 200);
+        REQUIRE(block);
+        _fill(block, 8 + i % 200, (char) i);
+        blocks.push_back(block);
+    }
+    for (int i = 0; i < 10000; ++i)
+        CHECK(_holds(blocks[i], 8 + i % 200, (char) i));
+
+    for (int i = 0; i < 10000; ++i)
+        pool.realloc(blocks[i], 8 + i % 200, 0);
+    CHECK(pool.used() == 0);
+
+    // The most recently freed blocks of a size class come back first.
+    CHECK(pool.realloc(nullptr, 0, 3) == blocks[9800]);
+    CHECK(pool.realloc(nullptr, 0, 8) == blocks[9600]);
+    CHECK(pool.realloc(nullptr, 0, 9) == blocks[9808]);
+}
@@ -0,0 +1,87 @@
+#include "catch.hpp"
+
+#include "AppHdr.h"
+
+#include <cstdio>
+#include <memory>
+
+#include "package.h"
+#include "syscalls.h"
+
+static const string TEST_SAVE = "test_package.cs";
+
+static vector<unsigned char> _file_contents()
+{
+    vector<unsigned char> contents;
+    FILE *f = fopen_u(TEST_SAVE.c_str(), "rb");
+    REQUIRE(f);
+    unsigned char buf[4096];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+        contents.insert(contents.end(), buf, buf + got);
+    fclose(f);
+    return contents;
+}
+
+static vector<unsigned char> _read_chunk(package &save, const string &name)
+{
+    unique_ptr<chunk_reader> in(save.reader(name));
+    REQUIRE(in);
+    vector<char> data;
+    in->read_all(data);
+    return vector<unsigned char>(data.begin(), data.end());
+}
+
+TEST_CASE( "package skips writes that wouldn't change a chunk", "[single-file]" ) {
+
+    vector<unsigned char> level(20000);
+    for (size_t i = 0; i < level.size(); ++i)
+        level[i] = i * 7 % 251;
+    const vector<unsigned char> other(level.rbegin(), level.rend());
+
+    {
+        package save(TEST_SAVE.c_str(), true, true);
+        save.write_async("D:3", vector<unsigned char>(level));
+        save.write_async("D:4", vector<unsigned char>(other));
+    }
+    const vector<unsigned char> saved = _file_contents();
+
+    SECTION ("a restored chunk saved again unmodified writes nothing") {
+        {
+            package save(TEST_SAVE.c_str(), true);
+            vector<unsigned char> data = _read_chunk(save, "D:3");
+            REQUIRE(data == level);
+            save.write_async("D:3", move(data));
+            save.commit();
+        }
+        CHECK(_file_contents() == saved);
+    }
+
+    SECTION ("a chunk that wasn't read back is still written") {
+        {
+            package save(TEST_SAVE.c_str(), true);
+            save.write_async("D:3", vector<unsigned char>(level));
+        }
+        CHECK(_file_contents() != saved);
+
+        package save(TEST_SAVE.c_str(), false);
+        CHECK(_read_chunk(save, "D:3") == level);
+    }
+
+    SECTION ("a restored chunk that has changed is written") {
+        {
+            package save(TEST_SAVE.c_str(), true);
+            vector<unsigned char> data = _read_chunk(save, "D:4");
+            data[100] ^= 1;
+            save.write_async("D:4", move(data));
+        }
+        CHECK(_file_contents() != saved);
+
+        package save(TEST_SAVE.c_str(), false);
+        const vector<unsigned char> data = _read_chunk(save, "D:4");
+        CHECK(data[100] == (other[100] ^ 1));
+        CHECK(_read_chunk(save, "D:3") == level);
+    }
+
+    unlink_u(TEST_SAVE.c_str());
+}
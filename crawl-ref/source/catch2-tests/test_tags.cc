@@ -245,3 +245,55 @@ TEST_CASE( "Basic marshalling/unmarshalling works correctly.", "[single-file]" )
         }
     }
 }
+
+TEST_CASE( "Run-length encoded blocks work correctly.", "[single-file]" ) {
+
+    auto roundtrip = [](const vector<uint32_t> &values, int width) {
+        vector<unsigned char> buf;
+        auto w = writer(&buf);
+        marshallRLEBlock(w, values, width);
+
+        auto r = reader(buf);
+        vector<uint32_t> roundtrip_values;
+        unmarshallRLEBlock(r, roundtrip_values, width);
+
+        REQUIRE(values == roundtrip_values);
+        REQUIRE(r.valid() == false);
+        return buf.size();
+    };
+
+    SECTION ("Empty blocks can be roundtripped.") {
+        roundtrip({}, 1);
+        roundtrip({}, 4);
+    }
+
+    SECTION ("Blocks of each width can be roundtripped.") {
+        rng::subgenerator subgen(0, 0);
+
+        for (int width : { 1, 2, 4 })
+        {
+            const uint32_t max_value = width == 4 ? UINT32_MAX
+                                                  : (1u << (8 * width)) - 1;
+            for (auto i = 0; i < 100; i++)
+            {
+                vector<uint32_t> values;
+                const int max_run = 1 + random2(600);
+                while (values.size() < (size_t)(GXM * GYM))
+                {
+                    const uint32_t value = random2(2) ? 0 : max_value
+                                                            - random2(100);
+                    values.insert(values.end(), 1 + random2(max_run), value);
+                }
+                roundtrip(values, width);
+            }
+        }
+    }
+
+    SECTION ("Level-like grids are smaller than when marshalled by element.") {
+        vector<uint32_t> values(GXM * GYM, 0);
+        for (size_t i = 0; i < values.size(); i += 97)
+            values[i] = 0x100;
+
+        REQUIRE(roundtrip(values, 4) < values.size() * 4 / 10);
+    }
+}
@@ -88,6 +88,7 @@ static void _sdump_monster_list(dump_params &);
 static void _sdump_vault_list(dump_params &);
 static void _sdump_skill_gains(dump_params &);
 static void _sdump_action_counts(dump_params &);
+static void _sdump_lua_hooks(dump_params &);
 static void _sdump_separator(dump_params &);
 static void _sdump_lua(dump_params &);
 static bool _write_dump(const string &fname, const dump_params &,
@@ -144,6 +145,7 @@ static dump_section_handler dump_handlers[] =
     { "spell_usage",    _sdump_action_counts }, // compat
     { "action_counts",  _sdump_action_counts },
     { "skill_gains",    _sdump_skill_gains   },
+    { "lua_hooks",      _sdump_lua_hooks     },
 
     // Conveniences for the .crawlrc artist.
     { "",               _sdump_newline       },
@@ -1148,6 +1150,27 @@ static void _sdump_vault_list(dump_params &par)
     }
 }
 
+static void _sdump_lua_hooks(dump_params &par)
+{
+    if (!par.se
+#ifdef WIZARD
+        && !you.wizard && !you.suppress_wizard
+#endif
+       )
+    {
+        return;
+    }
+
+    const vector<string> lines = clua.hook_profile_report();
+    if (lines.empty())
+        return;
+
+    par.text += "Lua hooks run (this session):\n\n";
+    for (const string &line : lines)
+        par.text += line + "\n";
+    par.text += "\n";
+}
+
 static bool _sort_by_first(pair<int, FixedVector<int, 28> > a,
                            pair<int, FixedVector<int, 28> > b)
 {
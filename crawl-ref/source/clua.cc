@@ -3,6 +3,7 @@
 #include "clua.h"
 
 #include <algorithm>
+#include <ctime>
 
 #include "cluautil.h"
 #include "dlua.h"
@@ -11,8 +12,10 @@
 #include "libutil.h"
 #include "l-libs.h"
 #include "maybe-bool.h"
+#include "message.h"
 #include "misc.h" // erase_val
 #include "options.h"
+#include "player.h"
 #include "state.h"
 #include "stringutil.h"
 #include "syscalls.h"
@@ -21,6 +24,7 @@
 
 #define BUGGY_PCALL_ERROR  "667: Malformed response to guarded pcall."
 #define BUGGY_SCRIPT_ERROR "666: Killing badly-behaved Lua script."
+#define BUDGET_SCRIPT_ERROR "668: Lua hook is over its instruction budget."
 
 // 64-bit luajit does not support custom allocators. Only checking
 // TARGET_CPU_X64 because luajit doesn't support other 64-bit archs.
@@ -45,7 +49,8 @@ CLua::CLua(bool managed)
       throttle_sleep_ms(0), throttle_sleep_start(2),
       throttle_sleep_end(800), n_throttle_sleeps(0), mixed_call_depth(0),
       lua_call_depth(0), max_mixed_call_depth(8),
-      max_lua_call_depth(100), memory_used(0),
+      max_lua_call_depth(100), memory(), hook_profiles(),
+      current_hook(nullptr), hook_count_lines(0), lines_since_throttle(0),
       _state(nullptr), sourced_files(), uniqindex(0)
 {
 }
@@ -223,7 +228,7 @@ void CLua::init_throttle()
     if (!managed_vm)
         return;
 
-    if (!crawl_state.throttle)
+    if (!crawl_state.throttle && crawl_state.lua_hook_budget <= 0)
         return;
 
     if (throttle_unit_lines <= 0)
@@ -237,10 +242,14 @@ void CLua::init_throttle()
 
     if (!mixed_call_depth)
     {
+        // Run the hook often enough to keep count of each hook's
+        // instructions, and throttle every throttle_unit_lines of them.
+        hook_count_lines = min(throttle_unit_lines, +HOOK_COUNT_LINES);
         lua_sethook(_state, _clua_throttle_hook,
-                    LUA_MASKCOUNT, throttle_unit_lines);
+                    LUA_MASKCOUNT, hook_count_lines);
         throttle_sleep_ms = 0;
         n_throttle_sleeps = 0;
+        lines_since_throttle = 0;
         crawl_state.lua_script_killed = false;
     }
 }
@@ -362,7 +371,7 @@ bool CLua::runhook(const char *hook, const char *params, ...)
         // So what's on top *is* a function. Call it with the args we have.
         va_list args;
         va_start(args, params);
-        calltopfn(ls, params, args);
+        calltopfn(ls, hook, params, args);
         va_end(args);
     }
     return true;
@@ -501,6 +510,92 @@ int CLua::push_args(lua_State *ls, const char *format, va_list args,
     return argc;
 }
 
+int clua_push_arg(lua_State *ls, bool b)
+{
+    lua_pushboolean(ls, b);
+    return 1;
+}
+
+int clua_push_arg(lua_State *ls, int n)
+{
+    lua_pushnumber(ls, n);
+    return 1;
+}
+
+int clua_push_arg(lua_State *ls, const char *s)
+{
+    if (s)
+        lua_pushstring(ls, s);
+    else
+        lua_pushnil(ls);
+    return 1;
+}
+
+int clua_push_arg(lua_State *ls, const string &s)
+{
+    lua_pushlstring(ls, s.data(), s.size());
+    return 1;
+}
+
+int clua_push_arg(lua_State *ls, const item_def *item)
+{
+    clua_push_item(ls, const_cast<item_def *>(item));
+    return 1;
+}
+
+int clua_push_arg(lua_State *ls, monster *mons)
+{
+    push_monster(ls, mons);
+    return 1;
+}
+
+int clua_push_arg(lua_State *ls, monster_info *mi)
+{
+    lua_push_moninf(ls, mi);
+    return 1;
+}
+
+int clua_push_arg(lua_State *ls, map_def *map)
+{
+    clua_push_map(ls, map);
+    return 1;
+}
+
+int clua_push_arg(lua_State *ls, const dgn_event *devent)
+{
+    clua_push_dgn_event(ls, devent);
+    return 1;
+}
+
+int clua_push_arg(lua_State *ls, const activity_interrupt_data *ai)
+{
+    return 1 + push_activity_interrupt(
+                   ls, const_cast<activity_interrupt_data *>(ai));
+}
+
+void clua_get_result(lua_State *ls, int index, bool &result)
+{
+    result = lua_toboolean(ls, index);
+}
+
+void clua_get_result(lua_State *ls, int index, maybe_bool &result)
+{
+    result = lua_isboolean(ls, index) ? frombool(lua_toboolean(ls, index))
+                                      : MB_MAYBE;
+}
+
+void clua_get_result(lua_State *ls, int index, int &result)
+{
+    if (lua_isnumber(ls, index))
+        result = luaL_safe_checkint(ls, index);
+}
+
+void clua_get_result(lua_State *ls, int index, string &result)
+{
+    if (const char *s = lua_tostring(ls, index))
+        result = s;
+}
+
 int CLua::return_count(lua_State *ls, const char *format)
 {
     UNUSED(ls);
@@ -528,11 +623,84 @@ int CLua::return_count(lua_State *ls, const char *format)
     return 0;
 }
 
-bool CLua::calltopfn(lua_State *ls, const char *params, va_list args,
-                     int retc, va_list *copyto)
+static bool _hook_over_budget(const CLua::hook_profile &profile)
+{
+    return crawl_state.lua_hook_budget > 0
+           && profile.turn_instructions >= crawl_state.lua_hook_budget;
+}
+
+// Accounts for a call from C++ to a hook in a managed VM, and turns the
+// call away if the hook has used up its instruction budget for this turn.
+// Calls made while another is running (such as c_message, for an mpr()
+// from ready()) are charged to the outer one.
+class lua_hook_call
+{
+public:
+    lua_hook_call(CLua &lua, const char *name)
+        : m_lua(lua), m_profile(nullptr), m_skipped(false), m_start(0)
+    {
+        if (!lua.managed_vm || lua.mixed_call_depth)
+            return;
+
+        m_name = name ? name : "<function>";
+        CLua::hook_profile &profile = lua.hook_profiles[m_name];
+        if (profile.turn != you.num_turns)
+        {
+            profile.turn = you.num_turns;
+            profile.turn_instructions = 0;
+        }
+        if (_hook_over_budget(profile))
+        {
+            ++profile.skipped;
+            m_skipped = true;
+            return;
+        }
+
+        ++profile.calls;
+        m_profile = &profile;
+        lua.current_hook = m_profile;
+        m_start = clock();
+    }
+
+    ~lua_hook_call()
+    {
+        if (!m_profile)
+            return;
+
+        m_profile->cpu_ms += (clock() - m_start) * 1000.0 / CLOCKS_PER_SEC;
+        m_lua.current_hook = nullptr;
+        if (_hook_over_budget(*m_profile))
+        {
+            // The count hook cut this call short. Say so once here, rather
+            // than have callers report an error for every skipped call.
+            m_lua.error.clear();
+            mprf(MSGCH_ERROR, "Lua hook %s went over its budget of %d "
+                 "instructions, and won't be run again this turn.",
+                 m_name.c_str(), crawl_state.lua_hook_budget);
+        }
+    }
+
+    bool skipped() const { return m_skipped; }
+
+private:
+    CLua &m_lua;
+    CLua::hook_profile *m_profile;
+    string m_name;
+    bool m_skipped;
+    clock_t m_start;
+};
+
+bool CLua::calltopfn(lua_State *ls, const char *hook, const char *params,
+                     va_list args, int retc, va_list *copyto)
 {
     // We guarantee to remove the function from the stack
     int argc = push_args(ls, params, args, copyto);
+    lua_hook_call profile(*this, hook);
+    if (profile.skipped())
+    {
+        lua_pop(ls, argc + 1);
+        return false;
+    }
     if (retc == -1)
         retc = return_count(ls, params);
     lua_call_throttle strangler(this);
@@ -555,7 +723,7 @@ maybe_bool CLua::callmbooleanfn(const char *fn, const char *params,
     if (!lua_isfunction(ls, -1))
         return MB_MAYBE;
 
-    bool ret = calltopfn(ls, params, args, 1);
+    bool ret = calltopfn(ls, fn, params, args, 1);
     if (!ret)
         return MB_MAYBE;
 
@@ -584,7 +752,7 @@ maybe_bool CLua::callmaybefn(const char *fn, const char *params, va_list args)
     if (!lua_isfunction(ls, -1))
         return MB_MAYBE;
 
-    bool ret = calltopfn(ls, params, args, 1);
+    bool ret = calltopfn(ls, fn, params, args, 1);
     if (!ret)
         return MB_MAYBE;
 
@@ -622,9 +790,20 @@ bool CLua::proc_returns(const char *par) const
 //
 void CLua::pushglobal(const string &name)
 {
-    vector<string> pieces = split_string(".", name);
     lua_State *ls(state());
 
+    // Hooks are called often, and are nearly always plain globals.
+    if (name.find('.') == string::npos)
+    {
+        if (name.empty())
+            lua_pushnil(ls);
+        else
+            lua_getglobal(ls, name.c_str());
+        return;
+    }
+
+    vector<string> pieces = split_string(".", name);
+
     if (pieces.empty())
         lua_pushnil(ls);
 
@@ -672,7 +851,7 @@ bool CLua::callfn(const char *fn, const char *params, ...)
     va_list fnret;
     va_start(args, params);
 
-    bool ret = calltopfn(ls, params, args, -1, &fnret);
+    bool ret = calltopfn(ls, fn, params, args, -1, &fnret);
     if (ret)
     {
         // If we have a > in format, gather return params now.
@@ -684,6 +863,23 @@ bool CLua::callfn(const char *fn, const char *params, ...)
     return ret;
 }
 
+// Pushes the named function, or pushes nothing and returns false if there
+// isn't one.
+bool CLua::pushfunction(const string &name)
+{
+    lua_State *ls = state();
+    if (!ls)
+        return false;
+
+    pushglobal(name);
+    if (!lua_isfunction(ls, -1))
+    {
+        lua_pop(ls, 1);
+        return false;
+    }
+    return true;
+}
+
 bool CLua::callfn(const char *fn, int nargs, int nret)
 {
     error.clear();
@@ -706,6 +902,21 @@ bool CLua::callfn(const char *fn, int nargs, int nret)
             lua_insert(ls, -nargs - 1);
     }
 
+    return callpushed(fn, nargs, nret);
+}
+
+// Calls the function below the top nargs values on the stack, as the named
+// hook (for profiling and budgeting). The function and its args are
+// replaced by nret results, or by nothing if the call fails.
+bool CLua::callpushed(const char *hook, int nargs, int nret)
+{
+    lua_State *ls = state();
+    lua_hook_call profile(*this, hook);
+    if (profile.skipped())
+    {
+        lua_pop(ls, nargs + 1);
+        return false;
+    }
     lua_call_throttle strangler(this);
     int err = lua_pcall(ls, nargs, nret, 0);
     set_error(err, ls);
@@ -726,8 +937,9 @@ void CLua::init_lua()
 # endif
     _state = luaL_newstate();
 #else
-    // Throttle memory usage in managed (clua) VMs
-    _state = managed_vm? lua_newstate(_clua_allocator, this) : luaL_newstate();
+    // Pool memory for all VMs, and throttle memory usage in managed (clua)
+    // ones.
+    _state = lua_newstate(_clua_allocator, this);
 #endif
     if (!_state)
         end(1, false, "Unable to create Lua state.");
@@ -873,6 +1085,42 @@ void CLua::remove_shutdown_listener(lua_shutdown_listener *listener)
     erase_val(shutdown_listeners, listener);
 }
 
+/**
+ * A table of what each hook has cost so far this session, most expensive
+ * first, for the wizard command and the character dump. Empty if no hooks
+ * have been called.
+ */
+vector<string> CLua::hook_profile_report() const
+{
+    vector<pair<string, const hook_profile *>> hooks;
+    for (const auto &entry : hook_profiles)
+        hooks.emplace_back(entry.first, &entry.second);
+    if (hooks.empty())
+        return {};
+
+    sort(hooks.begin(), hooks.end(),
+         [](const pair<string, const hook_profile *> &a,
+            const pair<string, const hook_profile *> &b)
+         {
+             return a.second->cpu_ms > b.second->cpu_ms;
+         });
+
+    vector<string> lines;
+    lines.push_back(make_stringf("%-28s %8s %8s %10s %13s", "Hook", "Calls",
+                                 "Skipped", "CPU (ms)", "Instructions"));
+    for (const auto &hook : hooks)
+    {
+        const hook_profile &p = *hook.second;
+        lines.push_back(make_stringf("%-28s %8u %8u %10.1f %13s",
+                                     hook.first.c_str(), p.calls, p.skipped,
+                                     p.cpu_ms,
+                                     hook_count_lines
+                                         ? to_string(p.instructions).c_str()
+                                         : "-"));
+    }
+    return lines;
+}
+
 // Can be called from within a debugger to look at the current Lua
 // call stack. (Borrowed from ToME 3)
 void CLua::print_stack()
@@ -936,7 +1184,7 @@ bool lua_text_pattern::is_lua_pattern(const string &s)
 
 lua_text_pattern::lua_text_pattern(const string &_pattern)
     : translated(false), isvalid(true), pattern(_pattern),
-      lua_fn_name(new_fn_name())
+      lua_fn_name(new_fn_name()), lua_fn(lua_fn_name)
 {
 }
 
@@ -966,7 +1214,9 @@ bool lua_text_pattern::matches(const string &s) const
     if (!isvalid)
         return false;
 
-    return clua.callbooleanfn(false, lua_fn_name.c_str(), "s", s.c_str());
+    bool matched = false;
+    lua_fn(clua, matched, s);
+    return matched;
 }
 
 pattern_match lua_text_pattern::match_location(const string &s) const
@@ -1100,24 +1350,32 @@ static int _clua_panic(lua_State *ls)
 static void *_clua_allocator(void *ud, void *ptr, size_t osize, size_t nsize)
 {
     CLua *cl = static_cast<CLua *>(ud);
-    cl->memory_used += nsize - osize;
 
-    if (nsize > osize && cl->memory_used >= CLUA_MAX_MEMORY_USE * 1024
-        && cl->mixed_call_depth)
+    if (nsize > osize && cl->managed_vm && cl->mixed_call_depth
+        && cl->memory.used() - osize + nsize
+           > (size_t) crawl_state.lua_max_memory * 1024)
     {
         return nullptr;
     }
 
-    if (!nsize)
-    {
-        free(ptr);
-        return nullptr;
-    }
-    else
-        return realloc(ptr, nsize);
+    return cl->memory.realloc(ptr, osize, nsize);
 }
 #endif
 
+string CLua::memory_summary() const
+{
+#ifdef NO_CUSTOM_ALLOCATOR
+    return "not tracked";
+#else
+    string summary = make_stringf("%d KB in use, at most %d KB",
+                                  (int) (memory.used() / 1024),
+                                  (int) (memory.peak() / 1024));
+    if (managed_vm)
+        summary += make_stringf(" of %d KB", crawl_state.lua_max_memory);
+    return summary;
+#endif
+}
+
 static void _clua_throttle_hook(lua_State *ls, lua_Debug *dbg)
 {
     UNUSED(dbg);
@@ -1132,24 +1390,36 @@ static void _clua_throttle_hook(lua_State *ls, lua_Debug *dbg)
     if (!lua)
         lua = &clua;
 
-    if (lua)
+    if (CLua::hook_profile *hook = lua->current_hook)
     {
-        if (!lua->throttle_sleep_ms)
-            lua->throttle_sleep_ms = lua->throttle_sleep_start;
-        else if (lua->throttle_sleep_ms < lua->throttle_sleep_end)
-            lua->throttle_sleep_ms *= 2;
+        hook->instructions += lua->hook_count_lines;
+        hook->turn_instructions += lua->hook_count_lines;
+        if (_hook_over_budget(*hook))
+            luaL_error(ls, BUDGET_SCRIPT_ERROR);
+    }
 
-        ++lua->n_throttle_sleeps;
+    if (!crawl_state.throttle)
+        return;
+    lua->lines_since_throttle += lua->hook_count_lines;
+    if (lua->lines_since_throttle < lua->throttle_unit_lines)
+        return;
+    lua->lines_since_throttle = 0;
 
-        delay(lua->throttle_sleep_ms);
+    if (!lua->throttle_sleep_ms)
+        lua->throttle_sleep_ms = lua->throttle_sleep_start;
+    else if (lua->throttle_sleep_ms < lua->throttle_sleep_end)
+        lua->throttle_sleep_ms *= 2;
 
-        // Try to kill the annoying script.
-        if (lua->n_throttle_sleeps > CLua::MAX_THROTTLE_SLEEPS)
-        {
-            lua->n_throttle_sleeps = CLua::MAX_THROTTLE_SLEEPS;
-            crawl_state.lua_script_killed = true;
-            luaL_error(ls, BUGGY_SCRIPT_ERROR);
-        }
+    ++lua->n_throttle_sleeps;
+
+    delay(lua->throttle_sleep_ms);
+
+    // Try to kill the annoying script.
+    if (lua->n_throttle_sleeps > CLua::MAX_THROTTLE_SLEEPS)
+    {
+        lua->n_throttle_sleeps = CLua::MAX_THROTTLE_SLEEPS;
+        crawl_state.lua_script_killed = true;
+        luaL_error(ls, BUGGY_SCRIPT_ERROR);
     }
 }
 
@@ -1198,7 +1468,8 @@ static int _clua_guarded_pcall(lua_State *ls)
     if (err)
     {
         const char *errs = lua_tostring(ls, 1);
-        if (!errs || strstr(errs, BUGGY_SCRIPT_ERROR))
+        if (!errs || strstr(errs, BUGGY_SCRIPT_ERROR)
+            || strstr(errs, BUDGET_SCRIPT_ERROR))
             luaL_error(ls, errs? errs : BUGGY_PCALL_ERROR);
     }
 
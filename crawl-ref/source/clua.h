@@ -13,11 +13,18 @@ extern "C" {
 #include <string>
 #include <vector>
 
+#include "lua-pool.h"
 #include "maybe-bool.h"
 
 using std::vector;
 
 class CLua;
+struct activity_interrupt_data;
+class dgn_event;
+struct item_def;
+class map_def;
+class monster;
+struct monster_info;
 
 class lua_stack_cleaner
 {
@@ -126,6 +133,8 @@ public:
                  bool force = false);
 
     void pushglobal(const string &name);
+    bool pushfunction(const string &name);
+    bool callpushed(const char *hook, int nargs, int nret);
 
     maybe_bool callmbooleanfn(const char *fn, const char *params, ...);
     maybe_bool callmaybefn(const char *fn, const char *params, ...);
@@ -166,9 +175,38 @@ public:
     int max_mixed_call_depth;
     int max_lua_call_depth;
 
-    long memory_used;
+    // Everything the state allocates, unless it's 64-bit LuaJIT's.
+    lua_pool memory;
+    string memory_summary() const;
+
+    // The cost of the hooks (functions C++ calls by name) in a managed VM,
+    // this session. Instructions are only counted while the throttle or
+    // the instruction budget is on, and only to within HOOK_COUNT_LINES.
+    struct hook_profile
+    {
+        hook_profile()
+            : calls(0), skipped(0), cpu_ms(0), instructions(0), turn(-1),
+              turn_instructions(0)
+        {
+        }
+
+        unsigned calls;
+        unsigned skipped;           // for being over budget
+        double cpu_ms;
+        int64_t instructions;
+        int turn;                   // the turn turn_instructions is for
+        int64_t turn_instructions;
+    };
+    map<string, hook_profile> hook_profiles;
+    hook_profile *current_hook;
+    // How often the count hook runs, and how far it is to the next throttle.
+    int hook_count_lines;
+    int lines_since_throttle;
+
+    vector<string> hook_profile_report() const;
 
     static const int MAX_THROTTLE_SLEEPS = 15;
+    static const int HOOK_COUNT_LINES = 1000;
 
 private:
     lua_State *_state;
@@ -189,8 +227,8 @@ private:
 
     bool proc_returns(const char *par) const;
 
-    bool calltopfn(lua_State *ls, const char *format, va_list args,
-                   int retc = -1, va_list *fnr = nullptr);
+    bool calltopfn(lua_State *ls, const char *hook, const char *format,
+                   va_list args, int retc = -1, va_list *fnr = nullptr);
     maybe_bool callmbooleanfn(const char *fn, const char *params,
                               va_list args);
     maybe_bool callmaybefn(const char *fn, const char *params,
@@ -211,6 +249,113 @@ private:
     friend class lua_call_throttle;
 };
 
+// Push one argument for a lua_hook call, returning the number of values
+// pushed. These match push_args()'s format characters.
+int clua_push_arg(lua_State *ls, bool b);
+int clua_push_arg(lua_State *ls, int n);
+int clua_push_arg(lua_State *ls, const char *s);
+int clua_push_arg(lua_State *ls, const string &s);
+int clua_push_arg(lua_State *ls, const item_def *item);
+int clua_push_arg(lua_State *ls, monster *mons);
+int clua_push_arg(lua_State *ls, monster_info *mi);
+int clua_push_arg(lua_State *ls, map_def *map);
+int clua_push_arg(lua_State *ls, const dgn_event *devent);
+int clua_push_arg(lua_State *ls, const activity_interrupt_data *ai);
+
+inline int clua_push_args(lua_State *)
+{
+    return 0;
+}
+
+template<typename T, typename... Rest>
+int clua_push_args(lua_State *ls, const T &arg, const Rest &... rest)
+{
+    const int pushed = clua_push_arg(ls, arg);
+    return pushed + clua_push_args(ls, rest...);
+}
+
+// Read a lua_hook's result. bool is Lua's idea of truth, maybe_bool is
+// MB_MAYBE for anything but a boolean, and int and string are left alone
+// if the result isn't one.
+void clua_get_result(lua_State *ls, int index, bool &result);
+void clua_get_result(lua_State *ls, int index, maybe_bool &result);
+void clua_get_result(lua_State *ls, int index, int &result);
+void clua_get_result(lua_State *ls, int index, string &result);
+
+class lua_hook_base
+{
+public:
+    explicit lua_hook_base(const string &fn) : fn_name(fn) { }
+
+    const string &name() const { return fn_name; }
+
+protected:
+    // Leaves the results (if any) on the stack for the caller's
+    // lua_stack_cleaner.
+    template<typename... Args>
+    bool call(CLua &lua, int nret, const Args &... args) const
+    {
+        lua.error.clear();
+        if (!lua.pushfunction(fn_name))
+            return false;
+        const int argc = clua_push_args(lua.state(), args...);
+        return lua.callpushed(fn_name.c_str(), argc, nret);
+    }
+
+private:
+    string fn_name;
+};
+
+// A Lua function, named by a global, that C++ calls with fixed argument and
+// result types: the compiler checks each call against Sig, and nothing is
+// parsed at run time, unlike callfn() and friends with their format strings.
+// For example:
+//
+//     static const lua_hook<maybe_bool(const item_def *, const string &)>
+//         force_pickup("ch_force_autopickup");
+//     maybe_bool res = MB_MAYBE;
+//     force_pickup(clua, res, &item, name);
+//
+// The name is looked up on each call, since scripts may redefine it.
+// A call returns false, leaving the result alone, if there is no such
+// function or it fails (with the error in lua.error).
+template<typename Sig> class lua_hook;
+
+template<typename R, typename... Args>
+class lua_hook<R(Args...)> : public lua_hook_base
+{
+public:
+    explicit lua_hook(const string &fn) : lua_hook_base(fn) { }
+
+    bool operator()(CLua &lua, R &result, Args... args) const
+    {
+        lua_State *ls = lua.state();
+        if (!ls)
+            return false;
+        lua_stack_cleaner clean(ls);
+        if (!call(lua, 1, args...))
+            return false;
+        clua_get_result(ls, -1, result);
+        return true;
+    }
+};
+
+template<typename... Args>
+class lua_hook<void(Args...)> : public lua_hook_base
+{
+public:
+    explicit lua_hook(const string &fn) : lua_hook_base(fn) { }
+
+    bool operator()(CLua &lua, Args... args) const
+    {
+        lua_State *ls = lua.state();
+        if (!ls)
+            return false;
+        lua_stack_cleaner clean(ls);
+        return call(lua, 0, args...);
+    }
+};
+
 class lua_text_pattern : public base_pattern
 {
 public:
@@ -229,6 +374,7 @@ private:
     bool        isvalid;
     string pattern;
     string lua_fn_name;
+    lua_hook<bool(const string &)> lua_fn;
 
     static unsigned int lfndx;
 
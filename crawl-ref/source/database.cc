@@ -8,6 +8,7 @@
 #include "database.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -18,15 +19,19 @@
 #include "clua.h"
 #include "end.h"
 #include "files.h"
+#include "hashdb.h"
 #include "libutil.h"
 #include "options.h"
 #include "random.h"
+#include "startup-profile.h"
 #include "stringutil.h"
 #include "syscalls.h"
 #include "unicode.h"
 
 // TextDB handles dependency checking the db vs text files, creating the
-// db, loading, and destroying the DB.
+// db, loading, and destroying the DB. The db is a hash_db, compiled from
+// the text files into the savedir by whichever process first finds it
+// missing or out of date (or by -builddb), and then mapped by every game.
 class TextDB
 {
 public:
@@ -37,11 +42,9 @@ public:
     ~TextDB() { shutdown(true); delete translation; }
     void init();
     void shutdown(bool recursive = false);
-    DBM* get() { return _db; }
+    const hash_db* get() const { return _db; }
 
-    // Make it easier to migrate from raw DBM* to TextDB
     operator bool() const { return _db != 0; }
-    operator DBM*() const { return _db; }
 
  private:
     bool _needs_update() const;
@@ -52,7 +55,7 @@ public:
     const char* const _db_name;
     string _directory;
     vector<string> _input_files;
-    DBM* _db;
+    hash_db* _db;
     string timestamp;
     TextDB *_parent;
     const char* lang() { return _parent ? Options.lang_name : 0; }
@@ -60,13 +63,11 @@ public:
     TextDB *translation;
 };
 
-// Convenience functions for (read-only) access to generic
-// berkeley DB databases.
-static void _store_text_db(const string &in, DBM *db);
+static void _store_text_db(const string &in, hash_db_writer &db);
 
 static string _query_database(TextDB &db, string key, bool canonicalise_key,
                               bool run_lua, bool untranslated = false);
-static void _add_entry(DBM *db, const string &k, string &v);
+static void _add_entry(hash_db_writer &db, const string &k, string &v);
 
 static TextDB AllDBs[] =
 {
@@ -154,7 +155,7 @@ static string _db_cache_path(string db, const char *lang)
 {
     if (lang)
         db = db + "." + lang;
-    return savedir_versioned_path("db/" + db);
+    return savedir_versioned_path("db/" + db) + ".hdb";
 }
 
 // ----------------------------------------------------------------------
@@ -180,10 +181,10 @@ bool TextDB::open_db()
     if (_db)
         return true;
 
-    const string full_db_path = _db_cache_path(_db_name, lang());
-    _db = dbm_open(full_db_path.c_str(), O_RDONLY, 0660);
-    if (!_db)
+    unique_ptr<hash_db> db(new hash_db);
+    if (!db->open(_db_cache_path(_db_name, lang())))
         return false;
+    _db = db.release();
 
     timestamp = _query_database(*this, "TIMESTAMP", false, false, true);
     if (timestamp.empty())
@@ -215,11 +216,8 @@ void TextDB::init()
 
 void TextDB::shutdown(bool recursive)
 {
-    if (_db)
-    {
-        dbm_close(_db);
-        _db = nullptr;
-    }
+    delete _db;
+    _db = nullptr;
     if (recursive && translation)
         translation->shutdown(recursive);
 }
@@ -265,6 +263,9 @@ bool TextDB::_needs_update() const
 
 void TextDB::_regenerate_db()
 {
+    startup_phase phase(_parent ? make_stringf("regenerate_db:%s [%s]",
+                                               _db_name, Options.lang_name)
+                                : make_stringf("regenerate_db:%s", _db_name));
     shutdown();
     if (_parent)
     {
@@ -282,7 +283,6 @@ void TextDB::_regenerate_db()
     }
 
     string db_path = _db_cache_path(_db_name, lang());
-    string full_db_path = db_path + ".db";
 
     {
         string output_dir = get_parent_directory(db_path);
@@ -290,14 +290,13 @@ void TextDB::_regenerate_db()
             end(1, false, "Cannot create db directory '%s'.", output_dir.c_str());
     }
 
+    // The new db replaces the old one with a rename, so games that still
+    // have the old one mapped carry on undisturbed; the lock only keeps two
+    // processes from compiling it at once.
     file_lock lock(db_path + ".lk", "wb");
-#ifndef DGL_REWRITE_PROTECT_DB_FILES
-    unlink_u(full_db_path.c_str());
-#endif
 
+    hash_db_writer db;
     string ts;
-    if (!(_db = dbm_open(db_path.c_str(), O_RDWR | O_CREAT, 0660)))
-        end(1, true, "Unable to open DB: %s", db_path.c_str());
     for (const string &file : _input_files)
     {
         string full_input_path = _directory + file;
@@ -309,13 +308,13 @@ void TextDB::_regenerate_db()
         {
             snprintf(buf, sizeof(buf), ":%" PRId64, (int64_t)mtime);
             ts += buf;
-            _store_text_db(full_input_path, _db);
+            _store_text_db(full_input_path, db);
         }
     }
-    _add_entry(_db, "TIMESTAMP", ts);
+    _add_entry(db, "TIMESTAMP", ts);
 
-    dbm_close(_db);
-    _db = 0;
+    if (!db.write(db_path))
+        end(1, true, "Unable to write DB: %s", db_path.c_str());
 }
 
 // ----------------------------------------------------------------------
@@ -326,6 +325,7 @@ void TextDB::_regenerate_db()
 
 void databaseSystemInit()
 {
+    startup_phase phase("databaseSystemInit");
     for (unsigned int i = 0; i < NUM_DB; i++)
         AllDBs[i].init();
 }
@@ -339,24 +339,18 @@ void databaseSystemShutdown()
 ////////////////////////////////////////////////////////////////////////////
 // Main DB functions
 
-static datum _database_fetch(DBM *database, const string &key)
+// Points into the db's mapping: no copy is made until the caller needs one.
+static hash_db::entry _database_fetch(const hash_db *database,
+                                      const string &key)
 {
-    datum result;
-    result.dptr = nullptr;
-    result.dsize = 0;
-    datum dbKey;
-
-    dbKey.dptr = (DPTR_COERCE) key.c_str();
-    dbKey.dsize = key.length();
-
     // Don't use the database if called from "monster".
-    if (database)
-        result = dbm_fetch(database, dbKey);
+    if (!database)
+        return { nullptr, 0 };
 
-    return result;
+    return database->find(key);
 }
 
-static vector<string> _database_find_keys(DBM *database,
+static vector<string> _database_find_keys(const hash_db *database,
                                           const string &regex,
                                           bool ignore_case,
                                           db_find_filter filter = nullptr)
@@ -364,11 +358,9 @@ static vector<string> _database_find_keys(DBM *database,
     text_pattern             tpat(regex, ignore_case);
     vector<string> matches;
 
-    datum dbKey = dbm_firstkey(database);
-
-    while (dbKey.dptr != nullptr)
+    for (size_t i = 0; i < database->size(); ++i)
     {
-        string key((const char *)dbKey.dptr, dbKey.dsize);
+        string key = database->key(i).str();
 
         if (tpat.matches(key)
             && key.find("__") == string::npos
@@ -376,14 +368,12 @@ static vector<string> _database_find_keys(DBM *database,
         {
             matches.push_back(key);
         }
-
-        dbKey = dbm_nextkey(database);
     }
 
     return matches;
 }
 
-static vector<string> _database_find_bodies(DBM *database,
+static vector<string> _database_find_bodies(const hash_db *database,
                                             const string &regex,
                                             bool ignore_case,
                                             db_find_filter filter = nullptr)
@@ -391,14 +381,10 @@ static vector<string> _database_find_bodies(DBM *database,
     text_pattern             tpat(regex, ignore_case);
     vector<string> matches;
 
-    datum dbKey = dbm_firstkey(database);
-
-    while (dbKey.dptr != nullptr)
+    for (size_t i = 0; i < database->size(); ++i)
     {
-        string key((const char *)dbKey.dptr, dbKey.dsize);
-
-        datum dbBody = dbm_fetch(database, dbKey);
-        string body((const char *)dbBody.dptr, dbBody.dsize);
+        string key = database->key(i).str();
+        string body = database->value(i).str();
 
         if (tpat.matches(body)
             && key.find("__") == string::npos
@@ -406,8 +392,6 @@ static vector<string> _database_find_bodies(DBM *database,
         {
             matches.push_back(key);
         }
-
-        dbKey = dbm_nextkey(database);
     }
 
     return matches;
@@ -479,21 +463,13 @@ static void _trim_leading_newlines(string &s)
     s.erase(0, s.find_first_not_of("\n"));
 }
 
-static void _add_entry(DBM *db, const string &k, string &v)
+static void _add_entry(hash_db_writer &db, const string &k, string &v)
 {
     _trim_leading_newlines(v);
-    datum key, value;
-    key.dptr = (char *) k.c_str();
-    key.dsize = k.length();
-
-    value.dptr = (char *) v.c_str();
-    value.dsize = v.length();
-
-    if (dbm_store(db, key, value, DBM_REPLACE))
-        end(1, true, "Error storing %s", k.c_str());
+    db.add(k, v);
 }
 
-static void _parse_text_db(LineInput &inf, DBM *db)
+static void _parse_text_db(LineInput &inf, hash_db_writer &db)
 {
     string key;
     string value;
@@ -536,7 +512,7 @@ static void _parse_text_db(LineInput &inf, DBM *db)
         _add_entry(db, key, value);
 }
 
-static void _store_text_db(const string &in, DBM *db)
+static void _store_text_db(const string &in, hash_db_writer &db)
 {
     UTF8FileLineInput inf(in.c_str());
     if (inf.error())
@@ -545,28 +521,44 @@ static void _store_text_db(const string &in, DBM *db)
     _parse_text_db(inf, db);
 }
 
-static string _chooseStrByWeight(const string &entry, int fixed_weight = -1)
+// Picks one of the blank-line separated parts of an entry, each weighted by
+// a "w:<weight>" line before it (10 by default). The entry is looked at in
+// place; only the chosen part is copied.
+static string _chooseStrByWeight(const hash_db::entry &entry,
+                                 int fixed_weight = -1)
 {
-    vector<string> parts;
-    vector<int>    weights;
+    // Where each line starts and ends in the entry.
+    vector<pair<size_t, size_t>> lines;
+    for (size_t start = 0;;)
+    {
+        const char *nl = static_cast<const char *>(
+            memchr(entry.data + start, '\n', entry.size - start));
+        const size_t end = nl ? nl - entry.data : entry.size;
+        lines.emplace_back(start, end);
+        if (!nl)
+            break;
+        start = end + 1;
+    }
 
-    vector<string> lines = split_string("\n", entry, false, true);
+    vector<pair<size_t, size_t>> parts;
+    vector<int>                  weights;
 
     int total_weight = 0;
     for (int i = 0, size = lines.size(); i < size; i++)
     {
         // Skip over multiple blank lines, and leading and trailing
         // blank lines.
-        while (i < size && lines[i].empty())
+        while (i < size && lines[i].first == lines[i].second)
             i++;
 
         if (i == size)
             break;
 
-        int         weight;
-        string part = "";
-
-        if (sscanf(lines[i].c_str(), "w:%d", &weight))
+        int weight;
+        if (entry.data[lines[i].first] == 'w'
+            && sscanf(string(entry.data + lines[i].first,
+                             entry.data + lines[i].second).c_str(),
+                      "w:%d", &weight))
         {
             i++;
             if (i == size)
@@ -577,14 +569,12 @@ static string _chooseStrByWeight(const string &entry, int fixed_weight = -1)
 
         total_weight += weight;
 
-        while (i < size && !lines[i].empty())
-        {
-            part += lines[i++];
-            part += "\n";
-        }
-        trim_string(part);
+        const size_t part_start = lines[i].first;
+        size_t part_end = part_start;
+        while (i < size && lines[i].first != lines[i].second)
+            part_end = lines[i++].second;
 
-        parts.push_back(part);
+        parts.emplace_back(part_start, part_end);
         weights.push_back(total_weight);
     }
 
@@ -599,7 +589,12 @@ static string _chooseStrByWeight(const string &entry, int fixed_weight = -1)
 
     for (int i = 0, size = parts.size(); i < size; i++)
         if (choice < weights[i])
-            return parts[i];
+        {
+            string part(entry.data + parts[i].first,
+                        entry.data + parts[i].second);
+            trim_string(part);
+            return part;
+        }
 
     return "BUG, NO STRING CHOSEN";
 }
@@ -616,14 +611,14 @@ static string _getWeightedString(TextDB &db, const string &key,
     lowercase(canonical_key);
 
     // Query the DB.
-    datum result;
+    hash_db::entry result = { nullptr, 0 };
 
     if (db.translation)
         result = _database_fetch(db.translation->get(), canonical_key);
-    if (result.dsize <= 0)
+    if (!result.size)
         result = _database_fetch(db.get(), canonical_key);
 
-    if (result.dsize <= 0)
+    if (!result.size)
     {
         // Try ignoring the suffix.
         canonical_key = key;
@@ -632,17 +627,14 @@ static string _getWeightedString(TextDB &db, const string &key,
         // Query the DB.
         if (db.translation)
             result = _database_fetch(db.translation->get(), canonical_key);
-        if (result.dsize <= 0)
+        if (!result.size)
             result = _database_fetch(db.get(), canonical_key);
 
-        if (result.dsize <= 0)
+        if (!result.size)
             return "";
     }
 
-    // Cons up a (C++) string to return. The caller must release it.
-    string str = string((const char *)result.dptr, result.dsize);
-
-    return _chooseStrByWeight(str, fixed_weight);
+    return _chooseStrByWeight(result, fixed_weight);
 }
 
 static void _call_recursive_replacement(string &str, TextDB &db,
@@ -730,27 +722,29 @@ static string _query_database(TextDB &db, string key, bool canonicalise_key,
     }
 
     // Query the DB.
-    datum result;
+    hash_db::entry result = { nullptr, 0 };
 
     if (db.translation && !untranslated)
         result = _database_fetch(db.translation->get(), key);
-    if (result.dsize <= 0)
+    if (!result.size)
         result = _database_fetch(db.get(), key);
 
-    if (result.dsize <= 0)
+    if (!result.size)
         return "";
 
-    string str((const char *)result.dptr, result.dsize);
-
     // <foo> is an alias to key foo
-    if (str[0] == '<' && str[str.size() - 2] == '>'
-        && str.find('<', 1) == str.npos
-        && str.find('\n') == str.size() - 1)
+    const char *text = result.data;
+    if (result.size > 2 && text[0] == '<' && text[result.size - 2] == '>'
+        && !memchr(text + 1, '<', result.size - 1)
+        && memchr(text, '\n', result.size) == text + result.size - 1)
     {
-        return _query_database(db, str.substr(1, str.size() - 3),
+        return _query_database(db, string(text + 1, result.size - 3),
                                canonicalise_key, run_lua, untranslated);
     }
 
+    // Only the text we return gets copied, since it will be edited.
+    string str = result.str();
+
     _substitute_descriptions(db, str, canonicalise_key, run_lua, untranslated);
 
     if (run_lua)
@@ -801,8 +795,7 @@ vector<string> getLongDescBodiesByRegex(const string &regex,
     // On partial translations, this will match only translated descriptions.
     // Not good, but otherwise we'd have to check hundreds of keys, with
     // two queries for each.
-    // SQL can do this in one go, DBM can't.
-    DBM *database = DescriptionDB.translation ?
+    const hash_db *database = DescriptionDB.translation ?
         DescriptionDB.translation->get() : DescriptionDB.get();
     return _database_find_bodies(database, regex, true, filter);
 }
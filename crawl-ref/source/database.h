@@ -10,23 +10,6 @@
 
 using std::vector;
 
-#ifdef DB_NDBM
-extern "C" {
-#   include <ndbm.h>
-}
-#elif defined(DB_DBH)
-extern "C" {
-#   define DB_DBM_HSEARCH 1
-#   include <db.h>
-}
-#elif defined(USE_SQLITE_DBM)
-#   include "sqldbm.h"
-#else
-#   error DBM interfaces unavailable!
-#endif
-
-#define DPTR_COERCE char *
-
 void databaseSystemInit();
 void databaseSystemShutdown();
 
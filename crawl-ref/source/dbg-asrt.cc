@@ -752,6 +752,8 @@ void do_crash_dump()
 
     // If anything has screwed up the Lua runtime stacks then trying to
     // print those stacks will likely crash, so do this after the others.
+    fprintf(file, "clua memory: %s\n", clua.memory_summary().c_str());
+    fprintf(file, "dlua memory: %s\n", dlua.memory_summary().c_str());
     fprintf(file, "clua stack:\n");
     clua.print_stack();
 
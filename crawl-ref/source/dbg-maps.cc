@@ -7,22 +7,33 @@
 
 #include "dbg-maps.h"
 
+#include <chrono>
+#include <cinttypes>
+#ifdef UNIX
+#include <sys/resource.h>
+#endif
+
 #include "branch.h"
 #include "chardump.h"
 #include "crash.h"
 #include "dbg-objstat.h"
 #include "dungeon.h"
+#include "end.h"
 #include "env.h"
 #include "initfile.h"
 #include "libutil.h"
 #include "maps.h"
 #include "message.h"
 #include "ng-init.h"
+#include "options.h"
 #include "player.h"
+#include "random.h"
 #include "shopping.h"
 #include "state.h"
 #include "stringutil.h"
+#include "syscalls.h"
 #include "tag-version.h"
+#include "version.h"
 #include "view.h"
 
 #ifdef DEBUG_STATISTICS
@@ -47,6 +58,11 @@ static int build_attempts = 0, level_vetoes = 0;
 // Map from message to counts.
 static map<string, int> veto_messages;
 
+// Level generation benchmark (-bench-levelgen): wall-clock time of each
+// builder() call, in milliseconds, by branch.
+static map<branch_type, vector<double>> bench_build_times;
+static map<branch_type, int> bench_failures;
+
 void mapstat_report_map_build_start()
 {
     build_attempts++;
@@ -93,7 +109,18 @@ static bool _do_build_level()
     }
 
     ++levels_tried;
-    if (!builder())
+    const auto build_start = chrono::steady_clock::now();
+    const bool built = builder();
+    if (crawl_state.levelgen_bench)
+    {
+        const chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - build_start;
+        bench_build_times[you.where_are_you].push_back(elapsed.count());
+        if (!built)
+            ++bench_failures[you.where_are_you];
+    }
+
+    if (!built)
     {
         ++levels_failed;
         // Abort level build failure in objstat since the statistics will be
@@ -261,6 +288,9 @@ bool mapstat_build_levels()
              build_attempts ? level_vetoes * 100.0 / build_attempts : 0.0);
         printf("%d..", i + 1);
         fflush(stdout);
+        // Use a fixed seed sequence so that benchmark runs are comparable.
+        if (crawl_state.levelgen_bench)
+            rng::seed((Options.seed ? Options.seed : 1) + i);
         dlua.callfn("dgn_clear_data", "");
         you.uniq_map_tags.clear();
         you.uniq_map_names.clear();
@@ -490,6 +520,135 @@ static void _write_map_stats()
     printf("\n");
 }
 
+static double _percentile(const vector<double> &sorted, int pct)
+{
+    if (sorted.empty())
+        return 0.0;
+    // Nearest-rank percentile.
+    const size_t rank = (sorted.size() * pct + 99) / 100;
+    return sorted[max<size_t>(rank, 1) - 1];
+}
+
+static long _peak_rss_kb()
+{
+#ifdef UNIX
+    struct rusage usage;
+    if (!getrusage(RUSAGE_SELF, &usage))
+    {
+#ifdef __APPLE__
+        return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+    return -1;
+}
+
+struct bench_times
+{
+    double p50;
+    double p95;
+};
+
+// Read per-branch build times from an earlier levelgen-bench.txt.
+static map<string, bench_times> _read_bench_baseline(const string &filename)
+{
+    map<string, bench_times> baseline;
+    FILE *inf = fopen_u(filename.c_str(), "r");
+    if (!inf)
+    {
+        end(1, true, "Can't open levelgen benchmark baseline '%s'",
+            filename.c_str());
+    }
+
+    char buf[256];
+    while (fgets(buf, sizeof buf, inf))
+    {
+        if (buf[0] == '#')
+            continue;
+
+        const vector<string> fields = split_string(" ", buf);
+        if (fields.size() < 7)
+            continue;
+        baseline[fields[0]] = { atof(fields[5].c_str()),
+                                atof(fields[6].c_str()) };
+    }
+    fclose(inf);
+    return baseline;
+}
+
+// A branch regresses if its p50 or p95 build time grows by more than this
+// many percent relative to the baseline. Very fast branches are too noisy
+// to judge, so only flag regressions of at least a millisecond.
+static const int BENCH_REGRESSION_PCT = 10;
+
+static bool _bench_regressed(double old_ms, double new_ms)
+{
+    return new_ms - old_ms >= 1.0
+           && new_ms > old_ms * (100 + BENCH_REGRESSION_PCT) / 100;
+}
+
+// Write the levelgen benchmark report, and compare it against the baseline
+// if one was given. Returns false if any branch regressed.
+static bool _write_levelgen_bench()
+{
+    // Read the baseline first, in case it's the file we're about to write.
+    map<string, bench_times> baseline;
+    if (!SysEnv.levelgen_bench_baseline.empty())
+        baseline = _read_bench_baseline(SysEnv.levelgen_bench_baseline);
+
+    const char *out_file = "levelgen-bench.txt";
+    FILE *outf = fopen_u(out_file, "w");
+    if (!outf)
+        end(1, true, "Can't write levelgen benchmark to '%s'", out_file);
+
+    printf("Writing levelgen benchmark to %s...\n", out_file);
+
+    map<branch_type, pair<int, int>> branch_builds;
+    for (const auto &entry : map_builds)
+    {
+        branch_builds[entry.first.branch].first += entry.second.first;
+        branch_builds[entry.first.branch].second += entry.second.second;
+    }
+
+    fprintf(outf, "# %s; %d iteration(s), base seed %" PRIu64 "\n",
+            Version::Long, SysEnv.map_gen_iters,
+            Options.seed ? Options.seed : 1);
+    fprintf(outf, "# branch levels builds vetoes failed p50_ms p95_ms\n");
+
+    bool regressed = false;
+    for (auto &entry : bench_build_times)
+    {
+        vector<double> &times = entry.second;
+        sort(times.begin(), times.end());
+
+        const string br = branches[entry.first].abbrevname;
+        const bench_times now = { _percentile(times, 50),
+                                  _percentile(times, 95) };
+        const pair<int, int> builds = branch_builds[entry.first];
+
+        fprintf(outf, "%s %d %d %d %d %.3f %.3f\n", br.c_str(),
+                (int)times.size(), builds.first, builds.second,
+                bench_failures[entry.first], now.p50, now.p95);
+
+        const bench_times *old = map_find(baseline, br);
+        if (!old)
+            continue;
+
+        const bool bad = _bench_regressed(old->p50, now.p50)
+                         || _bench_regressed(old->p95, now.p95);
+        printf("%s%-8s p50 %8.3f -> %8.3f ms, p95 %8.3f -> %8.3f ms\n",
+               bad ? "REGRESSION: " : "", br.c_str(), old->p50, now.p50,
+               old->p95, now.p95);
+        regressed = regressed || bad;
+    }
+
+    fprintf(outf, "# peak_rss_kb %ld\n", _peak_rss_kb());
+    fclose(outf);
+    return !regressed;
+}
+
 bool mapstat_find_forced_map()
 {
     const map_def *map = find_map_by_name(crawl_state.force_map);
@@ -538,6 +697,14 @@ void mapstat_generate_stats()
 
     mapstat_build_levels();
 
+    if (crawl_state.levelgen_bench)
+    {
+        if (!_write_levelgen_bench())
+            end(1, false, "Level generation is slower than the baseline.\n");
+        printf("Levelgen benchmark complete.\n");
+        return;
+    }
+
     _write_map_stats();
     printf("Map stats complete.\n");
 }
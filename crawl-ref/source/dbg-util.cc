@@ -8,7 +8,9 @@
 #include "dbg-util.h"
 
 #include "artefact.h"
+#include "clua.h"
 #include "directn.h"
+#include "dlua.h"
 #include "dungeon.h"
 #include "format.h"
 #include "item-name.h"
@@ -594,3 +596,18 @@ void wizard_toggle_dprf()
     }
 }
 #endif
+
+void wizard_list_lua_hooks()
+{
+    mprf(MSGCH_DIAGNOSTICS, "clua memory: %s", clua.memory_summary().c_str());
+    mprf(MSGCH_DIAGNOSTICS, "dlua memory: %s", dlua.memory_summary().c_str());
+
+    const vector<string> lines = clua.hook_profile_report();
+    if (lines.empty())
+    {
+        mpr("No client Lua hooks have been run.");
+        return;
+    }
+    for (const string &line : lines)
+        mprf(MSGCH_DIAGNOSTICS, "%s", line.c_str());
+}
@@ -36,6 +36,7 @@ void debug_dump_item(const char *name, int num, const item_def &item,
 string debug_mon_str(const monster* mon);
 
 void wizard_toggle_dprf();
+void wizard_list_lua_hooks();
 void debug_list_vacant_keys();
 
 vector<string> level_vault_names(bool force_all=false);
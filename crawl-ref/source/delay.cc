@@ -909,10 +909,14 @@ static maybe_bool _userdef_interrupt_activity(Delay* delay,
             return MB_TRUE;
     }
 
-    if (delay->is_macro() && clua.callbooleanfn(true, "c_interrupt_macro",
-                                                "sA", interrupt_name, &at))
+    static const lua_hook<bool(const char *, const activity_interrupt_data *)>
+        interrupt_macro("c_interrupt_macro");
+    bool stopmacro = true;
+    if (delay->is_macro())
     {
-        return MB_TRUE;
+        interrupt_macro(clua, stopmacro, interrupt_name, &at);
+        if (stopmacro)
+            return MB_TRUE;
     }
     return MB_MAYBE;
 }
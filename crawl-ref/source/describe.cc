@@ -3118,7 +3118,10 @@ static vector<command_type> _allowed_actions(const item_def& item)
         actions.push_back(CMD_QUIVER_ITEM);
 
     // what is this for?
-    if (clua.callbooleanfn(false, "ch_item_wieldable", "i", &item))
+    static const lua_hook<bool(const item_def *)>
+        item_wieldable("ch_item_wieldable");
+    bool wieldable = false;
+    if (item_wieldable(clua, wieldable, &item) && wieldable)
         actions.push_back(CMD_WIELD_WEAPON);
 
     switch (item.base_type)
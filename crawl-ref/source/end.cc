@@ -30,6 +30,7 @@
 #include "misc.h"
 #include "prompt.h"
 #include "religion.h"
+#include "startup-profile.h"
 #include "startup.h"
 #include "state.h"
 #include "stringutil.h"
@@ -197,6 +198,7 @@ NORETURN void end(int exit_code, bool print_error, const char *format, ...)
         tiles.shutdown();
 #endif
 
+        startup_profile_finish();
         cio_cleanup();
         msg::deinitialise_mpr_streams();
         _clear_globals_on_exit();
@@ -38,6 +38,7 @@
 #include "abyss.h"
 #include "act-iter.h"
 #include "areas.h"
+#include "bones-store.h"
 #include "branch.h"
 #include "chardump.h"
 #include "cloud.h"
@@ -137,13 +138,14 @@ static bool _ghost_version_compatible(const save_version &version);
 
 static bool _restore_tagged_chunk(package *save, const string &name,
                                   tag_type tag, const char* complaint);
+static void _restore_level(const string &level_name);
 static player_save_info _read_character_info(package *save);
 
 static bool _convert_obsolete_species();
 
 const short GHOST_SIGNATURE = short(0xDC55);
 
-const int GHOST_LIMIT = 27; // max number of ghost files per level
+const int GHOST_LIMIT = 27; // max number of ghost records per level
 
 static void _redraw_all()
 {
@@ -1043,14 +1045,35 @@ void write_ghost_version(writer &outf)
         marshallInt(outf, 0);
 }
 
+// Levels are rewritten on every level change, so favour speed over size.
 static void _write_tagged_chunk(const string &chunkname, tag_type tag)
 {
-    writer outf(you.save, chunkname);
+    writer outf(you.save, chunkname,
+                tag == TAG_LEVEL ? SAVE_COMPRESSION_FAST : SAVE_COMPRESSION);
 
     write_save_version(outf, save_version::current());
     tag_write(tag, outf);
 }
 
+static string _level_band_chunk(const string &level_name, int band)
+{
+    return make_stringf("%s#%d", level_name.c_str(), band);
+}
+
+// Bands that are unchanged since they were last written are dropped by
+// the package, so this only costs the marshalling.
+static void _write_level_bands(const string &level_name)
+{
+    for (int band = 0; band < LEVEL_BANDS; ++band)
+    {
+        writer outf(you.save, _level_band_chunk(level_name, band),
+                    SAVE_COMPRESSION_FAST);
+
+        write_save_version(outf, save_version::current());
+        tag_write_level_band(band, outf);
+    }
+}
+
 static int _get_dest_stair_type(dungeon_feature_type stair_taken,
                                 bool &find_first)
 {
@@ -1768,8 +1791,7 @@ bool generate_level(const level_id &l)
         // the level generated before the portals.
         ASSERT(you.save->has_chunk(save_name));
         dprf("Reloading new level '%s'.", save_name.c_str());
-        _restore_tagged_chunk(you.save, save_name, TAG_LEVEL,
-            "Level file is invalid.");
+        _restore_level(save_name);
     }
     // Did the generation process actually manage to place the player? This is
     // a useful sanity check, and also is necessary for the initial loading
@@ -2157,7 +2179,7 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
         }
 
         dprf("Loading old level '%s'.", level_name.c_str());
-        _restore_tagged_chunk(you.save, level_name, TAG_LEVEL, "Level file is invalid.");
+        _restore_level(level_name);
         if (load_mode != LOAD_VISITOR)
             you.on_current_level = true;
         _redraw_all(); // TODO why is there a redraw call here?
@@ -2434,6 +2456,7 @@ void save_level(const level_id& lid)
     // Nail all items to the ground.
     fix_item_coordinates();
 
+    _write_level_bands(lid.describe());
     _write_tagged_chunk(lid.describe(), TAG_LEVEL);
 }
 
@@ -2500,6 +2523,11 @@ static void _save_game_exit()
     if (!you.entering_level)
         save_level(level_id::current());
 
+    // Wait for the background writer before telling anyone we've saved;
+    // doing it here rather than in the destructor also lets errors be
+    // reported normally.
+    you.save->commit();
+
     clrscr();
 
     save_game_prefs();
@@ -2521,6 +2549,10 @@ void save_game(bool leave_game, const char *farewellmsg)
     // that can.
     ASSERT(you.on_current_level || Options.no_save);
 
+    // Chunks are written and committed in the background; don't let
+    // checkpoints pile up behind a slow disk, and report any error from the
+    // last one before writing more.
+    you.save->wait_for_commit();
 
     if (leave_game && Options.dump_on_save)
     {
@@ -2545,7 +2577,7 @@ void save_game(bool leave_game, const char *farewellmsg)
     {
         if (!crawl_state.disables[DIS_SAVE_CHECKPOINTS])
         {
-            you.save->commit();
+            you.save->commit_async();
             save_game_prefs();
         }
         return;
@@ -2592,114 +2624,125 @@ static string _make_ghost_filename(bool store=false)
     return string("bones.") + (store ? "store." : "") + level_desc;
 }
 
-static string _bones_permastore_file()
+static vector<unsigned char> _read_bones_file(const string &filename)
 {
-    string filename = _make_ghost_filename(true);
-    string full_path = _get_bonefile_directory() + filename;
-    if (file_exists(full_path))
-        return full_path;
-
-    string dist_full_path = datafile_path(
-            string("dist_bones") + FILE_SEPARATOR + filename, false, false);
-    if (dist_full_path.empty())
-        return dist_full_path;
-
-    // no matching permastore is in the player's bones file, but one exists in
-    // the crawl distribution. Install it.
+    vector<unsigned char> data;
+    if (filename.empty())
+        return data;
 
-    FILE *src = fopen(dist_full_path.c_str(), "rb");
-    if (!src)
-    {
-        mprf(MSGCH_ERROR, "Bones file exists but can't be opened: %s",
-            dist_full_path.c_str());
-        return "";
-    }
-    FILE *target = lk_open("wb", full_path);
-    if (!target)
-    {
-        mprf(MSGCH_ERROR, "Unable to open bones file %s for writing",
-            full_path.c_str());
-        fclose(src);
-        return "";
-    }
-
-    _ghost_dprf("Copying %s to %s", dist_full_path.c_str(), full_path.c_str());
-
-    char buf[BUFSIZ];
+    FILE *handle = lk_open("rb", filename);
+    if (!handle)
+        return data;
 
+    unsigned char buf[BUFSIZ];
     size_t size;
-    while ((size = fread(buf, sizeof(char), BUFSIZ, src)) > 0)
-        fwrite(buf, sizeof(char), size, target);
+    while ((size = fread(buf, sizeof(char), BUFSIZ, handle)) > 0)
+        data.insert(data.end(), buf, buf + size);
 
-    lk_close(target);
+    lk_close(handle);
+    return data;
+}
 
-    if (!feof(src))
-    {
-        mprf(MSGCH_ERROR, "Error installing bones file to %s",
-                                                    full_path.c_str());
-        if (unlink(full_path.c_str()) != 0)
-        {
-            mprf(MSGCH_ERROR,
-                "Failed to unlink probably corrupt bones file: %s",
-                full_path.c_str());
-        }
-        fclose(src);
-        return "";
-    }
-    fclose(src);
-    return full_path;
+/**
+ * The permastore file for the current level, from the bones directory or
+ * else the ones that come with crawl.
+ *
+ * @return The contents of the file, or nothing if there isn't one.
+ */
+static vector<unsigned char> _read_permastore_file()
+{
+    const string filename = _make_ghost_filename(true);
+    const string full_path = _get_bonefile_directory() + filename;
+    if (file_exists(full_path))
+        return _read_bones_file(full_path);
+
+    return _read_bones_file(datafile_path(
+            string("dist_bones") + FILE_SEPARATOR + filename, false, false));
 }
 
 // Bones files
 //
-// There are two kinds of bones files: temporary bones files and the
-// permastore. Temporary bones files are ephemeral: ghosts will be reused only
-// if they are on the floor where the player dies. The permastore is a more
-// permanent stock of ghosts (per level) to use as a backup in case the
-// temporary bones files are depleted.
+// There are two kinds of bones: temporary bones and the permastore.
+// Temporary bones are ephemeral: ghosts will be reused only if they are on
+// the floor where the player dies. The permastore is a more permanent stock
+// of ghosts (per level) to use as a backup in case the temporary bones are
+// depleted.
+//
+// Both live in a single bones store (see bones-store.h), under the names
+// their bones files used to have: each death adds a record to bones.D-5,
+// say, and the permastore is the one record of bones.store.D-5. Each record
+// holds exactly what the bones file would have.
+
+static string _bones_store_file()
+{
+    return _get_bonefile_directory() + "bones.db";
+}
+
+static bool _backup_bones_for_upgrade(string ghost_filename, save_version &v);
+
+static save_version _bones_record_version(const vector<unsigned char> &data)
+{
+    reader inf(data);
+    inf.set_safe_read(true); // don't die on 0-byte bones
+    return read_ghost_header(inf);
+}
 
 /**
- * Lists all bonefiles for the current level.
+ * Move bones files from before the bones store into it, when it's new.
  *
- * @return A vector containing absolute paths to 0+ bonefiles.
+ * That's the ephemeral bones files in the bones directory (bones.D-5_3), and
+ * the even older ones in the save directory (bones.D-5). Permastore files
+ * are left in place, and copied into the store as each is first used.
  */
-static vector<string> _list_bones()
+static void _import_bones_files(bones_store &store)
 {
-    string bonefile_dir = _get_bonefile_directory();
-    string base_filename = _make_ghost_filename();
-    string underscored_filename = base_filename + "_";
+    if (!store.created())
+        return;
 
-    vector<string> filenames = get_dir_files_sorted(bonefile_dir);
-    vector<string> bonefiles;
-    for (const auto &filename : filenames)
-        if (starts_with(filename, underscored_filename)
-                                            && !ends_with(filename, ".backup"))
+    vector<pair<string, string>> files; // filename, key
+    const string bonefile_dir = _get_bonefile_directory();
+    for (const string &filename : get_dir_files_sorted(bonefile_dir))
+    {
+        const size_t sep = filename.rfind('_');
+        if (starts_with(filename, "bones.")
+            && !starts_with(filename, "bones.store.")
+            && !ends_with(filename, ".backup") && sep != string::npos)
         {
-            bonefiles.push_back(bonefile_dir + filename);
-            _ghost_dprf("bonesfile %s", (bonefile_dir + filename).c_str());
+            files.emplace_back(bonefile_dir + filename,
+                               filename.substr(0, sep));
         }
-
-    string old_bonefile = _get_old_bonefile_directory() + base_filename;
-    if (access(old_bonefile.c_str(), F_OK) == 0)
+    }
+    const string old_dir = _get_old_bonefile_directory();
+    for (const string &filename : get_dir_files_sorted(old_dir))
     {
-        _ghost_dprf("Found old bonefile %s", old_bonefile.c_str());
-        bonefiles.push_back(old_bonefile);
+        if (starts_with(filename, "bones.")
+            && filename.find('_') == string::npos
+            && !ends_with(filename, ".backup"))
+        {
+            files.emplace_back(old_dir + filename, filename);
+        }
     }
 
-    return bonefiles;
-}
-
-/**
- * Attempts to find a file containing ghost(s) appropriate for the player.
- *
- * @return The filename of an appropriate bones file; may be "".
- */
-static string _find_ghost_file()
-{
-    vector<string> bonefiles = _list_bones();
-    if (bonefiles.empty())
-        return "";
-    return bonefiles[random2(bonefiles.size())];
+    for (const auto &file : files)
+    {
+        vector<unsigned char> data = _read_bones_file(file.first);
+        save_version version = _bones_record_version(data);
+        if (!version.valid())
+            mprf(MSGCH_ERROR, "Clearing bad bones file: %s", file.first.c_str());
+        else
+        {
+            if (version < save_version::current_bones())
+                _backup_bones_for_upgrade(file.first, version);
+            if (!store.add(file.second, data, GHOST_LIMIT))
+                continue;
+            _ghost_dprf("Moved %s into the bones store", file.first.c_str());
+        }
+        if (unlink(file.first.c_str()) != 0)
+        {
+            mprf(MSGCH_ERROR, "Failed to unlink bones file: %s",
+                 file.first.c_str());
+        }
+    }
 }
 
 static string _old_bones_filename(string ghost_filename, const save_version &v)
@@ -2811,121 +2854,139 @@ save_version read_ghost_header(reader &inf)
     return version;
 }
 
-vector<ghost_demon> load_bones_file(string ghost_filename, bool backup)
+// Read the ghosts in a bones file or bones record, whose header says it's
+// from version.
+static vector<ghost_demon> _read_bones(reader &inf, const string &name,
+                                       save_version &version)
 {
-    vector<ghost_demon> result;
-
-    if (ghost_filename.empty())
-        return result; // no such ghost.
-
-    reader inf(ghost_filename);
-    if (!inf.valid())
-    {
-        // file doesn't exist
-        _ghost_dprf("Ghost file '%s' invalid before read.", ghost_filename.c_str());
-        return result;
-    }
-
     inf.set_safe_read(true); // don't die on 0-byte bones
-    save_version version = read_ghost_header(inf);
+    version = read_ghost_header(inf);
     if (!_ghost_version_compatible(version))
     {
-        string error = "Incompatible bones file: " + ghost_filename;
+        string error = "Incompatible bones file: " + name;
         throw corrupted_save(error, version);
     }
     inf.setMinorVersion(version.minor);
-    if (backup && version < save_version::current_bones())
-        _backup_bones_for_upgrade(ghost_filename, version);
 
+    vector<ghost_demon> result;
     try
     {
         result = tag_read_ghosts(inf);
-        inf.fail_if_not_eof(ghost_filename);
+        inf.fail_if_not_eof(name);
     }
     catch (short_read_exception &short_read)
     {
-        string error = "Broken bones file: " + ghost_filename;
+        string error = "Broken bones file: " + name;
         throw corrupted_save(error, version);
     }
-    inf.close();
 
     if (!debug_check_ghosts(result))
     {
-        string error = "Bones file is buggy: " + ghost_filename;
+        string error = "Bones file is buggy: " + name;
         throw corrupted_save(error, version);
     }
 
     return result;
 }
 
+vector<ghost_demon> load_bones_file(string ghost_filename, bool backup)
+{
+    vector<ghost_demon> result;
+
+    if (ghost_filename.empty())
+        return result; // no such ghost.
+
+    reader inf(ghost_filename);
+    if (!inf.valid())
+    {
+        // file doesn't exist
+        _ghost_dprf("Ghost file '%s' invalid before read.", ghost_filename.c_str());
+        return result;
+    }
+
+    save_version version;
+    result = _read_bones(inf, ghost_filename, version);
+    inf.close();
+
+    if (backup && version < save_version::current_bones())
+        _backup_bones_for_upgrade(ghost_filename, version);
+
+    return result;
+}
+
+/**
+ * Read the ghosts from a bones store record.
+ *
+ * @param data the record, which holds what a bones file would.
+ * @param key  the record's key, for error messages.
+ * @throws corrupted_save if the record can't be used.
+ */
+vector<ghost_demon> load_bones_record(const vector<unsigned char> &data,
+                                      const string &key)
+{
+    reader inf(data);
+    save_version version;
+    return _read_bones(inf, key, version);
+}
 
-static vector<ghost_demon> _load_ghosts_core(string filename,
-                                                        bool backup_on_upgrade)
+// Bad ephemeral records have already left the store, and a bad permastore
+// is replaced the next time it's updated, so all that's left is to report
+// them.
+static vector<ghost_demon> _read_bones_record(const vector<unsigned char> &data,
+                                              const string &key)
 {
-    vector<ghost_demon> results;
     try
     {
-        results = load_bones_file(filename, backup_on_upgrade);
+        return load_bones_record(data, key);
     }
     catch (corrupted_save &err)
     {
-        // not a corrupted save per se, just from the future. Try to load the
-        // versioned bones file if it exists.
-        if (err.version.valid() && err.version.is_future())
-        {
-            string old_bones =
-                        _old_bones_filename(filename, save_version::current());
-            if (old_bones != filename)
-            {
-                _ghost_dprf("Loading ghost from backup bones file %s",
-                                                        old_bones.c_str());
-                return load_bones_file(old_bones, false);
-            }
-            else
-                mprf(MSGCH_ERROR, "Mismatch between bones backup "
-                    "filename '%s' and version %d.%d!", filename.c_str(),
-                    err.version.major, err.version.minor);
-            // intentional fallthrough -- unlink the misnamed file
-        }
-        else
-            mprf(MSGCH_ERROR, "%s", err.what());
-        string report;
-        // if we get to this point the bones file is unreadable and needs to
-        // be scrapped
-        if (unlink(filename.c_str()) != 0)
-            report = "Failed to unlink bad bones file";
-        else
-            report = "Clearing bad bones file";
-        mprf(MSGCH_ERROR, "%s: %s", report.c_str(), filename.c_str());
+        mprf(MSGCH_ERROR, "%s", err.what());
+        mprf(MSGCH_ERROR, "Bad bones record: %s", key.c_str());
     }
-    return results;
-
+    return vector<ghost_demon>();
 }
 
 static vector<ghost_demon> _load_ephemeral_ghosts()
 {
-    vector<ghost_demon> results;
+    bones_store store(_bones_store_file());
+    _import_bones_files(store);
 
-    string ghost_filename = _find_ghost_file();
-    if (ghost_filename.empty())
+    const string key = _make_ghost_filename();
+    vector<unsigned char> data;
+    // Leave bones from newer versions to games of those versions.
+    if (!store.take(key, data, [](const vector<unsigned char> &record)
+                    { return !_bones_record_version(record).is_future(); }))
     {
-        _ghost_dprf("%s", "No ephemeral ghost files for this level.");
-        return results; // no such ghost.
+        _ghost_dprf("%s", "No ephemeral ghosts for this level.");
+        return vector<ghost_demon>();
     }
 
-    results = _load_ghosts_core(ghost_filename, true);
-
-    if (unlink(ghost_filename.c_str()) != 0)
-    {
-        mprf(MSGCH_ERROR, "Failed to unlink bones file: %s",
-                ghost_filename.c_str());
-    }
-    return results;
+    return _read_bones_record(data, key);
 }
 
-static vector<ghost_demon> _load_permastore_ghosts(bool backup_on_upgrade=false)
+static vector<ghost_demon> _load_permastore_ghosts()
 {
-    return _load_ghosts_core(_bones_permastore_file(), backup_on_upgrade);
+    bones_store store(_bones_store_file());
+    _import_bones_files(store);
+
+    const string key = _make_ghost_filename(true);
+    vector<unsigned char> data;
+    store.update(key, [&data](vector<unsigned char> &record)
+    {
+        if (!record.empty())
+        {
+            data = record;
+            return false;
+        }
+        // The first time, copy in the permastore file.
+        data = record = _read_permastore_file();
+        return !record.empty();
+    });
+
+    if (data.empty() || _bones_record_version(data).is_future())
+        return vector<ghost_demon>();
+    return _read_bones_record(data, key);
 }
 
 /**
@@ -3264,7 +3325,11 @@ void delete_level(const level_id &level)
     clear_level_annotations(level);
 
     if (you.save)
+    {
         you.save->delete_chunk(level.describe());
+        for (int band = 0; band < LEVEL_BANDS; ++band)
+            you.save->delete_chunk(_level_band_chunk(level.describe(), band));
+    }
 
     auto &visited = you.props[VISITED_LEVELS_KEY].get_table();
     visited.erase(level.describe());
@@ -3534,6 +3599,38 @@ static bool _restore_tagged_chunk(package *save, const string &name,
     return true;
 }
 
+static void _restore_level_band(const string &level_name, int band)
+{
+    const string name = _level_band_chunk(level_name, band);
+    reader inf(you.save, name);
+    string reason;
+    if (!_tagged_chunk_version_compatible(inf, &reason))
+        end(-1, false, "\nLevel file is invalid. %s\n", reason.c_str());
+
+    try
+    {
+        tag_read_level_band(inf, band);
+    }
+    catch (short_read_exception &E)
+    {
+        fail("truncated save chunk (%s)", name.c_str());
+    };
+
+    inf.fail_if_not_eof(name);
+}
+
+static void _restore_level(const string &level_name)
+{
+    // Levels last saved before TAG_MINOR_LEVEL_BANDS have no bands; their
+    // map is in the main chunk.
+    if (you.save->has_chunk(_level_band_chunk(level_name, 0)))
+        for (int band = 0; band < LEVEL_BANDS; ++band)
+            _restore_level_band(level_name, band);
+
+    _restore_tagged_chunk(you.save, level_name, TAG_LEVEL,
+                          "Level file is invalid.");
+}
+
 static bool _ghost_version_compatible(const save_version &version)
 {
     if (!version.valid())
@@ -3548,39 +3645,6 @@ static bool _ghost_version_compatible(const save_version &version)
     return true;
 }
 
-/**
- * Attempt to open a new bones file for saving ghosts.
- *
- * @param[out] return_gfilename     The name of the file created, if any.
- * @return                          A FILE object, or nullptr.
- **/
-static FILE* _make_bones_file(string * return_gfilename)
-{
-    const string bone_dir = _get_bonefile_directory();
-    const string base_filename = _make_ghost_filename(false);
-
-    for (int i = 0; i < GHOST_LIMIT; i++)
-    {
-        const string g_file_name = make_stringf("%s%s_%d", bone_dir.c_str(),
-                                                base_filename.c_str(), i);
-        FILE *ghost_file = lk_open_exclusive(g_file_name);
-        // need to check file size, so can't open 'wb' - would truncate!
-
-        if (!ghost_file)
-        {
-            dprf("Could not open %s", g_file_name.c_str());
-            continue;
-        }
-
-        dprf("found %s", g_file_name.c_str());
-
-        *return_gfilename = g_file_name;
-        return ghost_file;
-    }
-
-    return nullptr;
-}
-
 #define GHOST_PERMASTORE_SIZE 10
 #define GHOST_PERMASTORE_REPLACE_CHANCE 5
 
@@ -3592,88 +3656,82 @@ static size_t _ghost_permastore_size()
         return GHOST_PERMASTORE_SIZE * 2;
 }
 
-static vector<ghost_demon> _update_permastore(const vector<ghost_demon> &ghosts)
+static vector<ghost_demon> _update_permastore(bones_store &store,
+                                              const vector<ghost_demon> &ghosts)
 {
     rng::generator rng(rng::SYSTEM_SPECIFIC);
     if (ghosts.empty())
         return ghosts;
 
-    // this read is not locked...
-    vector<ghost_demon> permastore = _load_permastore_ghosts();
+    const string key = _make_ghost_filename(true);
     vector<ghost_demon> leftovers;
-
     bool rewrite = false;
-    unsigned int i = 0;
-    const size_t max_ghosts = _ghost_permastore_size();
-    while (permastore.size() < max_ghosts && i < ghosts.size())
-    {
-        // TODO: heuristics to make this as distinct as possible; maybe
-        // create a new name?
-        permastore.push_back(ghosts[i]);
-#ifdef DGAMELAUNCH
-        // randomize name for online play
-        permastore.back().name = make_name();
-#endif
-        i++;
-        rewrite = true;
-    }
-    if (i > 0)
-        _ghost_dprf("Permastoring %d ghosts", i);
-    if (!rewrite && x_chance_in_y(GHOST_PERMASTORE_REPLACE_CHANCE, 100)
-                                                        && i < ghosts.size())
-    {
-        int rewrite_i = random2(permastore.size());
-        permastore[rewrite_i] = ghosts[i];
-#ifdef DGAMELAUNCH
-        permastore[rewrite_i].name = make_name();
-#endif
-        rewrite = true;
-    }
-    while (i < ghosts.size())
-    {
-        leftovers.push_back(ghosts[i]);
-        i++;
-    }
 
-    if (rewrite)
+    // The permastore stays locked from reading it to writing it back.
+    const bool stored = store.update(key, [&](vector<unsigned char> &record)
     {
-        string permastore_file = _bones_permastore_file();
+        if (record.empty())
+            record = _read_permastore_file();
 
-        // the following is to ensure that an old game doesn't overwrite a
-        // permastore that has a version in the future relative to that game.
+        // Don't let an old game overwrite a permastore from the future.
+        if (!record.empty() && _bones_record_version(record).is_future())
         {
-            reader inf(permastore_file);
-            if (inf.valid())
-            {
-                inf.set_safe_read(true); // don't die on 0-byte bones
-                save_version version = read_ghost_header(inf);
-                if (version.valid() && version.is_future())
-                {
-                    permastore_file = _old_bones_filename(permastore_file,
-                                                    save_version::current());
-                }
-                inf.close();
-            }
+            leftovers = ghosts;
+            return false;
         }
 
-        FILE *ghost_file = lk_open("wb", permastore_file);
+        vector<ghost_demon> permastore;
+        if (!record.empty())
+            permastore = _read_bones_record(record, key);
 
-        if (!ghost_file)
+        unsigned int i = 0;
+        const size_t max_ghosts = _ghost_permastore_size();
+        while (permastore.size() < max_ghosts && i < ghosts.size())
         {
-            // this will fail silently if the lock fails, seems safest
-            // TODO: better lock system for servers?
-            _ghost_dprf("Could not open ghost permastore: %s",
-                                                    permastore_file.c_str());
-            return ghosts;
+            // TODO: heuristics to make this as distinct as possible; maybe
+            // create a new name?
+            permastore.push_back(ghosts[i]);
+#ifdef DGAMELAUNCH
+            // randomize name for online play
+            permastore.back().name = make_name();
+#endif
+            i++;
+            rewrite = true;
         }
+        if (i > 0)
+            _ghost_dprf("Permastoring %d ghosts", i);
+        if (!rewrite && x_chance_in_y(GHOST_PERMASTORE_REPLACE_CHANCE, 100)
+                                                            && i < ghosts.size())
+        {
+            int rewrite_i = random2(permastore.size());
+            permastore[rewrite_i] = ghosts[i];
+#ifdef DGAMELAUNCH
+            permastore[rewrite_i].name = make_name();
+#endif
+            rewrite = true;
+        }
+        while (i < ghosts.size())
+        {
+            leftovers.push_back(ghosts[i]);
+            i++;
+        }
+
+        if (!rewrite)
+            return false;
 
         _ghost_dprf("Rewriting ghost permastore %s with %u ghosts",
-                    permastore_file.c_str(), (unsigned int) permastore.size());
-        writer outw(permastore_file, ghost_file);
+                    key.c_str(), (unsigned int) permastore.size());
+        record.clear();
+        writer outw(&record);
         write_ghost_version(outw);
         tag_write_ghosts(outw, permastore);
+        return true;
+    });
 
-        lk_close(ghost_file);
+    if (rewrite && !stored)
+    {
+        _ghost_dprf("Could not update ghost permastore: %s", key.c_str());
+        return ghosts;
     }
     return leftovers;
 }
@@ -3704,37 +3762,31 @@ void save_ghosts(const vector<ghost_demon> &ghosts, bool force, bool use_store)
         return;
     }
 
+    bones_store store(_bones_store_file());
+    _import_bones_files(store);
+
     vector<ghost_demon> leftovers;
     if (use_store)
-        leftovers = _update_permastore(ghosts);
+        leftovers = _update_permastore(store, ghosts);
     else
         leftovers = ghosts;
     if (leftovers.size() == 0)
         return;
 
-    if (_list_bones().size() >= static_cast<size_t>(GHOST_LIMIT))
-    {
-        _ghost_dprf("Too many ghosts for this level already!");
-        return;
-    }
-
-    string g_file_name = "";
-    FILE* ghost_file = _make_bones_file(&g_file_name);
+    vector<unsigned char> data;
+    writer outw(&data);
+    write_ghost_version(outw);
+    tag_write_ghosts(outw, leftovers);
 
-    if (!ghost_file)
+    const string key = _make_ghost_filename();
+    if (!store.add(key, data, GHOST_LIMIT))
     {
-        _ghost_dprf("Could not open file to save ghosts.");
+        _ghost_dprf("Too many ghosts for this level already, or no bones "
+                    "store!");
         return;
     }
 
-    writer outw(g_file_name, ghost_file);
-
-    write_ghost_version(outw);
-    tag_write_ghosts(outw, leftovers);
-
-    lk_close(ghost_file);
-
-    _ghost_dprf("Saved ghosts (%s).", g_file_name.c_str());
+    _ghost_dprf("Saved ghosts (%s).", key.c_str());
 }
 
 ////////////////////////////////////////////////////////////////////////////
@@ -128,6 +128,8 @@ void save_ghosts(const vector<ghost_demon> &ghosts, bool force = false,
 bool load_ghosts(int max_ghosts, bool creating_level);
 bool define_ghost_from_bones(monster& mons);
 vector<ghost_demon> load_bones_file(string ghost_filename, bool backup=false);
+vector<ghost_demon> load_bones_record(const vector<unsigned char> &data,
+                                      const string &key);
 void write_ghost_version(writer &outf);
 save_version read_ghost_header(reader &inf);
 
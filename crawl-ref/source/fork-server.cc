@@ -0,0 +1,492 @@
+/**
+ * @file
+ * @brief Starting games from a process that is already initialised.
+ *
+ * Most of the startup time of a game (Lua, the databases, the maps) is the
+ * same for every player. A fork server does that once, then waits on a
+ * socket; a game started with -use-fork-server connects to it and sends
+ * its arguments, environment, working directory and stdin/stdout/stderr,
+ * and the server forks a child that takes over from there as if it had
+ * been started with them. The client stays around to pass on signals and
+ * to exit with the game's status.
+**/
+
+#include "AppHdr.h"
+
+#ifdef USE_FORK_SERVER
+
+#include "fork-server.h"
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <poll.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "end.h"
+#include "stringutil.h"
+
+extern char **environ;
+
+// A request is a 32-bit length, sent with the client's stdin, stdout and
+// stderr, then that many bytes of NUL-terminated strings: the working
+// directory, the argument count, the arguments and the environment. The
+// reply is the game's pid and, when it ends, its wait() status, both as
+// 32-bit ints.
+static const uint32_t FORK_REQUEST_LIMIT = 1 << 20;
+static const int FORK_REQUEST_FDS = 3;
+
+// How often the server checks on its games, in milliseconds, in case a
+// SIGCHLD arrives just before it starts waiting.
+static const int FORK_REAP_INTERVAL = 1000;
+
+// How long, in seconds, the server waits for each read of a request. The
+// client sends it all at once, and nobody else gets a game started until
+// it's done.
+static const int FORK_REQUEST_TIMEOUT = 5;
+
+struct fork_request
+{
+    string cwd;
+    vector<string> args;
+    vector<string> env;
+};
+
+static bool _write_all(int fd, const void *data, size_t len)
+{
+    const char *p = static_cast<const char *>(data);
+    while (len)
+    {
+        const ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool _read_all(int fd, void *data, size_t len)
+{
+    char *p = static_cast<char *>(data);
+    while (len)
+    {
+        const ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool _socket_address(const string &path, sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+static bool _parse_request(const string &data, fork_request &req)
+{
+    vector<string> parts;
+    for (size_t start = 0; start < data.size();)
+    {
+        const size_t end = data.find('\0', start);
+        if (end == string::npos)
+            return false;
+        parts.push_back(data.substr(start, end - start));
+        start = end + 1;
+    }
+    if (parts.size() < 2)
+        return false;
+
+    const size_t argc = atoi(parts[1].c_str());
+    if (argc < 1 || parts.size() < 2 + argc)
+        return false;
+
+    req.cwd = parts[0];
+    req.args.assign(parts.begin() + 2, parts.begin() + 2 + argc);
+    req.env.assign(parts.begin() + 2 + argc, parts.end());
+    return true;
+}
+
+static bool _receive_request(int conn, fork_request &req,
+                             int fds[FORK_REQUEST_FDS])
+{
+    uint32_t len;
+    iovec iov;
+    iov.iov_base = &len;
+    iov.iov_len = sizeof(len);
+
+    char control[CMSG_SPACE(sizeof(int) * FORK_REQUEST_FDS)];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do
+    {
+        n = recvmsg(conn, &msg, 0);
+    }
+    while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return false;
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET
+        || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * FORK_REQUEST_FDS))
+    {
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * FORK_REQUEST_FDS);
+
+    string data;
+    if (n == sizeof(len) && len <= FORK_REQUEST_LIMIT)
+    {
+        data.resize(len);
+        if (_read_all(conn, &data[0], len) && _parse_request(data, req))
+            return true;
+    }
+
+    for (int i = 0; i < FORK_REQUEST_FDS; ++i)
+        close(fds[i]);
+    return false;
+}
+
+static int _listen(const string &path)
+{
+    sockaddr_un addr;
+    if (!_socket_address(path, addr))
+        end(1, false, "Fork server socket path too long: %s", path.c_str());
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        end(1, true, "Can't open the fork server socket");
+
+    unlink(path.c_str());
+    // Anyone who can connect can run a game as us, so the socket is ours
+    // alone from the moment it exists.
+    const mode_t old_mask = umask(S_IRWXG | S_IRWXO);
+    const int bound = ::bind(listener, (sockaddr *) &addr, sizeof(addr));
+    umask(old_mask);
+    if (bound < 0)
+        end(1, true, "Can't bind the fork server socket %s", path.c_str());
+    if (listen(listener, 16) < 0)
+        end(1, true, "Can't listen on the fork server socket");
+
+    return listener;
+}
+
+static volatile sig_atomic_t _child_exited = 0;
+
+static void _handle_sigchld(int)
+{
+    _child_exited = 1;
+}
+
+// Become the process the client would have been.
+static void _become_game(fork_request &req, int fds[FORK_REQUEST_FDS],
+                         int &argc, char **&argv)
+{
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    // A server started in the background ignores these, but the client's
+    // game shouldn't.
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    // Out of the server's session, so that its terminal is none of ours.
+    setsid();
+
+    for (int i = 0; i < FORK_REQUEST_FDS; ++i)
+    {
+        dup2(fds[i], i);
+        if (fds[i] >= FORK_REQUEST_FDS)
+            close(fds[i]);
+    }
+    // Take the client's terminal as ours, so that the game gets its
+    // keyboard signals directly. This fails while the client's session
+    // still has it, which is what the client's signal forwarding is for.
+    if (isatty(STDIN_FILENO))
+        ioctl(STDIN_FILENO, TIOCSCTTY, 0);
+
+    if (chdir(req.cwd.c_str()) < 0)
+        end(1, true, "Can't change to %s", req.cwd.c_str());
+
+    // clearenv() isn't everywhere.
+    while (environ && *environ)
+    {
+        const string var = *environ;
+        if (unsetenv(var.substr(0, var.find('=')).c_str()) < 0)
+            break;
+    }
+    for (const string &var : req.env)
+    {
+        const size_t eq = var.find('=');
+        if (eq != string::npos && eq > 0)
+            setenv(var.substr(0, eq).c_str(), var.substr(eq + 1).c_str(), 1);
+    }
+
+    // argv has to outlive this.
+    static vector<string> args;
+    static vector<char *> arg_ptrs;
+    args = move(req.args);
+    arg_ptrs.clear();
+    for (string &arg : args)
+        arg_ptrs.push_back(&arg[0]);
+    arg_ptrs.push_back(nullptr);
+
+    argc = args.size();
+    argv = arg_ptrs.data();
+}
+
+void fork_server_run(const string &socket_path, int &argc, char **&argv)
+{
+    const int listener = _listen(socket_path);
+
+    // Where to send each game's status when it ends.
+    map<pid_t, int> games;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _handle_sigchld;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, nullptr);
+    // A client going away shouldn't take the server with it.
+    signal(SIGPIPE, SIG_IGN);
+#if defined(__linux__) && defined(PR_SET_CHILD_SUBREAPER)
+    // Anything a game leaves behind is ours to reap, not init's; the
+    // waitpid() loop below ignores pids that aren't games.
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+#endif
+
+    fprintf(stderr, "Fork server listening on %s\n", socket_path.c_str());
+
+    while (true)
+    {
+        _child_exited = 0;
+        pid_t pid;
+        int status;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            auto game = games.find(pid);
+            if (game == games.end())
+                continue;
+            const int32_t reply = status;
+            _write_all(game->second, &reply, sizeof(reply));
+            close(game->second);
+            games.erase(game);
+        }
+
+        pollfd pfd;
+        pfd.fd = listener;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (_child_exited || poll(&pfd, 1, FORK_REAP_INTERVAL) <= 0)
+            continue;
+
+        const int conn = accept(listener, nullptr, nullptr);
+        if (conn < 0)
+            continue;
+
+        // A client that stalls mustn't hold up everyone else's games.
+        timeval timeout;
+        timeout.tv_sec = FORK_REQUEST_TIMEOUT;
+        timeout.tv_usec = 0;
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        fork_request req;
+        int fds[FORK_REQUEST_FDS];
+        if (!_receive_request(conn, req, fds))
+        {
+            close(conn);
+            continue;
+        }
+
+        fflush(nullptr);
+        const pid_t child = fork();
+        if (child == 0)
+        {
+            close(listener);
+            close(conn);
+            for (const auto &game : games)
+                close(game.second);
+            _become_game(req, fds, argc, argv);
+            return;
+        }
+
+        for (int i = 0; i < FORK_REQUEST_FDS; ++i)
+            close(fds[i]);
+
+        // If the fork failed, the client sees the connection close, and
+        // starts the game itself.
+        const int32_t reply = child;
+        if (child < 0 || !_write_all(conn, &reply, sizeof(reply)))
+        {
+            close(conn);
+            continue;
+        }
+        games[child] = conn;
+    }
+}
+
+static volatile sig_atomic_t _game_pid = 0;
+
+static void _forward_signal(int sig)
+{
+    if (_game_pid > 0)
+        kill(_game_pid, sig);
+}
+
+// The game is in a session of its own, where the kernel drops stop signals,
+// so stop it outright, then ourselves, for whoever is doing job control.
+static void _forward_stop(int sig)
+{
+    UNUSED(sig);
+    if (_game_pid > 0)
+        kill(_game_pid, SIGSTOP);
+    raise(SIGSTOP);
+}
+
+static bool _is_option(const char *arg, const char *name)
+{
+    if (arg[0] != '-')
+        return false;
+    // We accept both -option and --option, like parse_args().
+    arg += arg[1] == '-' ? 2 : 1;
+    return !strcasecmp(arg, name);
+}
+
+void fork_server_launch(const string &socket_path, int argc, char **argv)
+{
+    sockaddr_un addr;
+    if (!_socket_address(socket_path, addr))
+        return;
+
+    const int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn < 0)
+        return;
+    if (connect(conn, (sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+        close(conn);
+        return;
+    }
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+    {
+        close(conn);
+        return;
+    }
+
+    // Leave out -use-fork-server, or the game would ask the server too.
+    vector<const char *> args;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (i > 0 && _is_option(argv[i], "use-fork-server"))
+            ++i;
+        else
+            args.push_back(argv[i]);
+    }
+
+    string data = cwd;
+    data += '\0';
+    data += to_string(args.size());
+    data += '\0';
+    for (const char *arg : args)
+    {
+        data += arg;
+        data += '\0';
+    }
+    for (char **var = environ; var && *var; ++var)
+    {
+        data += *var;
+        data += '\0';
+    }
+
+    uint32_t len = data.size();
+    iovec iov;
+    iov.iov_base = &len;
+    iov.iov_len = sizeof(len);
+
+    char control[CMSG_SPACE(sizeof(int) * FORK_REQUEST_FDS)];
+    memset(control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * FORK_REQUEST_FDS);
+    const int fds[FORK_REQUEST_FDS] = { STDIN_FILENO, STDOUT_FILENO,
+                                        STDERR_FILENO };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    int32_t pid;
+    if (sendmsg(conn, &msg, 0) != sizeof(len)
+        || !_write_all(conn, data.data(), data.size())
+        || !_read_all(conn, &pid, sizeof(pid)))
+    {
+        close(conn);
+        return;
+    }
+
+    // From here on the game is running, so whatever happens we don't start
+    // it again ourselves.
+    _game_pid = pid;
+    signal(SIGHUP, _forward_signal);
+    signal(SIGTERM, _forward_signal);
+    signal(SIGWINCH, _forward_signal);
+    signal(SIGINT, _forward_signal);
+    signal(SIGQUIT, _forward_signal);
+    signal(SIGCONT, _forward_signal);
+    signal(SIGTSTP, _forward_stop);
+    signal(SIGTTIN, _forward_stop);
+    signal(SIGTTOU, _forward_stop);
+
+    int32_t status;
+    if (!_read_all(conn, &status, sizeof(status)))
+    {
+        // The server went away; wait for the game some other way.
+        while (kill(pid, 0) == 0 || errno == EPERM)
+            sleep(1);
+        exit(0);
+    }
+
+    if (WIFSIGNALED(status))
+    {
+        signal(WTERMSIG(status), SIG_DFL);
+        raise(WTERMSIG(status));
+    }
+    exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
+
+#endif
@@ -0,0 +1,20 @@
+/**
+ * @file
+ * @brief Starting games from a process that is already initialised.
+**/
+
+#pragma once
+
+#ifdef USE_FORK_SERVER
+
+// Serve games on socket_path. Each time a client (fork_server_launch())
+// connects, fork, and return in the child with argc and argv replaced by
+// the client's; the server itself never returns.
+void fork_server_run(const string &socket_path, int &argc, char **&argv);
+
+// Ask the fork server on socket_path to run this game with our arguments,
+// environment, working directory and terminal, then exit the way the game
+// does. Returns only if there's no server to ask.
+void fork_server_launch(const string &socket_path, int argc, char **argv);
+
+#endif
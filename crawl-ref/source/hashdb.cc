@@ -0,0 +1,341 @@
+/**
+ * @file
+ * @brief Read-only string tables, looked up through a minimal perfect hash.
+ *
+ * File layout, all integers in native byte order (the files are built on
+ * the machine that reads them):
+ *
+ *   header            magic, version, entry count, bucket count, and the
+ *                     size of the string area
+ *   displacements     one uint32 per bucket
+ *   slots             one {key offset, key length, value offset, value
+ *                     length} per entry
+ *   order             the slots again, by index, in key order
+ *   strings           keys and values, each followed by a NUL
+ *
+ * A key's bucket is hash(key, 0) % buckets, and its slot is
+ * hash(key, displacement[bucket]) % entries. The writer picks the
+ * displacements (hash and displace, a.k.a. CHD) so that every key gets its
+ * own slot and no slot is left empty; a lookup is then two hashes and one
+ * compare.
+**/
+
+#include "AppHdr.h"
+
+#include "hashdb.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(UNIX) || defined(TARGET_COMPILER_MINGW)
+#include <unistd.h>
+#endif
+#ifdef MMAP_HASHDB
+#include <sys/mman.h>
+#endif
+
+#include "syscalls.h"
+
+static const char HASHDB_MAGIC[8] = { 'C', 'R', 'A', 'W', 'L', 'P', 'H', 'F' };
+static const uint32_t HASHDB_VERSION = 1;
+
+struct hashdb_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint32_t nbuckets;
+    uint32_t strings_len;
+};
+
+static uint64_t _hash(const char *s, size_t len, uint32_t seed)
+{
+    // FNV-1a, started from a seed-dependent state...
+    uint64_t h = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char) s[i];
+        h *= 0x100000001b3ULL;
+    }
+    // ... and finished with MurmurHash3's mixer, so that neighbouring seeds
+    // scatter a bucket's keys independently.
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+hash_db::hash_db()
+    : base(nullptr), length(0), count(0), nbuckets(0),
+      displacements(nullptr), slots(nullptr), order(nullptr),
+      strings(nullptr)
+{
+}
+
+hash_db::~hash_db()
+{
+    close();
+}
+
+bool hash_db::open(const string &path)
+{
+    close();
+
+#ifdef MMAP_HASHDB
+    int fd = open_u(path.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(hashdb_header))
+    {
+        ::close(fd);
+        return false;
+    }
+    void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED)
+        return false;
+    base = (const char *) m;
+    length = st.st_size;
+#else
+    FILE *f = fopen_u(path.c_str(), "rb");
+    if (!f)
+        return false;
+    char buf[16384];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+        contents.append(buf, got);
+    fclose(f);
+    if (contents.size() < sizeof(hashdb_header))
+    {
+        contents.clear();
+        return false;
+    }
+    base = contents.data();
+    length = contents.size();
+#endif
+
+    hashdb_header header;
+    memcpy(&header, base, sizeof(header));
+    count = header.count;
+    nbuckets = header.nbuckets;
+    displacements = (const uint32_t *) (base + sizeof(header));
+    slots = (const slot *) (displacements + nbuckets);
+    order = (const uint32_t *) (slots + count);
+    strings = (const char *) (order + count);
+
+    if (memcmp(header.magic, HASHDB_MAGIC, sizeof(HASHDB_MAGIC))
+        || header.version != HASHDB_VERSION
+        || !check_layout(header.strings_len))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+// Is the file exactly as long as the header says, with every string
+// inside it? Anything else is a truncated or foreign file, which we'd
+// rather regenerate than crash on.
+bool hash_db::check_layout(size_t strings_len) const
+{
+    if (!nbuckets)
+        return false;
+    const uint64_t expected = sizeof(hashdb_header)
+                              + (uint64_t) nbuckets * sizeof(uint32_t)
+                              + (uint64_t) count * sizeof(slot)
+                              + (uint64_t) count * sizeof(uint32_t)
+                              + strings_len;
+    if (expected != length)
+        return false;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const slot &s = slots[i];
+        if ((uint64_t) s.key_off + s.key_len >= strings_len
+            || (uint64_t) s.val_off + s.val_len >= strings_len
+            || order[i] >= count)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void hash_db::close()
+{
+#ifdef MMAP_HASHDB
+    if (base)
+        munmap((void *) base, length);
+#else
+    contents.clear();
+#endif
+    base = nullptr;
+    length = 0;
+    count = nbuckets = 0;
+    displacements = nullptr;
+    slots = nullptr;
+    order = nullptr;
+    strings = nullptr;
+}
+
+hash_db::entry hash_db::find(const string &key) const
+{
+    if (!count)
+        return { nullptr, 0 };
+
+    const uint32_t bucket = _hash(key.data(), key.size(), 0) % nbuckets;
+    const slot &s = slots[_hash(key.data(), key.size(),
+                                displacements[bucket]) % count];
+    if (s.key_len != key.size()
+        || memcmp(strings + s.key_off, key.data(), s.key_len))
+    {
+        return { nullptr, 0 };
+    }
+    return { strings + s.val_off, s.val_len };
+}
+
+hash_db::entry hash_db::key(size_t i) const
+{
+    ASSERT(i < count);
+    const slot &s = slots[order[i]];
+    return { strings + s.key_off, s.key_len };
+}
+
+hash_db::entry hash_db::value(size_t i) const
+{
+    ASSERT(i < count);
+    const slot &s = slots[order[i]];
+    return { strings + s.val_off, s.val_len };
+}
+
+void hash_db_writer::add(const string &key, const string &value)
+{
+    entries[key] = value;
+}
+
+// Find a displacement for each bucket such that the buckets' keys fill
+// slots [0, keys.size()) exactly. Returns false if some bucket has no
+// displacement that fits, in which case the caller tries more buckets.
+static bool _place_keys(const vector<const string *> &keys, uint32_t nbuckets,
+                        vector<uint32_t> &displacements,
+                        vector<uint32_t> &slot_of)
+{
+    const uint32_t n = keys.size();
+    vector<vector<uint32_t>> buckets(nbuckets);
+    for (uint32_t i = 0; i < n; ++i)
+        buckets[_hash(keys[i]->data(), keys[i]->size(), 0) % nbuckets]
+            .push_back(i);
+
+    // Biggest buckets first, while there's still plenty of room.
+    vector<uint32_t> order(nbuckets);
+    for (uint32_t b = 0; b < nbuckets; ++b)
+        order[b] = b;
+    stable_sort(order.begin(), order.end(),
+                [&buckets](uint32_t a, uint32_t b)
+                {
+                    return buckets[a].size() > buckets[b].size();
+                });
+
+    displacements.assign(nbuckets, 0);
+    slot_of.assign(n, 0);
+    vector<bool> taken(n, false);
+    vector<uint32_t> tried;
+    for (uint32_t b : order)
+    {
+        if (buckets[b].empty())
+            break;
+
+        bool placed = false;
+        for (uint32_t seed = 1; seed < (1 << 20) && !placed; ++seed)
+        {
+            tried.clear();
+            for (uint32_t i : buckets[b])
+            {
+                const uint32_t s = _hash(keys[i]->data(), keys[i]->size(),
+                                         seed) % n;
+                if (taken[s]
+                    || find(tried.begin(), tried.end(), s) != tried.end())
+                {
+                    break;
+                }
+                tried.push_back(s);
+            }
+            if (tried.size() != buckets[b].size())
+                continue;
+
+            for (size_t j = 0; j < tried.size(); ++j)
+            {
+                taken[tried[j]] = true;
+                slot_of[buckets[b][j]] = tried[j];
+            }
+            displacements[b] = seed;
+            placed = true;
+        }
+        if (!placed)
+            return false;
+    }
+    return true;
+}
+
+bool hash_db_writer::write(const string &path) const
+{
+    vector<const string *> keys;
+    for (const auto &e : entries)
+        keys.push_back(&e.first);
+    const uint32_t n = keys.size();
+
+    // Two keys to a bucket on average finds displacements quickly.
+    uint32_t nbuckets = n / 2 + 1;
+    vector<uint32_t> displacements, slot_of;
+    while (!_place_keys(keys, nbuckets, displacements, slot_of))
+        nbuckets *= 2;
+
+    string strings;
+    vector<uint32_t> slot_words(4 * n);
+    uint32_t i = 0;
+    for (const auto &e : entries)
+    {
+        uint32_t *s = &slot_words[4 * slot_of[i++]];
+        s[0] = strings.size();
+        s[1] = e.first.size();
+        strings.append(e.first).push_back('\0');
+        s[2] = strings.size();
+        s[3] = e.second.size();
+        strings.append(e.second).push_back('\0');
+    }
+    // Keep the string area non-empty, so even an empty table has a valid
+    // layout.
+    strings.push_back('\0');
+
+    hashdb_header header;
+    memcpy(header.magic, HASHDB_MAGIC, sizeof(HASHDB_MAGIC));
+    header.version = HASHDB_VERSION;
+    header.count = n;
+    header.nbuckets = nbuckets;
+    header.strings_len = strings.size();
+
+    const string tmp = path + ".tmp";
+    FILE *f = fopen_u(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(displacements.data(), sizeof(uint32_t), nbuckets, f);
+    if (n)
+    {
+        fwrite(slot_words.data(), sizeof(uint32_t), slot_words.size(), f);
+        fwrite(slot_of.data(), sizeof(uint32_t), slot_of.size(), f);
+    }
+    fwrite(strings.data(), 1, strings.size(), f);
+    const bool failed = ferror(f);
+    if (fclose(f) || failed || rename_u(tmp.c_str(), path.c_str()))
+    {
+        unlink_u(tmp.c_str());
+        return false;
+    }
+    return true;
+}
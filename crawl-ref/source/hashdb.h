@@ -0,0 +1,86 @@
+/**
+ * @file
+ * @brief Read-only string tables, looked up through a minimal perfect hash.
+ *
+ * The text databases are compiled into these from the .txt files. A file
+ * is mapped (rather than read) where we can, so every process using the
+ * same file shares one copy of it, and lookups point straight into it.
+**/
+
+#pragma once
+
+#include <map>
+#include <string>
+
+using std::map;
+using std::string;
+
+#ifdef UNIX
+#define MMAP_HASHDB
+#endif
+
+class hash_db
+{
+public:
+    // Points into the file, so valid only until close(). Not NUL
+    // terminated (though the file does have a NUL after each one).
+    struct entry
+    {
+        const char *data;
+        size_t size;
+
+        explicit operator bool() const { return data != nullptr; }
+        string str() const { return string(data, size); }
+    };
+
+    hash_db();
+    ~hash_db();
+    hash_db(const hash_db &) = delete;
+    hash_db &operator=(const hash_db &) = delete;
+
+    bool open(const string &path);
+    void close();
+    bool is_open() const { return base != nullptr; }
+
+    entry find(const string &key) const;
+
+    // For walking every entry, in key order.
+    size_t size() const { return count; }
+    entry key(size_t i) const;
+    entry value(size_t i) const;
+
+private:
+    struct slot
+    {
+        uint32_t key_off, key_len;
+        uint32_t val_off, val_len;
+    };
+
+    const char *base;
+    size_t length;
+    uint32_t count;
+    uint32_t nbuckets;
+    const uint32_t *displacements;
+    const slot *slots;
+    const uint32_t *order;
+    const char *strings;
+#ifndef MMAP_HASHDB
+    string contents;
+#endif
+
+    bool check_layout(size_t strings_len) const;
+};
+
+class hash_db_writer
+{
+public:
+    // A later value for the same key replaces the earlier one.
+    void add(const string &key, const string &value);
+
+    // Writes to a temporary file beside path and renames it into place, so
+    // that processes still using the old file are undisturbed.
+    bool write(const string &path) const;
+
+private:
+    map<string, string> entries;
+};
@@ -17,6 +17,7 @@
 #include "json-wrapper.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cinttypes>
 #include <cctype>
 #include <cstdio>
@@ -26,6 +27,7 @@
 #include <string>
 
 #include "ability.h"
+#include "bones-store.h"
 #include "branch-data-json.h"
 #include "chardump.h"
 #include "clua.h"
@@ -61,6 +63,7 @@
 #include "slot-select-mode.h"
 #include "species.h"
 #include "spl-util.h"
+#include "startup-profile.h"
 #include "stash.h"
 #include "state.h"
 #include "stringutil.h"
@@ -330,6 +333,7 @@ const vector<GameOption*> game_options::build_options_list()
         new IntGameOption(SIMPLE_NAME(rest_delay), USING_DGL ? -1 : 0,
                           -1, 2000),
         new IntGameOption(SIMPLE_NAME(explore_delay), -1, -1, 2000),
+        new IntGameOption(SIMPLE_NAME(runrest_frame_rate), 30, 0, 1000),
         new IntGameOption(SIMPLE_NAME(explore_item_greed), 10, -1000, 1000),
         new IntGameOption(SIMPLE_NAME(explore_wall_bias), 0, -1000, 1000),
         new IntGameOption(SIMPLE_NAME(scroll_margin_x), 2, 0),
@@ -498,6 +502,7 @@ const vector<GameOption*> game_options::build_options_list()
         new BoolGameOption(SIMPLE_NAME(tile_level_map_hide_messages), true),
         new BoolGameOption(SIMPLE_NAME(tile_level_map_hide_sidebar), false),
         new BoolGameOption(SIMPLE_NAME(tile_web_mouse_control), true),
+        new BoolGameOption(SIMPLE_NAME(tile_web_compact_map), false),
         new MultipleChoiceGameOption<string>(
             SIMPLE_NAME(tile_web_mobile_input_helper), "auto",
             {{"auto", "auto"}, {"true", "true"}, {"false", "false"}}),
@@ -1329,7 +1334,7 @@ void game_options::reset_options()
     new_dump_fields("header,hiscore,stats,misc,inventory,"
                     "skills,spells,overview,mutations,messages,"
                     "screenshot,monlist,kills,notes,screenshots,vaults,"
-                    "skill_gains,action_counts");
+                    "skill_gains,action_counts,lua_hooks");
     // Currently enabled by default for testing in trunk.
     if (Version::ReleaseType == VER_ALPHA)
         new_dump_fields("turns_by_place");
@@ -1916,6 +1921,8 @@ void game_options::merge(const game_options &other)
 
 void read_init_file(bool runscript)
 {
+    startup_phase phase("read_init_file");
+
     Options.reset_options();
     // XX why didn't this clear first
     Options.reset_aliases(false);
@@ -4307,6 +4314,8 @@ enum commandline_option_type
     CLO_MAPSTAT,
     CLO_MAPSTAT_DUMP_DISCONNECT,
     CLO_OBJSTAT,
+    CLO_BENCH_LEVELGEN,
+    CLO_BENCH_BASELINE,
     CLO_ITERATIONS,
     CLO_FORCE_MAP,
     CLO_ARENA,
@@ -4334,15 +4343,26 @@ enum commandline_option_type
     CLO_NO_GDB, CLO_NOGDB,
     CLO_THROTTLE,
     CLO_NO_THROTTLE,
+    CLO_LUA_HOOK_BUDGET,
+    CLO_LUA_MAX_MEMORY,
     CLO_PLAYABLE_JSON, // JSON metadata for species, jobs, combos.
     CLO_BRANCHES_JSON, // JSON metadata for branches.
     CLO_SAVE_JSON,
     CLO_GAMETYPES_JSON,
     CLO_EDIT_BONES,
+    CLO_STARTUP_PROFILE,
 #ifdef USE_TILE_WEB
     CLO_WEBTILES_SOCKET,
     CLO_AWAIT_CONNECTION,
     CLO_PRINT_WEBTILES_OPTIONS,
+    CLO_WEBTILES_LATENCY,
+#endif
+#ifdef USE_FORK_SERVER
+    CLO_FORK_SERVER,
+    CLO_USE_FORK_SERVER,
+#endif
+#if defined(UNIX) && !defined(USE_TILE_LOCAL)
+    CLO_TTY_STATS,
 #endif
 
     CLO_NOPS
@@ -4352,14 +4372,24 @@ static const char *cmd_ops[] =
 {
     "scores", "name", "species", "background", "dir", "rc", "rcdir", "tscores",
     "vscores", "scorefile", "morgue", "macro", "mapstat", "dump-disconnect",
-    "objstat", "iters", "force-map", "arena", "dump-maps", "test", "script",
-    "builddb", "help", "version", "seed", "pregen", "save-version", "sprint",
+    "objstat", "bench-levelgen", "bench-baseline", "iters", "force-map",
+    "arena", "dump-maps", "test", "script", "builddb", "help", "version",
+    "seed", "pregen", "save-version", "sprint",
     "extra-opt-first", "extra-opt-last", "sprint-map", "edit-save",
     "print-charset", "tutorial", "wizard", "explore", "no-save",
     "no-player-bones", "gdb", "no-gdb", "nogdb", "throttle", "no-throttle",
+    "lua-hook-budget", "lua-max-memory",
     "playable-json", "branches-json", "save-json", "gametypes-json", "bones",
+    "startup-profile",
 #ifdef USE_TILE_WEB
     "webtiles-socket", "await-connection", "print-webtiles-options",
+    "webtiles-latency",
+#endif
+#ifdef USE_FORK_SERVER
+    "fork-server", "use-fork-server",
+#endif
+#if defined(UNIX) && !defined(USE_TILE_LOCAL)
+    "tty-stats",
 #endif
 };
 
@@ -4463,6 +4493,7 @@ enum es_command_type
     ES_PUT,
     ES_REPACK,
     ES_INFO,
+    ES_BENCH,
     NUM_ES
 };
 
@@ -4491,6 +4522,7 @@ static edit_command<es_command_type> es_commands[] =
     { ES_RM,      "rm",      true,  1, 1, },
     { ES_REPACK,  "repack",  false, 0, 0, },
     { ES_INFO,    "info",    false, 0, 0, },
+    { ES_BENCH,   "bench",   false, 0, 0, },
 };
 
 static edit_command<eb_command_type> eb_commands[] =
@@ -4501,6 +4533,79 @@ static edit_command<eb_command_type> eb_commands[] =
     { EB_REWRITE,  "rewrite", true,  0, 1 },
 };
 
+// Whether files.cc would save this chunk with SAVE_COMPRESSION_FAST: level
+// maps ("D:3") and their bands ("D:3#0").
+static bool _is_level_chunk(const string &chunk)
+{
+    try
+    {
+        level_id::parse_level_id(chunk.substr(0, chunk.find('#')));
+        return true;
+    }
+    catch (const bad_level_id &err)
+    {
+        return false;
+    }
+}
+
+// Save every chunk into a scratch file twice: first the way everything used
+// to be saved (one at a time, at the default level), then as save_game()
+// does now.
+static void _bench_save(package &save, const string &filename)
+{
+    vector<pair<string, vector<unsigned char>>> chunks;
+    size_t total = 0;
+    for (const string &chunk : save.list_chunks())
+    {
+        chunks.emplace_back(chunk, vector<unsigned char>());
+        vector<unsigned char> &data = chunks.back().second;
+
+        unsigned char buf[16384];
+        chunk_reader in(&save, chunk);
+        while (plen_t s = in.read(buf, sizeof(buf)))
+            data.insert(data.end(), buf, buf + s);
+        total += data.size();
+    }
+    printf("Chunks: %u, %u bytes uncompressed\n",
+           (unsigned int)chunks.size(), (unsigned int)total);
+
+    const string tmpname = filename + ".bench";
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        const auto start = chrono::steady_clock::now();
+        package bench(tmpname.c_str(), true, true);
+        for (auto &chunk : chunks)
+        {
+            if (!pass)
+            {
+                chunk_writer out(&bench, chunk.first);
+                out.write(chunk.second.data(), chunk.second.size());
+            }
+            else
+            {
+                bench.write_async(chunk.first, move(chunk.second),
+                                  _is_level_chunk(chunk.first)
+                                      ? SAVE_COMPRESSION_FAST
+                                      : SAVE_COMPRESSION);
+            }
+        }
+        if (!pass)
+            bench.commit();
+        else
+        {
+            bench.commit_async();
+            bench.flush_async();
+        }
+        const chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+
+        printf("%-17s %9.1fms %9u bytes\n",
+               pass ? "As saved now:" : "Serial, default:",
+               elapsed.count(), bench.get_size());
+        bench.unlink();
+    }
+}
+
 #define FAIL(...) do { fprintf(stderr, __VA_ARGS__); return; } while (0)
 static void _edit_save(int argc, char **argv)
 {
@@ -4514,6 +4619,7 @@ static void _edit_save(int argc, char **argv)
                "     <chunkfile> defaults to \"chunk\"; use \"-\" for stdout/stdin\n"
                "  rm <chunk>                  delete a chunk\n"
                "  repack                      defrag and reclaim unused space\n"
+               "  bench                       time and size saving every chunk\n"
              );
         return;
     }
@@ -4661,6 +4767,8 @@ static void _edit_save(int argc, char **argv)
             // there's also wasted space due to fragmentation, but since
             // it's linear, there's no need to print it
         }
+        else if (cmd == ES_BENCH)
+            _bench_save(save, filename);
     }
     catch (ext_fail_exception &fe)
     {
@@ -4701,30 +4809,38 @@ static void _write_bones(const string &filename, vector<ghost_demon> ghosts)
     lk_close(ghost_file);
 }
 
-static void _bones_ls(const string &filename, const string name_match,
-                                                            bool long_output)
+static vector<ghost_demon> _bones_matching(const vector<ghost_demon> &ghosts,
+                                           const string &name_match)
 {
-    save_version v = _read_bones_version(filename);
-    cout << "Bones file '" << filename << "', version " << v.major << "."
-         << v.minor << ":\n";
-    const vector<ghost_demon> ghosts = load_bones_file(filename, false);
+    vector<ghost_demon> result;
+    for (const ghost_demon &g : ghosts)
+    {
+        // TODO: partial name matching?
+        if (name_match.empty() || name_match == lowercase_string(g.name))
+            result.push_back(g);
+    }
+    return result;
+}
+
+static void _bones_print(const vector<ghost_demon> &ghosts, bool long_output)
+{
+    static bool initialised = false;
     monster m;
     if (long_output)
     {
-        init_monsters(); // no monster is valid without this
-        init_spell_descs();
-        init_spell_name_cache();
+        if (!initialised)
+        {
+            init_monsters(); // no monster is valid without this
+            init_spell_descs();
+            init_spell_name_cache();
+            initialised = true;
+        }
         m.reset();
         m.type = MONS_PROGRAM_BUG;
         m.base_monster = MONS_PHANTOM;
     }
-    int count = 0;
     for (auto g : ghosts)
     {
-        // TODO: partial name matching?
-        if (name_match.size() && name_match != lowercase_string(g.name))
-            continue;
-        count++;
         if (long_output)
         {
             // TOOD: line wrapping, some elements of this aren't meaningful at
@@ -4749,6 +4865,10 @@ static void _bones_ls(const string &filename, const string name_match,
                  << "\n";
         }
     }
+}
+
+static void _bones_ls_total(int count, const string &name_match)
+{
     if (!count)
     {
         if (name_match.size())
@@ -4760,8 +4880,129 @@ static void _bones_ls(const string &filename, const string name_match,
         cout << count << " ghosts total\n";
 }
 
+// A bones store holds many bones files' worth of ghosts, each under the name
+// of the file it would have been.
+static void _bones_store_ls(const string &filename, const string &name_match,
+                            bool long_output)
+{
+    bones_store store(filename);
+    if (!store.valid())
+        FAIL("Couldn't open bones store '%s'.\n", filename.c_str());
+    cout << "Bones store '" << filename << "':\n";
+
+    int count = 0;
+    for (const string &key : store.keys())
+    {
+        vector<vector<unsigned char>> records;
+        if (!store.records(key, records))
+            cout << "Broken records for " << key << "\n";
+        vector<ghost_demon> ghosts;
+        for (const vector<unsigned char> &record : records)
+        {
+            try
+            {
+                const vector<ghost_demon> got = load_bones_record(record, key);
+                ghosts.insert(ghosts.end(), got.begin(), got.end());
+            }
+            catch (corrupted_save &err)
+            {
+                cout << err.what() << "\n";
+            }
+        }
+        ghosts = _bones_matching(ghosts, name_match);
+        if (ghosts.empty())
+            continue;
+        cout << key << ":\n";
+        _bones_print(ghosts, long_output);
+        count += ghosts.size();
+    }
+    _bones_ls_total(count, name_match);
+}
+
+static void _bones_ls(const string &filename, const string name_match,
+                                                            bool long_output)
+{
+    if (bones_store::is_store(filename))
+    {
+        _bones_store_ls(filename, name_match, long_output);
+        return;
+    }
+    save_version v = _read_bones_version(filename);
+    cout << "Bones file '" << filename << "', version " << v.major << "."
+         << v.minor << ":\n";
+    const vector<ghost_demon> ghosts =
+        _bones_matching(load_bones_file(filename, false), name_match);
+    _bones_print(ghosts, long_output);
+    _bones_ls_total(ghosts.size(), name_match);
+}
+
+// Take every record with the ghost out of the store, and put back the rest
+// of its ghosts.
+static void _bones_store_rm(const string &filename, const string &remove)
+{
+    bones_store store(filename);
+    if (!store.valid())
+        FAIL("Couldn't open bones store '%s'.\n", filename.c_str());
+
+    const string remove_lower = lowercase_string(remove);
+    auto has_ghost = [&remove_lower](const vector<unsigned char> &record)
+    {
+        try
+        {
+            for (const ghost_demon &g : load_bones_record(record, ""))
+                if (lowercase_string(g.name) == remove_lower)
+                    return true;
+        }
+        catch (corrupted_save &err)
+        {
+            // Leave records this version can't read alone.
+        }
+        return false;
+    };
+
+    int removed = 0;
+    for (const string &key : store.keys())
+    {
+        vector<unsigned char> data;
+        while (store.take(key, data, has_ghost))
+        {
+            vector<ghost_demon> out;
+            for (const ghost_demon &g : load_bones_record(data, key))
+            {
+                if (lowercase_string(g.name) == remove_lower)
+                    removed++;
+                else
+                    out.push_back(g);
+            }
+            if (out.empty())
+                continue;
+
+            data.clear();
+            writer outw(&data);
+            write_ghost_version(outw);
+            tag_write_ghosts(outw, out);
+            if (!store.add(key, data, SIZE_MAX))
+                cout << "Couldn't put back the other ghosts of " << key << "\n";
+        }
+    }
+    if (removed)
+    {
+        cout << "Removed " << removed << " ghosts named '" << remove_lower
+             << "' from '" << filename << "'\n";
+    }
+    else
+        cout << "No matching ghosts for '" << remove_lower << "'\n";
+}
+
 static void _bones_rewrite(const string filename, const string remove, bool dedup)
 {
+    if (bones_store::is_store(filename))
+    {
+        if (remove.empty())
+            FAIL("Bones stores can't be rewritten; use ls and rm.\n");
+        _bones_store_rm(filename, remove);
+        return;
+    }
     const vector<ghost_demon> ghosts = load_bones_file(filename, false);
 
     vector<ghost_demon> out;
@@ -4803,6 +5044,9 @@ static void _bones_rewrite(const string filename, const string remove, bool dedu
 
 static void _bones_merge(const vector<string> files, const string out_name)
 {
+    for (const string &filename : files)
+        if (bones_store::is_store(filename))
+            FAIL("'%s' is a bones store, not a bones file.\n", filename.c_str());
     vector<ghost_demon> out;
     for (auto filename : files)
     {
@@ -4835,9 +5079,11 @@ static void _edit_bones(int argc, char **argv)
         printf("Usage: crawl --bones <command> ARGS, where <command> may be:\n"
                "  ls <file> [<name>] [--long] List the ghosts in <file>\n"
                "                              --long shows full monster descriptions\n"
+               "                              <file> may be a bones store (bones.db)\n"
                "  merge <file1> <file2>       Merge two bones files together, rewriting into\n"
                "                              <file2>. Capped at %d; read in reverse order.\n"
-               "  rm <file> <name>            Rewrite a ghost file without <name>\n"
+               "  rm <file> <name>            Rewrite a ghost file without <name>, or\n"
+               "                              remove <name> from a bones store\n"
                "  rewrite <file> [--dedup]    Rewrite a ghost file, fixing up version etc.\n",
                MAX_GHOSTS
              );
@@ -5136,8 +5382,8 @@ bool parse_args(int argc, char **argv, bool rc_only)
     COMPILE_CHECK(ARRAYSZ(cmd_ops) == CLO_NOPS);
 
 #ifndef DEBUG_STATISTICS
-    const char *dbg_stat_err = "mapstat and objstat are available only in "
-                               "DEBUG_STATISTICS builds.\n";
+    const char *dbg_stat_err = "mapstat, objstat and bench-levelgen are "
+                               "available only in DEBUG_STATISTICS builds.\n";
 #endif
 
     if (crawl_state.command_line_arguments.empty())
@@ -5282,9 +5528,17 @@ bool parse_args(int argc, char **argv, bool rc_only)
 
         case CLO_MAPSTAT:
         case CLO_OBJSTAT:
+        case CLO_BENCH_LEVELGEN:
 #ifdef DEBUG_STATISTICS
             if (o == CLO_MAPSTAT)
                 crawl_state.map_stat_gen = true;
+            else if (o == CLO_BENCH_LEVELGEN)
+            {
+                // The benchmark piggybacks on mapstat's level building and
+                // veto tracking.
+                crawl_state.map_stat_gen = true;
+                crawl_state.levelgen_bench = true;
+            }
             else
                 crawl_state.obj_stat_gen = true;
 #ifdef USE_TILE_LOCAL
@@ -5335,6 +5589,20 @@ bool parse_args(int argc, char **argv, bool rc_only)
 #endif
             break;
 
+        case CLO_BENCH_BASELINE:
+#ifdef DEBUG_STATISTICS
+            if (!next_is_param)
+                end(1, false, "Filename argument required for -%s\n", arg);
+            else
+            {
+                SysEnv.levelgen_bench_baseline = next_arg;
+                nextUsed = true;
+            }
+#else
+            end(1, false, "%s", dbg_stat_err);
+#endif
+            break;
+
         case CLO_FORCE_MAP:
 #ifdef DEBUG_STATISTICS
             if (!next_is_param)
@@ -5412,6 +5680,16 @@ bool parse_args(int argc, char **argv, bool rc_only)
 #endif
             break;
 
+        case CLO_STARTUP_PROFILE:
+            if (!next_is_param)
+                return false;
+            // Start timing on the first pass, which comes before any of
+            // the phases.
+            if (rc_only)
+                startup_profile_enable(next_arg);
+            nextUsed = true;
+            break;
+
         case CLO_GDB:
             crawl_state.no_gdb = 0;
             break;
@@ -5603,6 +5881,39 @@ bool parse_args(int argc, char **argv, bool rc_only)
                 end(0);
             }
             break;
+
+        case CLO_WEBTILES_LATENCY:
+            if (!next_is_param)
+                return false;
+            tiles.m_latency.set_stats_file(next_arg);
+            nextUsed = true;
+            break;
+#endif
+
+#ifdef USE_FORK_SERVER
+        case CLO_FORK_SERVER:
+            if (!next_is_param)
+                return false;
+            SysEnv.fork_server = next_arg;
+            nextUsed = true;
+            break;
+
+        case CLO_USE_FORK_SERVER:
+            if (!next_is_param)
+                return false;
+            SysEnv.use_fork_server = next_arg;
+            nextUsed = true;
+            break;
+#endif
+
+#if defined(UNIX) && !defined(USE_TILE_LOCAL)
+        case CLO_TTY_STATS:
+            if (!next_is_param)
+                return false;
+            if (rc_only)
+                tty_stats_enable(next_arg);
+            nextUsed = true;
+            break;
 #endif
 
         case CLO_PRINT_CHARSET:
@@ -5626,6 +5937,30 @@ bool parse_args(int argc, char **argv, bool rc_only)
             crawl_state.throttle = false;
             break;
 
+        case CLO_LUA_HOOK_BUDGET:
+            if (!next_is_param)
+                return false;
+            if (!parse_int(next_arg, crawl_state.lua_hook_budget)
+                || crawl_state.lua_hook_budget < 0)
+            {
+                end(1, false, "-%s needs a non-negative number of "
+                    "instructions\n", arg);
+            }
+            nextUsed = true;
+            break;
+
+        case CLO_LUA_MAX_MEMORY:
+            if (!next_is_param)
+                return false;
+            if (!parse_int(next_arg, crawl_state.lua_max_memory)
+                || crawl_state.lua_max_memory < CLUA_MIN_MEMORY_USE)
+            {
+                end(1, false, "-%s needs a number of KB, at least %d\n",
+                    arg, CLUA_MIN_MEMORY_USE);
+            }
+            nextUsed = true;
+            break;
+
         case CLO_EXTRA_OPT_FIRST:
             if (!next_is_param)
                 return false;
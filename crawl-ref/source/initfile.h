@@ -62,10 +62,16 @@ public:
 
     int map_gen_iters;
     unique_ptr<depth_ranges> map_gen_range;
+    string levelgen_bench_baseline; // -bench-levelgen report to compare to.
 
     vector<string> extra_opts_first;
     vector<string> extra_opts_last;
 
+#ifdef USE_FORK_SERVER
+    string fork_server;            // Socket to serve games on.
+    string use_fork_server;        // Socket of a server to start the game.
+#endif
+
 public:
     void add_rcdir(const string &dir);
 };
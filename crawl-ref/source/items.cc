@@ -2930,8 +2930,10 @@ static bool _is_option_autopickup(const item_def &item, bool ignore_force)
                                                 ? "{gold}"
                                                 : _autopickup_item_name(item);
 
-    maybe_bool res = clua.callmaybefn("ch_force_autopickup", "is",
-                                      &item, iname.c_str());
+    static const lua_hook<maybe_bool(const item_def *, const string &)>
+        force_autopickup("ch_force_autopickup");
+    maybe_bool res = MB_MAYBE;
+    force_autopickup(clua, res, &item, iname);
     if (!clua.error.empty())
     {
         mprf(MSGCH_ERROR, "ch_force_autopickup failed: %s",
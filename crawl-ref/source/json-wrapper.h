@@ -37,3 +37,23 @@ struct JsonWrapper
 
     static class MalformedException { } malformed;
 };
+
+// The same, for nodes owned by something else (like a JsonArena).
+struct JsonRef
+{
+    JsonRef(JsonNode* n) : node(n)
+    { }
+
+    JsonNode* operator->()
+    {
+        return node;
+    }
+
+    void check(JsonTag tag)
+    {
+        if (!node || node->tag != tag)
+            throw JsonWrapper::MalformedException();
+    }
+
+    JsonNode* node;
+};
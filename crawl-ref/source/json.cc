@@ -119,6 +119,51 @@ static void sb_free(SB *sb)
     free(sb->start);
 }
 
+/* Arena */
+
+#define JSON_ARENA_BLOCK 4096
+
+JsonArena::~JsonArena()
+{
+    for (char *b : blocks)
+        free(b);
+}
+
+void *JsonArena::alloc(size_t size)
+{
+    const size_t align = alignof(max_align_t);
+    size = (size + align - 1) & ~(align - 1);
+    ASSERT(size <= JSON_ARENA_BLOCK);
+
+    if (used + size > JSON_ARENA_BLOCK)
+    {
+        block++;
+        used = 0;
+    }
+    if (block == blocks.size())
+    {
+        char *b = (char*)malloc(JSON_ARENA_BLOCK);
+        if (b == nullptr)
+            out_of_memory();
+        blocks.push_back(b);
+    }
+
+    void *ret = blocks[block] + used;
+    used += size;
+    return ret;
+}
+
+size_t JsonArena::mark() const
+{
+    return block * JSON_ARENA_BLOCK + used;
+}
+
+void JsonArena::reset(size_t to)
+{
+    block = to / JSON_ARENA_BLOCK;
+    used = to % JSON_ARENA_BLOCK;
+}
+
 /*
  * Unicode helper functions
  *
@@ -357,11 +402,11 @@ static void to_surrogate_pair(uchar_t unicode, uint16_t *uc, uint16_t *lc)
 #define is_space(c) ((c) == '\t' || (c) == '\n' || (c) == '\r' || (c) == ' ')
 #define is_digit(c) ((c) >= '0' && (c) <= '9')
 
-static bool parse_value     (const char **sp, JsonNode    **out);
-static bool parse_string    (const char **sp, char        **out);
+static bool parse_value     (const char **sp, JsonNode    **out, JsonArena *arena);
+static bool parse_string    (const char **sp, char        **out, bool in_place);
 static bool parse_number    (const char **sp, double       *out);
-static bool parse_array     (const char **sp, JsonNode    **out);
-static bool parse_object    (const char **sp, JsonNode    **out);
+static bool parse_array     (const char **sp, JsonNode    **out, JsonArena *arena);
+static bool parse_object    (const char **sp, JsonNode    **out, JsonArena *arena);
 static bool parse_hex16     (const char **sp, uint16_t     *out);
 
 static bool expect_literal  (const char **sp, const char *str);
@@ -378,7 +423,7 @@ static void emit_object_indented    (SB *out, const JsonNode *object, const char
 
 static int write_hex16(char *out, uint16_t val);
 
-static JsonNode *mknode(JsonTag tag);
+static JsonNode *mknode(JsonTag tag, JsonArena *arena = nullptr);
 static void append_node(JsonNode *parent, JsonNode *child);
 static void prepend_node(JsonNode *parent, JsonNode *child);
 static void append_member(JsonNode *object, char *key, JsonNode *value);
@@ -387,25 +432,37 @@ static void append_member(JsonNode *object, char *key, JsonNode *value);
 static bool tag_is_valid(unsigned int tag);
 static bool number_is_valid(const char *num);
 
-JsonNode *json_decode(const char *json)
+static JsonNode *decode(const char *json, JsonArena *arena)
 {
     const char *s = json;
     JsonNode *ret;
 
     skip_space(&s);
-    if (!parse_value(&s, &ret))
+    if (!parse_value(&s, &ret, arena))
         return nullptr;
 
     skip_space(&s);
     if (*s != 0)
     {
-        json_delete(ret);
+        if (!arena)
+            json_delete(ret);
         return nullptr;
     }
 
     return ret;
 }
 
+JsonNode *json_decode(const char *json)
+{
+    return decode(json, nullptr);
+}
+
+JsonNode *json_decode_arena(JsonArena *arena, char *json)
+{
+    ASSERT(arena);
+    return decode(json, arena);
+}
+
 char *json_encode(const JsonNode *node)
 {
     return json_stringify(node, nullptr);
@@ -468,7 +525,7 @@ bool json_validate(const char *json)
     const char *s = json;
 
     skip_space(&s);
-    if (!parse_value(&s, nullptr))
+    if (!parse_value(&s, nullptr, nullptr))
         return false;
 
     skip_space(&s);
@@ -517,11 +574,18 @@ JsonNode *json_first_child(const JsonNode *node)
     return nullptr;
 }
 
-static JsonNode *mknode(JsonTag tag)
+static JsonNode *mknode(JsonTag tag, JsonArena *arena)
 {
-    JsonNode *ret = (JsonNode*) calloc(1, sizeof(JsonNode));
-    if (ret == nullptr)
-        out_of_memory();
+    JsonNode *ret;
+    if (arena)
+        ret = (JsonNode*) memset(arena->alloc(sizeof(JsonNode)), 0,
+                                 sizeof(JsonNode));
+    else
+    {
+        ret = (JsonNode*) calloc(1, sizeof(JsonNode));
+        if (ret == nullptr)
+            out_of_memory();
+    }
     ret->tag = tag;
     return ret;
 }
@@ -538,9 +602,9 @@ JsonNode *json_mkbool(bool b)
     return ret;
 }
 
-static JsonNode *mkstring(char *s)
+static JsonNode *mkstring(char *s, JsonArena *arena = nullptr)
 {
-    JsonNode *ret = mknode(JSON_STRING);
+    JsonNode *ret = mknode(JSON_STRING, arena);
     ret->string_ = s;
     return ret;
 }
@@ -660,7 +724,7 @@ void json_remove_from_parent(JsonNode *node)
     }
 }
 
-static bool parse_value(const char **sp, JsonNode **out)
+static bool parse_value(const char **sp, JsonNode **out, JsonArena *arena)
 {
     const char *s = *sp;
 
@@ -670,7 +734,7 @@ static bool parse_value(const char **sp, JsonNode **out)
         if (expect_literal(&s, "null"))
         {
             if (out)
-                *out = json_mknull();
+                *out = mknode(JSON_NULL, arena);
             *sp = s;
             return true;
         }
@@ -680,7 +744,10 @@ static bool parse_value(const char **sp, JsonNode **out)
         if (expect_literal(&s, "false"))
         {
             if (out)
-                *out = json_mkbool(false);
+            {
+                *out = mknode(JSON_BOOL, arena);
+                (*out)->bool_ = false;
+            }
             *sp = s;
             return true;
         }
@@ -690,7 +757,10 @@ static bool parse_value(const char **sp, JsonNode **out)
         if (expect_literal(&s, "true"))
         {
             if (out)
-                *out = json_mkbool(true);
+            {
+                *out = mknode(JSON_BOOL, arena);
+                (*out)->bool_ = true;
+            }
             *sp = s;
             return true;
         }
@@ -699,10 +769,10 @@ static bool parse_value(const char **sp, JsonNode **out)
     case '"':
     {
         char *str;
-        if (parse_string(&s, out ? &str : nullptr))
+        if (parse_string(&s, out ? &str : nullptr, arena != nullptr))
         {
             if (out)
-                *out = mkstring(str);
+                *out = mkstring(str, arena);
             *sp = s;
             return true;
         }
@@ -710,7 +780,7 @@ static bool parse_value(const char **sp, JsonNode **out)
     }
 
     case '[':
-        if (parse_array(&s, out))
+        if (parse_array(&s, out, arena))
         {
             *sp = s;
             return true;
@@ -718,7 +788,7 @@ static bool parse_value(const char **sp, JsonNode **out)
         return false;
 
     case '{':
-        if (parse_object(&s, out))
+        if (parse_object(&s, out, arena))
         {
             *sp = s;
             return true;
@@ -731,7 +801,10 @@ static bool parse_value(const char **sp, JsonNode **out)
         if (parse_number(&s, out ? &num : nullptr))
         {
             if (out)
-                *out = json_mknumber(num);
+            {
+                *out = mknode(JSON_NUMBER, arena);
+                (*out)->number_ = num;
+            }
             *sp = s;
             return true;
         }
@@ -740,10 +813,10 @@ static bool parse_value(const char **sp, JsonNode **out)
     }
 }
 
-static bool parse_array(const char **sp, JsonNode **out)
+static bool parse_array(const char **sp, JsonNode **out, JsonArena *arena)
 {
     const char *s = *sp;
-    JsonNode *ret = out ? json_mkarray() : nullptr;
+    JsonNode *ret = out ? mknode(JSON_ARRAY, arena) : nullptr;
     JsonNode *element;
 
     if (*s++ != '[')
@@ -758,7 +831,7 @@ static bool parse_array(const char **sp, JsonNode **out)
 
     for (;;)
     {
-        if (!parse_value(&s, out ? &element : nullptr))
+        if (!parse_value(&s, out ? &element : nullptr, arena))
             goto failure;
         skip_space(&s);
 
@@ -783,14 +856,15 @@ success:
     return true;
 
 failure:
-    json_delete(ret);
+    if (!arena)
+        json_delete(ret);
     return false;
 }
 
-static bool parse_object(const char **sp, JsonNode **out)
+static bool parse_object(const char **sp, JsonNode **out, JsonArena *arena)
 {
     const char *s = *sp;
-    JsonNode *ret = out ? json_mkobject() : nullptr;
+    JsonNode *ret = out ? mknode(JSON_OBJECT, arena) : nullptr;
     char *key;
     JsonNode *value;
 
@@ -806,7 +880,7 @@ static bool parse_object(const char **sp, JsonNode **out)
 
     for (;;)
     {
-        if (!parse_string(&s, out ? &key : nullptr))
+        if (!parse_string(&s, out ? &key : nullptr, arena != nullptr))
             goto failure;
         skip_space(&s);
 
@@ -814,7 +888,7 @@ static bool parse_object(const char **sp, JsonNode **out)
             goto failure_free_key;
         skip_space(&s);
 
-        if (!parse_value(&s, out ? &value : nullptr))
+        if (!parse_value(&s, out ? &value : nullptr, arena))
             goto failure_free_key;
         skip_space(&s);
 
@@ -839,14 +913,20 @@ success:
     return true;
 
 failure_free_key:
-    if (out)
+    if (out && !arena)
         free(key);
 failure:
-    json_delete(ret);
+    if (!arena)
+        json_delete(ret);
     return false;
 }
 
-bool parse_string(const char **sp, char **out)
+/*
+ * If in_place, the string is unescaped over itself (which never makes it
+ * longer) and terminated where its closing quote was, instead of being
+ * copied. The input must be writable.
+ */
+bool parse_string(const char **sp, char **out, bool in_place)
 {
     const char *s = *sp;
     SB sb;
@@ -857,7 +937,9 @@ bool parse_string(const char **sp, char **out)
     if (*s++ != '"')
         return false;
 
-    if (out)
+    if (out && in_place)
+        b = const_cast<char *>(s);
+    else if (out)
     {
         sb_init(&sb);
         sb_need(&sb, 4);
@@ -951,24 +1033,29 @@ bool parse_string(const char **sp, char **out)
          * Update sb to know about the new bytes,
          * and set up b to write another character.
          */
-        if (out)
+        if (!out)
+            b = throwaway_buffer;
+        else if (!in_place)
         {
             sb.cur = b;
             sb_need(&sb, 4);
             b = sb.cur;
         }
-        else
-            b = throwaway_buffer;
     }
     s++;
 
-    if (out)
+    if (out && in_place)
+    {
+        *b = 0;
+        *out = const_cast<char *>(*sp) + 1;
+    }
+    else if (out)
         *out = sb_finish(&sb);
     *sp = s;
     return true;
 
 failed:
-    if (out)
+    if (out && !in_place)
         sb_free(&sb);
     return false;
 }
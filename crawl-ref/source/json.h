@@ -71,9 +71,39 @@ struct JsonNode
     };
 };
 
+/*
+ * Memory for json_decode_arena(): nodes are carved out of a few big blocks,
+ * and are all freed at once by reset(), which keeps the blocks for the next
+ * message. reset() can also go back to a mark(), freeing just what was
+ * allocated since then.
+ */
+class JsonArena
+{
+public:
+    JsonArena() : block(0), used(0) { }
+    ~JsonArena();
+    JsonArena(const JsonArena &) = delete;
+    JsonArena &operator=(const JsonArena &) = delete;
+
+    void *alloc(size_t size);
+    size_t mark() const;
+    void reset(size_t to = 0);
+
+private:
+    vector<char *> blocks;
+    size_t block;
+    size_t used;
+};
+
 /*** Encoding, decoding, and validation ***/
 
 JsonNode   *json_decode         (const char *json);
+/*
+ * Decode json in place: strings are unescaped where they are and point into
+ * it, so it must outlive the result. The nodes belong to arena; don't pass
+ * them to json_delete() or modify them.
+ */
+JsonNode   *json_decode_arena   (JsonArena *arena, char *json);
 char       *json_encode         (const JsonNode *node);
 char       *json_encode_string  (const char *str);
 char       *json_stringify      (const JsonNode *node, const char *space);
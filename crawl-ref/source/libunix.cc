@@ -35,6 +35,8 @@
 #include "cio.h"
 #include "crash.h"
 #include "state.h"
+#include "stringutil.h"
+#include "syscalls.h"
 #include "tiles-build-specific.h"
 #include "unicode.h"
 #include "view.h"
@@ -74,6 +76,10 @@ static COLOURS BG_COL = BLACK;
 /** @brief The default background @em colour. */
 static COLOURS BG_COL_DEFAULT = BLACK;
 
+/** @brief The options the default colours were last set from. */
+static unsigned _default_fg_option = -1;
+static unsigned _default_bg_option = -1;
+
 struct curses_style
 {
     attr_t attr;
@@ -302,6 +308,9 @@ static short translate_colour(COLOURS col);
  */
 static void write_char_at(int y, int x, const cchar_t &ch);
 
+static void _refresh();
+static void _tty_write_stats();
+
 static bool cursor_is_enabled = true;
 
 static unsigned int convert_to_curses_style(int chattr)
@@ -488,7 +497,7 @@ static int _get_key_from_curses()
     wint_t c;
 
 #ifdef USE_TILE_WEB
-    refresh();
+    _refresh();
 
     tiles.redraw();
     tiles.await_input(c, true);
@@ -764,6 +773,10 @@ void console_shutdown()
     // resetty();
     endwin();
 
+    // Written at every shutdown (resizes included), so the file is there
+    // even if we never get to shut down tidily.
+    _tty_write_stats();
+
     tcsetattr(0, TCSAFLUSH, &def_term);
 #ifdef CURSES_USE_KEYPAD
     // "if ();" to avoid undisableable spurious warning.
@@ -827,6 +840,125 @@ void puttext(int x1, int y1, const crawl_view_buffer &vbuf)
     }
 }
 
+// Accounting for -tty-stats. curses already keeps what the terminal is
+// showing and sends only the runs of cells that differ from it; this keeps
+// its own copy of the last frame only to measure those runs.
+namespace
+{
+    struct tty_cell
+    {
+        wchar_t ch;
+        attr_t attr;
+        short pair;
+
+        bool operator==(const tty_cell &other) const
+        {
+            return ch == other.ch && attr == other.attr && pair == other.pair;
+        }
+    };
+}
+
+static string _tty_stats_file;
+static vector<tty_cell> _tty_last_frame;
+static int _tty_frame_width = 0;
+static uint64_t _tty_frames = 0;
+static uint64_t _tty_cells = 0;
+static uint64_t _tty_runs = 0;
+static uint64_t _tty_style_changes = 0;
+static uint64_t _tty_text_bytes = 0;
+
+// Rough costs of the escape sequences, for est_bytes: a cursor move
+// (CSI row;col H) to start each run, and an SGR with foreground and
+// background whenever the style changes.
+static const int TTY_MOVE_BYTES = 8;
+static const int TTY_STYLE_BYTES = 12;
+
+void tty_stats_enable(const string &file)
+{
+    _tty_stats_file = file;
+}
+
+static void _tty_account_frame()
+{
+    const int w = COLS, h = LINES;
+    if (w != _tty_frame_width
+        || _tty_last_frame.size() != (size_t) (w * h))
+    {
+        // Everything is new after a resize.
+        _tty_last_frame.assign(w * h, tty_cell{0, 0, -1});
+        _tty_frame_width = w;
+    }
+
+    int cy, cx;
+    getyx(stdscr, cy, cx);
+
+    vector<cchar_t> row(w + 1);
+    const tty_cell *last_style = nullptr;
+    for (int y = 0; y < h; ++y)
+    {
+        if (mvin_wchnstr(y, 0, row.data(), w) == ERR)
+            continue;
+
+        bool in_run = false;
+        for (int x = 0; x < w; ++x)
+        {
+            wchar_t wch[CCHARW_MAX + 1] = { 0 };
+            tty_cell cell = { 0, 0, 0 };
+            getcchar(&row[x], wch, &cell.attr, &cell.pair, nullptr);
+            cell.ch = wch[0];
+
+            tty_cell &old = _tty_last_frame[y * w + x];
+            if (cell == old)
+            {
+                in_run = false;
+                continue;
+            }
+
+            ++_tty_cells;
+            if (!in_run)
+                ++_tty_runs;
+            in_run = true;
+            if (!last_style || last_style->attr != cell.attr
+                || last_style->pair != cell.pair)
+            {
+                ++_tty_style_changes;
+            }
+            char buf[4];
+            _tty_text_bytes += cell.ch ? wctoutf8(buf, cell.ch) : 1;
+
+            old = cell;
+            last_style = &old;
+        }
+    }
+    ++_tty_frames;
+
+    move(cy, cx);
+}
+
+static void _tty_write_stats()
+{
+    if (_tty_stats_file.empty())
+        return;
+    FILE *f = fopen_u(_tty_stats_file.c_str(), "w");
+    if (!f)
+        return;
+    fprintf(f, "{\"frames\":%" PRIu64 ",\"cells\":%" PRIu64
+               ",\"runs\":%" PRIu64 ",\"style_changes\":%" PRIu64
+               ",\"text_bytes\":%" PRIu64 ",\"est_bytes\":%" PRIu64 "}\n",
+            _tty_frames, _tty_cells, _tty_runs, _tty_style_changes,
+            _tty_text_bytes,
+            _tty_text_bytes + _tty_runs * TTY_MOVE_BYTES
+            + _tty_style_changes * TTY_STYLE_BYTES);
+    fclose(f);
+}
+
+static void _refresh()
+{
+    if (!_tty_stats_file.empty())
+        _tty_account_frame();
+    refresh();
+}
+
 // These next four are front functions so that we can reduce
 // the amount of curses special code that occurs outside this
 // this file. This is good, since there are some issues with
@@ -838,8 +970,14 @@ void update_screen()
     if (stdscr)
     {
         // Refreshing the default colors helps keep colors synced in ttyrecs.
-        curs_set_default_colors();
-        refresh();
+        // Only when they change, though: redoing it on every update
+        // would rebuild the same colour pairs each time.
+        if (Options.foreground_colour != _default_fg_option
+            || Options.background_colour != _default_bg_option)
+        {
+            curs_set_default_colors();
+        }
+        _refresh();
     }
 
 #ifdef USE_TILE_WEB
@@ -895,15 +1033,30 @@ void clrscr_sys()
 {
     textcolour(LIGHTGREY);
     textbackground(BLACK);
-    clear();
 #ifdef DGAMELAUNCH
-    if (!_suppress_dgl_clrscr)
+    // ttyplay and spectators start from the last real clear screen, so
+    // send one now and then; each makes the next refresh repaint it all.
+    static time_t last_dgl_clear = 0;
+    const time_t now = time(nullptr);
+    if (!_suppress_dgl_clrscr
+        && now - last_dgl_clear >= DGL_CLEAR_SCREEN_INTERVAL)
     {
+        last_dgl_clear = now;
+        clear();
         printf("%s", DGL_CLEAR_SCREEN);
         fflush(stdout);
+        return;
     }
 #endif
+    // Only blank the next frame: curses still knows what the terminal shows,
+    // so the refresh sends just the cells that end up different. Opening
+    // and closing a popup over the map no longer repaints the whole screen.
+    erase();
+}
 
+void console_force_redraw()
+{
+    clearok(curscr, TRUE);
 }
 
 void set_cursor_enabled(bool enabled)
@@ -1322,6 +1475,8 @@ static void curs_set_default_colors()
     COLOURS default_bg_prev = BG_COL_DEFAULT;
     COLOURS default_fg = static_cast<COLOURS>(Options.foreground_colour);
     COLOURS default_bg = static_cast<COLOURS>(Options.background_colour);
+    _default_fg_option = Options.foreground_colour;
+    _default_bg_option = Options.background_colour;
 
 #ifdef NCURSES_VERSION
     if (!curs_can_use_extended_colors())
@@ -1632,7 +1787,7 @@ void delay(unsigned int time)
     }
 #endif
 
-    refresh();
+    _refresh();
     if (time)
         usleep(time * 1000);
 }
@@ -1,11 +1,17 @@
 #pragma once
 
+#include <string>
+
 #ifndef O_BINARY
 #define O_BINARY 0
 #endif
 
 void fakecursorxy(int x, int y);
 int unixcurses_get_vi_key(int keyin);
+// Make the next refresh repaint every cell, e.g. if the terminal has been
+// scribbled on behind our back.
+void console_force_redraw();
+void tty_stats_enable(const std::string &file);
 
 #ifdef DGAMELAUNCH
 class suppress_dgl_clrscr
@@ -507,6 +507,12 @@ static void raycast()
     _create_blockrays();
 }
 
+// Do the ray precalculations now rather than on first use.
+void los_precompute()
+{
+    raycast();
+}
+
 static int _imbalance(ray_def ray, const coord_def& target)
 {
     int imb = 0;
@@ -0,0 +1,165 @@
+/**
+ * @file
+ * @brief Memory for Lua states: pooled small blocks, with byte accounting.
+**/
+
+#include "AppHdr.h"
+
+#include "lua-pool.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Big enough that the system allocator's overhead doesn't matter, small
+// enough that a state with little in it doesn't hold much.
+static const size_t CHUNK_SIZE = 64 * 1024;
+
+static bool _pooled(size_t size)
+{
+    return size && size <= lua_pool::MAX_POOLED;
+}
+
+static size_t _size_class(size_t size)
+{
+    return (size - 1) / lua_pool::GRAIN;
+}
+
+lua_pool::lua_pool()
+    : chunks(nullptr), chunk_pos(nullptr), chunk_end(nullptr),
+      bytes_used(0), bytes_peak(0)
+{
+    for (free_block *&list : free_lists)
+        list = nullptr;
+}
+
+lua_pool::~lua_pool()
+{
+    for (void *block : unpooled)
+        free(block);
+    while (chunks)
+    {
+        char *prev;
+        memcpy(&prev, chunks, sizeof(prev));
+        free(chunks);
+        chunks = prev;
+    }
+}
+
+void *lua_pool::alloc_pooled(size_t size)
+{
+    const size_t cls = _size_class(size);
+    if (free_block *block = free_lists[cls])
+    {
+        free_lists[cls] = block->next;
+        return block;
+    }
+
+    const size_t rounded = (cls + 1) * GRAIN;
+    if ((size_t) (chunk_end - chunk_pos) < rounded)
+    {
+        // The rest of the old chunk (less than MAX_POOLED) is wasted.
+        char *chunk = static_cast<char *>(malloc(CHUNK_SIZE));
+        if (!chunk)
+            return nullptr;
+        memcpy(chunk, &chunks, sizeof(chunks));
+        chunks = chunk;
+        chunk_pos = chunk + GRAIN;
+        chunk_end = chunk + CHUNK_SIZE;
+    }
+    void *block = chunk_pos;
+    chunk_pos += rounded;
+    return block;
+}
+
+void lua_pool::free_pooled(void *ptr, size_t size)
+{
+    if (!unpooled.empty() && unpooled.erase(ptr))
+    {
+        free(ptr);
+        return;
+    }
+
+    const size_t cls = _size_class(size);
+    free_block *block = static_cast<free_block *>(ptr);
+    block->next = free_lists[cls];
+    free_lists[cls] = block;
+}
+
+void *lua_pool::realloc(void *ptr, size_t osize, size_t nsize)
+{
+    if (!ptr)
+        osize = 0;
+
+    if (!nsize)
+    {
+        if (_pooled(osize))
+            free_pooled(ptr, osize);
+        else
+            free(ptr);
+        bytes_used -= osize;
+        return nullptr;
+    }
+
+    void *block;
+    if (!_pooled(nsize))
+    {
+        if (_pooled(osize) || !ptr)
+        {
+            block = malloc(nsize);
+            if (!block)
+                return nullptr;
+            if (ptr)
+            {
+                memcpy(block, ptr, osize);
+                free_pooled(ptr, osize);
+            }
+        }
+        else if (!(block = ::realloc(ptr, nsize)))
+            return nullptr;
+    }
+    else if (_pooled(osize) && _size_class(osize) == _size_class(nsize))
+        block = ptr;
+    else
+    {
+        block = alloc_pooled(nsize);
+        if (!block)
+        {
+            // Lua counts on shrinking never failing, and the old block is
+            // big enough. If it came from malloc(), note that, so that it
+            // goes back there rather than onto a free list.
+            if (ptr && nsize < osize)
+            {
+                if (!_pooled(osize))
+                {
+                    try
+                    {
+                        unpooled.insert(ptr);
+                    }
+                    catch (const std::bad_alloc &)
+                    {
+                        // Then it joins the pool, and is only given back
+                        // when the pool goes.
+                    }
+                }
+                bytes_used -= osize - nsize;
+                return ptr;
+            }
+            return nullptr;
+        }
+        if (ptr)
+        {
+            memcpy(block, ptr, min(osize, nsize));
+            if (_pooled(osize))
+                free_pooled(ptr, osize);
+            else
+                free(ptr);
+        }
+    }
+
+    bytes_used += nsize;
+    bytes_used -= osize;
+    if (bytes_used > bytes_peak)
+        bytes_peak = bytes_used;
+    return block;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file
+ * @brief Memory for Lua states: pooled small blocks, with byte accounting.
+**/
+
+#pragma once
+
+#include <cstddef>
+#include <set>
+
+// Lua makes great numbers of small tables, closures and strings, especially
+// while dlua builds levels. Blocks of up to MAX_POOLED bytes are carved from
+// big chunks and recycled through a free list per size class; bigger ones
+// go to realloc(). Pooled memory is only given back to the system when the
+// pool is destroyed, which must be after its state is closed.
+class lua_pool
+{
+public:
+    lua_pool();
+    ~lua_pool();
+    lua_pool(const lua_pool &) = delete;
+    lua_pool &operator=(const lua_pool &) = delete;
+
+    // As for a lua_Alloc: frees ptr if nsize is 0, otherwise returns a
+    // block of nsize bytes holding the first min(osize, nsize) bytes of
+    // ptr, or nullptr (leaving ptr alone) if out of memory. osize must be
+    // the size ptr was last allocated with.
+    void *realloc(void *ptr, size_t osize, size_t nsize);
+
+    // Bytes Lua holds now, and the most it has ever held.
+    size_t used() const { return bytes_used; }
+    size_t peak() const { return bytes_peak; }
+
+    static const size_t GRAIN = 8;
+    static const size_t MAX_POOLED = 256;
+
+private:
+    struct free_block
+    {
+        free_block *next;
+    };
+
+    char *chunks;   // each begins with a pointer to the one before
+    char *chunk_pos;
+    char *chunk_end;
+    free_block *free_lists[MAX_POOLED / GRAIN];
+    // Blocks from malloc() that were shrunk to a pooled size in place,
+    // when the pool had no memory to move them to.
+    std::set<void *> unpooled;
+    size_t bytes_used;
+    size_t bytes_peak;
+
+    void *alloc_pooled(size_t size);
+    void free_pooled(void *ptr, size_t size);
+};
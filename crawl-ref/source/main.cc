@@ -70,6 +70,7 @@
 #include "fight.h"
 #include "files.h"
 #include "fineff.h"
+#include "fork-server.h"
 #include "god-abil.h"
 #include "god-companions.h"
 #include "god-conduct.h"
@@ -289,6 +290,11 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+#ifdef USE_FORK_SERVER
+    if (!SysEnv.use_fork_server.empty())
+        fork_server_launch(SysEnv.use_fork_server, argc, argv);
+#endif
+
     // Init monsters up front - needed to handle the mon_glyph option right.
     init_char_table(CSET_ASCII);
     init_monsters();
@@ -301,6 +307,27 @@ int main(int argc, char *argv[])
     // make sure all the expected data directories exist
     validate_basedirs();
 
+#ifdef USE_FORK_SERVER
+    if (!SysEnv.fork_server.empty())
+    {
+        startup_preload();
+        fork_server_run(SysEnv.fork_server, argc, argv);
+
+        // This is now a game's own process: start over with its arguments
+        // and environment, forgetting whatever the server's own were.
+        crawl_state = game_state();
+        Options.reset_options();
+        SysEnv = system_environment();
+        get_system_environment();
+        if (!parse_args(argc, argv, true))
+        {
+            _show_commandline_options_help();
+            return 1;
+        }
+        validate_basedirs();
+    }
+#endif
+
     {
         // Read the init file -- first pass. This pass ignores lua. It'll get
         // reread with lua on starting a game.
@@ -509,6 +536,13 @@ static void _show_commandline_options_help()
     puts("  -sprint               select Sprint");
     puts("  -sprint-map <name>    preselect a Sprint map");
     puts("  -tutorial             select the Tutorial");
+    puts("  -startup-profile <file>");
+    puts("                        write the time and memory taken by each phase");
+    puts("                        of startup to <file>, as JSON");
+#if defined(UNIX) && !defined(USE_TILE_LOCAL)
+    puts("  -tty-stats <file>     write how much of the screen was redrawn, and");
+    puts("                        roughly how many bytes that took, to <file>");
+#endif
 #ifdef WIZARD
     puts("  -wizard               allow access to wizard mode");
     puts("  -explore              allow access to explore mode");
@@ -519,6 +553,11 @@ static void _show_commandline_options_help()
     puts("  -throttle             enable throttling of user Lua scripts");
     puts("  -seed <number>        specify a game seed to use when creating a new game");
 #endif
+    puts("  -lua-hook-budget <n>  stop each user Lua hook after it has run <n>");
+    puts("                        instructions in a turn, until the next turn");
+    puts("                        (0, the default, means no limit)");
+    puts("  -lua-max-memory <KB>  how much memory user Lua scripts may use");
+    puts("                        (at least 1024)");
 
     puts("");
 
@@ -540,6 +579,14 @@ static void _show_commandline_options_help()
     puts("");
     puts("Arena options: (Stage a tournament between various monsters.)");
     puts("  -arena \"<monster list> v <monster list> arena:<arena map>\"");
+#ifdef USE_FORK_SERVER
+    puts("");
+    puts("Fork server options: (Start games faster on a busy server.)");
+    puts("  -fork-server <socket>     do the setup common to all games, then");
+    puts("                            start a game for each -use-fork-server");
+    puts("  -use-fork-server <socket> start the game from that fork server,");
+    puts("                            if it's running");
+#endif
 #ifdef DEBUG_DIAGNOSTICS
     puts("");
     puts("Diagnostic options:");
@@ -563,8 +610,17 @@ static void _show_commandline_options_help()
     puts("  -objstat [<levels>] run monster and item stats on the given range "
          "of levels");
     puts("      Defaults to entire dungeon; same level syntax as -mapstat.");
-    puts("  -iters <num>        For -mapstat and -objstat, set the number of "
-         "iterations");
+    puts("  -bench-levelgen [<levels>] time level generation on the given "
+         "range of levels");
+    puts("      Same level syntax as -mapstat; iteration N uses seed "
+         "(-seed value) + N.");
+    puts("      Writes per-branch build times to levelgen-bench.txt.");
+    puts("  -bench-baseline <file> For -bench-levelgen, compare against an "
+         "earlier");
+    puts("      levelgen-bench.txt and exit with an error on regressions.");
+    puts("  -iters <num>        For -mapstat, -objstat and -bench-levelgen, "
+         "set the");
+    puts("      number of iterations");
     puts("  -force-map <map>    For -mapstat and -objstat, alway choose the "
          "      given map on every level.");
 #endif
@@ -1245,7 +1301,12 @@ static void _input()
         // binding, your turn may be ended by the first invoke of the
         // macro.
         if (!you.turn_is_over && cmd != CMD_NEXT_CMD)
+        {
+#ifdef USE_TILE_WEB
+            tiles.m_latency.mark(TRACE_DISPATCH);
+#endif
             process_command(cmd, real_prev_cmd);
+        }
 
         repeat_again_rec.paused = true;
 
@@ -2318,6 +2379,11 @@ void process_command(command_type cmd, command_type prev_cmd)
 
         // Game commands.
     case CMD_REDRAW_SCREEN:
+#if defined(UNIX) && !defined(USE_TILE_LOCAL)
+        // Screen clears only blank what curses thinks is there; this is for
+        // when the terminal shows something else.
+        console_force_redraw();
+#endif
         redraw_screen();
         update_screen();
         break;
@@ -2647,6 +2713,9 @@ void world_reacts()
     // the loudest noise tracking for the next world_reacts cycle.
     you.los_noise_last_turn = you.los_noise_level;
     you.los_noise_level = 0;
+#ifdef USE_TILE_WEB
+    tiles.m_latency.mark(TRACE_WORLD);
+#endif
 }
 
 static command_type _get_next_cmd()
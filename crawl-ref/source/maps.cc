@@ -26,6 +26,7 @@
 #include "files.h"
 #include "mapmark.h"
 #include "message.h"
+#include "startup-profile.h"
 #include "state.h"
 #include "stringutil.h"
 #include "syscalls.h"
@@ -1475,6 +1476,7 @@ static void _parse_maps(const string &s)
         return;
 
     map_files_read.insert(cache_name);
+    startup_phase phase("des:" + cache_name);
 
     if (_load_map_cache(s, cache_name))
         return;
@@ -1515,6 +1517,8 @@ void read_map(const string &file)
 
 void read_maps()
 {
+    startup_phase phase("read_maps");
+
     if (dlua.execfile("dlua/loadmaps.lua", true, true, true))
         end(1, false, "Lua error: %s", dlua.error.c_str());
 
@@ -2714,6 +2714,11 @@ bool Menu::cycle_headers(bool forward)
 }
 
 #ifdef USE_TILE_WEB
+// Menus longer than this are sent this many items at a time, starting
+// around where they're scrolled to; the client asks for more as they come
+// into view.
+static const int WEBTILES_MENU_CHUNK = 100;
+
 void Menu::webtiles_write_menu(bool replace) const
 {
     if (crawl_state.doing_prev_cmd_again)
@@ -2732,21 +2737,32 @@ void Menu::webtiles_write_menu(bool replace) const
 
     m_ui.more->webtiles_write_more();
 
-    int count = items.size();
+    const int count = items.size();
+    const int first_entry = get_first_visible();
     int start = 0;
-    int end = start + count;
+    int end = count;
+    if (count > WEBTILES_MENU_CHUNK)
+    {
+        const int anchor = is_set(MF_START_AT_END) ? count : first_entry;
+        start = min(max(0, anchor - WEBTILES_MENU_CHUNK / 4),
+                    count - WEBTILES_MENU_CHUNK);
+        end = start + WEBTILES_MENU_CHUNK;
+    }
 
     tiles.json_write_int("total_items", count);
     tiles.json_write_int("chunk_start", start);
 
-    int first_entry = get_first_visible();
     if (first_entry != 0 && !is_set(MF_START_AT_END))
         tiles.json_write_int("jump_to", first_entry);
 
     tiles.json_open_array("items");
 
+    _webtiles_sent.assign(count, 0);
     for (int i = start; i < end; ++i)
+    {
         webtiles_write_item(items[i]);
+        _webtiles_sent[i] = webtiles_item_hash(items[i]);
+    }
 
     tiles.json_close_array();
 
@@ -2773,6 +2789,9 @@ void Menu::webtiles_scroll(int first, int hover)
 
 void Menu::webtiles_handle_item_request(int start, int end)
 {
+    if (items.empty())
+        return;
+
     start = min(max(0, start), (int)items.size()-1);
     if (end < start)
         end = start;
@@ -2786,8 +2805,12 @@ void Menu::webtiles_handle_item_request(int start, int end)
 
     tiles.json_open_array("items");
 
+    _webtiles_sent.resize(items.size(), 0);
     for (int i = start; i <= end; ++i)
+    {
         webtiles_write_item(items[i]);
+        _webtiles_sent[i] = webtiles_item_hash(items[i]);
+    }
 
     tiles.json_close_array();
 
@@ -2809,42 +2832,44 @@ void Menu::webtiles_update_items(int start, int end) const
     ASSERT_RANGE(start, 0, (int) items.size());
     ASSERT_RANGE(end, start, (int) items.size());
 
-    tiles.json_open_object();
+    _webtiles_sent.resize(items.size(), 0);
 
-    tiles.json_write_string("msg", "update_menu_items");
-    tiles.json_write_int("chunk_start", start);
-
-    tiles.json_open_array("items");
-
-    for (int i = start; i <= end; ++i)
+    // Only resend the items that changed, in a message per run of them.
+    // Items the client doesn't have are left for it to ask for.
+    int i = start;
+    while (true)
     {
-        // TODO: why is this different from Menu::webtiles_write_item?
+        size_t hash = 0;
+        while (i <= end && (!_webtiles_sent[i]
+                            || (hash = webtiles_item_hash(items[i]))
+                               == _webtiles_sent[i]))
+        {
+            ++i;
+        }
+        if (i > end)
+            break;
+
         tiles.json_open_object();
-        const MenuEntry* me = items[i];
-        tiles.json_write_string("text", me->get_text());
-        int col = item_colour(me);
-        // previous colour field is deleted by client if new one not sent
-        if (col != MENU_ITEM_STOCK_COLOUR)
-            tiles.json_write_int("colour", col);
-        webtiles_write_tiles(*me);
-        if (!me->hotkeys.empty())
+
+        tiles.json_write_string("msg", "update_menu_items");
+        tiles.json_write_int("chunk_start", i);
+
+        tiles.json_open_array("items");
+        do
         {
-            tiles.json_open_array("hotkeys");
-            for (int hotkey : me->hotkeys)
-                tiles.json_write_int(hotkey);
-            tiles.json_close_array();
+            webtiles_write_item(items[i]);
+            _webtiles_sent[i] = hash;
+            ++i;
         }
+        while (i <= end && _webtiles_sent[i]
+               && (hash = webtiles_item_hash(items[i])) != _webtiles_sent[i]);
+        tiles.json_close_array();
 
         tiles.json_close_object();
+        tiles.finish_message();
     }
-
-    tiles.json_close_array();
-
-    tiles.json_close_object();
-    tiles.finish_message();
 }
 
-
 void Menu::webtiles_update_item(int index) const
 {
     webtiles_update_items(index, index);
@@ -2902,6 +2927,29 @@ void Menu::webtiles_write_tiles(const MenuEntry& me) const
     }
 }
 
+// A hash of everything webtiles_write_item() sends; never 0.
+size_t Menu::webtiles_item_hash(const MenuEntry *me) const
+{
+    if (!me)
+        return 1;
+
+    string key = me->get_text();
+    key += '\n' + to_string(me->quantity)
+           + ' ' + to_string(item_colour(me))
+           + ' ' + to_string(me->level);
+    for (int hotkey : me->hotkeys)
+        key += ' ' + to_string(hotkey);
+
+    vector<tile_def> t;
+    if (me->get_tiles(t))
+    {
+        for (const tile_def &tile : t)
+            key += ' ' + to_string(tile.tile) + ':' + to_string(tile.ymax);
+    }
+
+    return max<size_t>(hash<string>()(key), 1);
+}
+
 void Menu::webtiles_write_item(const MenuEntry* me) const
 {
     tiles.json_open_object();
@@ -441,9 +441,13 @@ protected:
 
     virtual void webtiles_write_title() const;
     virtual void webtiles_write_item(const MenuEntry *me) const;
+    size_t webtiles_item_hash(const MenuEntry *me) const;
 
     bool _webtiles_title_changed;
     formatted_string _webtiles_title;
+    // A hash of each item as the client last got it, or 0 if it doesn't
+    // have it yet.
+    mutable vector<size_t> _webtiles_sent;
 #endif
 
     virtual formatted_string calc_title();
@@ -1565,8 +1565,9 @@ static void _mpr(string text, msg_channel_type channel, int param, bool nojoin,
     if (!_doing_c_message_hook)
     {
         unwind_bool no_reentry(_doing_c_message_hook, true);
-        clua.callfn("c_message", "ss", text.c_str(),
-                                        channel_to_str(channel).c_str());
+        static const lua_hook<void(const string &, const string &)>
+            message_hook("c_message");
+        message_hook(clua, text, channel_to_str(channel));
     }
 
     bool domore = _check_more(text, channel);
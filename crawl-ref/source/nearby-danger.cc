@@ -163,9 +163,9 @@ bool mons_is_safe(const monster* mon, const bool want_move,
         bool result = is_safe;
 
         monster_info mi(mon, MILEV_SKIP_SAFE);
-        if (clua.callfn("ch_mon_is_safe", "Ibbd>b",
-                        &mi, is_safe, moving, dist,
-                        &result))
+        static const lua_hook<bool(monster_info *, bool, bool, int)>
+            mon_is_safe("ch_mon_is_safe");
+        if (mon_is_safe(clua, result, &mi, is_safe, moving, dist))
         {
             is_safe = result;
         }
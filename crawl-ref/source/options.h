@@ -355,6 +355,7 @@ public:
     int         travel_delay;   // How long to pause between travel moves
     int         explore_delay;  // How long to pause between explore moves
     int         rest_delay;     // How long to pause between rest moves
+    int         runrest_frame_rate; // Max redraws/second when not pausing
 
     bool        show_travel_trail;
 
@@ -628,6 +629,7 @@ public:
     bool        tile_level_map_hide_messages;
     bool        tile_level_map_hide_sidebar;
     bool        tile_web_mouse_control;
+    bool        tile_web_compact_map;
     string      tile_web_mobile_input_helper;
 #endif
 #endif // USE_TILE
@@ -16,6 +16,10 @@ Notes:
 * Readers always get the last complete (but not necessarily committed) write
   (ie, READ_UNCOMMITTED) at the time they started; it is safe to continue
   reading even if the chunk has been changed since.
+* Chunks queued with write_async() count as written for readers: opening
+  such a chunk waits for the background writer to finish with it.
+* write_async() of a chunk with the same contents as its last write_async()
+  in this session, or as the last time it was read to the end, does nothing.
 */
 
 #include "AppHdr.h"
@@ -32,6 +36,9 @@ Notes:
 #if defined(UNIX) || defined(TARGET_COMPILER_MINGW)
 #include <unistd.h>
 #endif
+#ifdef MMAP_SAVE
+#include <sys/mman.h>
+#endif
 
 #include "end.h"
 #include "endianness.h"
@@ -81,6 +88,69 @@ typedef pair<plen_t, plen_t> bm_p;
 typedef map<plen_t, bm_p> bm_t;
 typedef map<plen_t, plen_t> fb_t;
 
+#ifdef ASYNC_SAVE
+// Holds the package lock for the rest of the scope.
+class package_guard
+{
+public:
+    package_guard(package *p) : pkg(p) { mutex_lock(pkg->lock); }
+    ~package_guard() { mutex_unlock(pkg->lock); }
+private:
+    package *pkg;
+};
+
+// Drops a lock held exactly once (see package_guard) for the rest of the
+// scope.
+class package_unguard
+{
+public:
+    package_unguard(mutex_t &m) : lock(m) { mutex_unlock(lock); }
+    ~package_unguard() { mutex_lock(lock); }
+private:
+    mutex_t &lock;
+};
+#else
+class package_guard
+{
+public:
+    package_guard(package *) {}
+};
+#endif
+
+#ifdef USE_ZLIB
+vector<unsigned char> package::compress(const vector<unsigned char> &data,
+                                        int level)
+{
+    z_stream zs;
+    zs.data_type = Z_BINARY;
+    zs.zalloc    = 0;
+    zs.zfree     = 0;
+    zs.opaque    = Z_NULL;
+    if (deflateInit(&zs, level))
+        fail("save file compression failed during init: %s", zs.msg);
+
+    vector<unsigned char> out(deflateBound(&zs, data.size()));
+    zs.next_in   = (Bytef*)data.data();
+    zs.avail_in  = data.size();
+    zs.next_out  = out.data();
+    zs.avail_out = out.size();
+    // deflateBound() guarantees a single call is enough.
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+        fail("save file compression failed: %s", zs.msg);
+    out.resize(zs.total_out);
+    if (deflateEnd(&zs) != Z_OK)
+        fail("save file compression failed during clean-up: %s", zs.msg);
+    return out;
+}
+#else
+vector<unsigned char> package::compress(const vector<unsigned char> &data,
+                                        int level)
+{
+    UNUSED(level);
+    return data;
+}
+#endif
+
 package::package(const char* file, bool writeable, bool empty)
   : n_users(0), dirty(false), aborted(false)
 #ifdef DO_FSYNC
@@ -89,6 +159,13 @@ package::package(const char* file, bool writeable, bool empty)
 {
     dprintf("package: initializing file=\"%s\" rw=%d\n", file, writeable);
     ASSERT(writeable || !empty);
+#ifdef ASYNC_SAVE
+    init_async();
+#endif
+#ifdef MMAP_SAVE
+    map_base = nullptr;
+    map_len = 0;
+#endif
     filename = file;
     rw = writeable;
 
@@ -125,6 +202,9 @@ package::package(const char* file, bool writeable, bool empty)
         }
         catch (exception &e)
         {
+#ifdef MMAP_SAVE
+            unmap();
+#endif
             close(fd);
             throw;
         }
@@ -139,6 +219,13 @@ package::package()
 {
     dprintf("package: initializing tmp file\n");
     filename = "[tmp]";
+#ifdef ASYNC_SAVE
+    init_async();
+#endif
+#ifdef MMAP_SAVE
+    map_base = nullptr;
+    map_len = 0;
+#endif
 
     char file[7] = "XXXXXX";
     fd = mkstemp(file);
@@ -214,6 +301,22 @@ package::~package()
         // catching missing manual deletes. The C++ exit handler is the
         // only place that can be legitimately call things in wrong order.
 
+#ifdef ASYNC_SAVE
+    // Errors should have been reported by an explicit commit() or
+    // flush_async(); throwing from here would only terminate. Whatever
+    // went wrong, the file is as of the last commit, so leave it that way.
+    stop_async(aborted);
+    if (async_error)
+    {
+        dprintf("package: dropping an unreported save error\n");
+        async_error = nullptr;
+        aborted = true;
+    }
+#endif
+#ifdef MMAP_SAVE
+    unmap();
+#endif
+
     if (rw && !aborted)
     {
         commit();
@@ -228,11 +331,24 @@ package::~package()
             sysfail(rw ? "write error while saving"
                        : "can't close the save I've just read???");
         }
+#ifdef ASYNC_SAVE
+    cond_destroy(job_queued);
+    cond_destroy(job_done);
+    mutex_destroy(lock);
+#endif
     dprintf("package: closed\n");
 }
 
 void package::commit()
 {
+    // Anything queued before this commit belongs in it.
+    flush_async();
+    do_commit();
+}
+
+void package::do_commit()
+{
+    package_guard guard(this);
     ASSERT(rw);
     if (!dirty)
         return;
@@ -279,6 +395,46 @@ void package::seek(plen_t to)
         sysfail("failed to seek inside the save file");
 }
 
+#ifdef MMAP_SAVE
+// Returns a pointer to bytes [at, at + len) of the file, or nullptr if they
+// can't be mapped. The mapping is grown as the file does; readers may still
+// hold pointers into the old one, so that is kept until we're done.
+const unsigned char *package::map_range(plen_t at, plen_t len)
+{
+    if (at > file_len || len > file_len - at)
+        return nullptr;
+
+    if (at + len > map_len)
+    {
+        // Leave room to grow, so that remapping is rare. Mapping past the
+        // end of the file is fine as long as nothing there is touched.
+        const plen_t want = file_len + file_len / 2;
+        void *m = mmap(nullptr, want, PROT_READ, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED)
+            return nullptr;
+
+        if (map_base)
+            old_maps.emplace_back(map_base, map_len);
+        map_base = (const unsigned char *)m;
+        map_len = want;
+        dprintf("package: mapped %u bytes\n", (unsigned int)map_len);
+    }
+
+    return map_base + at;
+}
+
+void package::unmap()
+{
+    for (const auto &old : old_maps)
+        munmap((void *)old.first, old.second);
+    old_maps.clear();
+    if (map_base)
+        munmap((void *)map_base, map_len);
+    map_base = nullptr;
+    map_len = 0;
+}
+#endif
+
 chunk_writer* package::writer(const string &name)
 {
     return new chunk_writer(this, name);
@@ -286,11 +442,286 @@ chunk_writer* package::writer(const string &name)
 
 chunk_reader* package::reader(const string &name)
 {
-    if (plen_t *ch = map_find(directory, name))
-        return new chunk_reader(this, *ch);
+    wait_for_chunk(name);
+    package_guard guard(this);
+    if (directory.count(name))
+        return new chunk_reader(this, name);
     return 0;
 }
 
+void package::write_compressed(const string &name,
+                               const vector<unsigned char> &data)
+{
+    chunk_writer w(this, name, true);
+    w.write(data.data(), data.size());
+}
+
+// FNV-1a, with the length folded in at the end. Built up a piece at a time,
+// so that chunk_reader can hash a chunk as it is read.
+static const uint64_t CHUNK_HASH_START = 0xcbf29ce484222325ULL;
+
+static uint64_t _chunk_hash_add(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t _chunk_hash_end(uint64_t hash, uint64_t len)
+{
+    return (hash ^ len) * 1099511628211ULL;
+}
+
+static uint64_t _chunk_hash(const vector<unsigned char> &data)
+{
+    return _chunk_hash_end(_chunk_hash_add(CHUNK_HASH_START, data.data(),
+                                           data.size()),
+                           data.size());
+}
+
+void package::write_async(const string &name, vector<unsigned char> &&data,
+                          int level)
+{
+    ASSERT(rw);
+    ASSERT(!aborted);
+    ASSERT(!name.empty());
+
+    // Rewriting a chunk with exactly what it already holds is a no-op.
+    const uint64_t hash = _chunk_hash(data);
+    {
+        package_guard guard(this);
+        const uint64_t *old_hash = map_find(chunk_hashes, name);
+        if (old_hash && *old_hash == hash)
+        {
+            dprintf("write_async(%s): unchanged\n", name.c_str());
+            return;
+        }
+        chunk_hashes[name] = hash;
+    }
+
+#ifdef ASYNC_SAVE
+    {
+        package_guard guard(this);
+        if (!writer_running)
+            start_async();
+
+        if (writer_running)
+        {
+            jobs.push_back(async_job());
+            jobs.back().name = name;
+            jobs.back().data = move(data);
+            jobs.back().level = level;
+            jobs.back().seq = ++last_job_seq;
+            pending_chunks.insert(name);
+            ++jobs_pending;
+            cond_wake(job_queued);
+            return;
+        }
+    }
+    // Couldn't start the writer threads; just do it here.
+#endif
+    write_compressed(name, compress(data, level));
+}
+
+void package::commit_async()
+{
+#ifdef ASYNC_SAVE
+    package_guard guard(this);
+    if (writer_running)
+    {
+        jobs.push_back(async_job());
+        ++jobs_pending;
+        ++commits_pending;
+        cond_wake(job_queued);
+        return;
+    }
+#endif
+    do_commit();
+}
+
+void package::flush_async()
+{
+#ifdef ASYNC_SAVE
+    wait_for_jobs(false);
+#endif
+}
+
+void package::wait_for_commit()
+{
+#ifdef ASYNC_SAVE
+    wait_for_jobs(true);
+#endif
+}
+
+void package::wait_for_chunk(const string &name)
+{
+#ifdef ASYNC_SAVE
+    package_guard guard(this);
+    while (pending_chunks.count(name))
+        cond_wait(job_done, lock);
+#else
+    UNUSED(name);
+#endif
+}
+
+#ifdef ASYNC_SAVE
+void package::init_async()
+{
+    mutex_init(lock);
+    cond_init(job_queued);
+    cond_init(job_done);
+    jobs_pending = 0;
+    commits_pending = 0;
+    jobs_running = 0;
+    last_job_seq = 0;
+    writer_running = false;
+    writer_quit = false;
+}
+
+void package::start_async()
+{
+    int threads = ASYNC_SAVE_THREADS;
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0 && cpus < threads)
+        threads = cpus;
+
+    writer_quit = false;
+    for (int i = 0; i < threads; ++i)
+    {
+        thread_t th;
+        if (thread_create_joinable(&th, _async_writer, this))
+            break;
+        writer_threads.push_back(th);
+    }
+    writer_running = !writer_threads.empty();
+}
+
+void package::wait_for_jobs(bool commits_only)
+{
+    package_guard guard(this);
+    while (commits_only ? commits_pending : jobs_pending)
+        cond_wait(job_done, lock);
+
+    if (async_error)
+    {
+        // The file is in an unknown state past the last commit, so don't
+        // write anything more to it.
+        aborted = true;
+        std::exception_ptr err = async_error;
+        async_error = nullptr;
+        std::rethrow_exception(err);
+    }
+}
+
+void *package::_async_writer(void *pkg)
+{
+    static_cast<package*>(pkg)->run_async_jobs();
+    return nullptr;
+}
+
+// Each writer thread takes the oldest job. Chunks are compressed in
+// parallel, but a commit waits until everything queued before it has been
+// written, and holds up everything queued after it.
+void package::run_async_jobs()
+{
+    package_guard guard(this);
+    while (true)
+    {
+        while (jobs.empty() ? !writer_quit
+                            : jobs.front().name.empty() && jobs_running)
+        {
+            cond_wait(job_queued, lock);
+        }
+        if (jobs.empty())
+            break;
+
+        async_job job = move(jobs.front());
+        jobs.pop_front();
+        if (!job.name.empty())
+            ++jobs_running;
+
+        // After an error, leave the file alone until the main thread has
+        // seen it.
+        if (!async_error && !aborted)
+        {
+            try
+            {
+                if (job.name.empty())
+                    do_commit();
+                else
+                {
+                    vector<unsigned char> compressed;
+                    {
+                        // Compression is the slow part, and doesn't touch
+                        // the package.
+                        package_unguard unguard(lock);
+                        compressed = compress(job.data, job.level);
+                    }
+                    // Another thread may have finished a later write of
+                    // the same chunk first.
+                    uint64_t &written = written_seq[job.name];
+                    if (job.seq > written)
+                    {
+                        written = job.seq;
+                        write_compressed(job.name, compressed);
+                    }
+                }
+            }
+            catch (...)
+            {
+                async_error = std::current_exception();
+            }
+        }
+
+        if (job.name.empty())
+            --commits_pending;
+        else
+        {
+            --jobs_running;
+            pending_chunks.erase(pending_chunks.find(job.name));
+        }
+        --jobs_pending;
+        cond_wake_all(job_queued);
+        cond_wake_all(job_done);
+    }
+}
+
+// Stop the writer threads, after they've finished everything queued unless
+// discard is set. Any error they ran into is left in async_error.
+void package::stop_async(bool discard)
+{
+    {
+        package_guard guard(this);
+        if (!writer_running)
+            return;
+
+        if (discard)
+        {
+            for (const async_job &job : jobs)
+            {
+                if (job.name.empty())
+                    --commits_pending;
+                else
+                    pending_chunks.erase(pending_chunks.find(job.name));
+                --jobs_pending;
+            }
+            jobs.clear();
+        }
+        writer_quit = true;
+        cond_wake_all(job_queued);
+    }
+
+    for (thread_t &th : writer_threads)
+        thread_join(th);
+    writer_threads.clear();
+    writer_running = false;
+}
+#endif
+
 plen_t package::extend_block(plen_t at, plen_t size, plen_t by)
 {
     // the header is not counted into the block's size, yet takes space
@@ -384,8 +815,11 @@ void package::free_chunk(const string &name)
 
 void package::delete_chunk(const string &name)
 {
+    wait_for_chunk(name);
+    package_guard guard(this);
     free_chunk(name);
     directory.erase(name);
+    chunk_hashes.erase(name);
 }
 
 plen_t package::write_directory()
@@ -564,11 +998,21 @@ void package::read_directory(plen_t start, uint8_t version)
 
 bool package::has_chunk(const string &name)
 {
-    return !name.empty() && directory.count(name);
+    if (name.empty())
+        return false;
+
+    package_guard guard(this);
+#ifdef ASYNC_SAVE
+    if (pending_chunks.count(name))
+        return true;
+#endif
+    return directory.count(name);
 }
 
 vector<string> package::list_chunks()
 {
+    flush_async();
+    package_guard guard(this);
     vector<string> list;
     list.reserve(directory.size());
     for (const auto &entry : directory)
@@ -619,7 +1063,11 @@ void package::abort()
     // Disable any further operations, allow a shutdown. All errors past
     // this point are ignored (assuming we already failed). All writes since
     // the last commit() are lost.
+#ifdef ASYNC_SAVE
+    stop_async(true);
+#endif
     aborted = true;
+    chunk_hashes.clear();
 }
 
 void package::unlink()
@@ -633,6 +1081,8 @@ void package::unlink()
 // the amount of free space not at the end of file
 plen_t package::get_slack()
 {
+    flush_async();
+    package_guard guard(this);
     load_traces();
 
     plen_t slack = 0;
@@ -643,6 +1093,8 @@ plen_t package::get_slack()
 
 plen_t package::get_chunk_fragmentation(const string &name)
 {
+    flush_async();
+    package_guard guard(this);
     load_traces();
     ASSERT(directory.count(name)); // not has_chunk(), "" is valid
     plen_t frags = 0;
@@ -659,6 +1111,8 @@ plen_t package::get_chunk_fragmentation(const string &name)
 
 plen_t package::get_chunk_compressed_length(const string &name)
 {
+    flush_async();
+    package_guard guard(this);
     load_traces();
     ASSERT(directory.count(name)); // not has_chunk(), "" is valid
     plen_t len = 0;
@@ -673,22 +1127,37 @@ plen_t package::get_chunk_compressed_length(const string &name)
     return len;
 }
 
-chunk_writer::chunk_writer(package *parent, const string &_name)
-    : first_block(0), cur_block(0), block_len(0)
+chunk_writer::chunk_writer(package *parent, const string &_name,
+                           bool _precompressed)
+    : first_block(0), cur_block(0), block_len(0),
+      precompressed(_precompressed)
 {
     ASSERT(parent);
-    ASSERT(!parent->aborted);
 
     // If you need more, please change {read,write}_directory().
     ASSERT(MAX_CHUNK_NAME_LENGTH < 256);
     ASSERT(_name.length() < MAX_CHUNK_NAME_LENGTH);
 
+    // Don't race a queued write of the same chunk. Precompressed writers
+    // are how the background writer finishes those, so they mustn't wait.
+    if (!precompressed)
+        parent->wait_for_chunk(_name);
+
+    package_guard guard(parent);
+    ASSERT(!parent->aborted);
     dprintf("chunk_writer(%s): starting\n", _name.c_str());
     pkg = parent;
     pkg->n_users++;
     name = _name;
+    // Whatever this writes isn't what write_async() last saw.
+    if (!precompressed)
+        pkg->chunk_hashes.erase(name);
 
 #ifdef USE_ZLIB
+    z_buffer = nullptr;
+    if (precompressed)
+        return;
+
     zs.data_type = Z_BINARY;
     zs.zalloc    = 0;
     zs.zfree     = 0;
@@ -705,41 +1174,52 @@ chunk_writer::~chunk_writer()
 {
     dprintf("chunk_writer(%s): closing\n", name.c_str());
 
+    package_guard guard(pkg);
     ASSERT(pkg->n_users > 0);
     pkg->n_users--;
     if (pkg->aborted)
     {
 #ifdef USE_ZLIB
         // ignore errors, they're not relevant anymore
-        deflateEnd(&zs);
-        free(z_buffer);
+        if (!precompressed)
+        {
+            deflateEnd(&zs);
+            free(z_buffer);
+        }
 #endif
         return;
     }
 
 #ifdef USE_ZLIB
-    zs.avail_in = 0;
-    int res;
-    do
+    if (!precompressed)
     {
-        res = deflate(&zs, Z_FINISH);
-        if (res != Z_STREAM_END && res != Z_OK && res != Z_BUF_ERROR)
-            fail("save file compression failed: %s", zs.msg);
-        raw_write(z_buffer, zs.next_out - z_buffer);
-        zs.next_out = z_buffer;
-        zs.avail_out = ZB_SIZE;
-    } while (res != Z_STREAM_END);
-    if (deflateEnd(&zs) != Z_OK)
-        fail("save file compression failed during clean-up: %s", zs.msg);
-    free(z_buffer);
+        zs.avail_in = 0;
+        int res;
+        do
+        {
+            res = deflate(&zs, Z_FINISH);
+            if (res != Z_STREAM_END && res != Z_OK && res != Z_BUF_ERROR)
+                fail("save file compression failed: %s", zs.msg);
+            raw_write(z_buffer, zs.next_out - z_buffer);
+            zs.next_out = z_buffer;
+            zs.avail_out = ZB_SIZE;
+        } while (res != Z_STREAM_END);
+        if (deflateEnd(&zs) != Z_OK)
+            fail("save file compression failed during clean-up: %s", zs.msg);
+        free(z_buffer);
+    }
 #endif
     if (cur_block)
         finish_block(0);
     pkg->finish_chunk(name, first_block);
+    // A reader may have hashed the old contents while this was written.
+    if (!precompressed)
+        pkg->chunk_hashes.erase(name);
 }
 
 void chunk_writer::raw_write(const void *data, plen_t len)
 {
+    package_guard guard(pkg);
     while (len > 0)
     {
         plen_t space = pkg->extend_block(cur_block, block_len, len);
@@ -783,6 +1263,12 @@ void chunk_writer::write(const void *data, plen_t len)
     ASSERT(!pkg->aborted);
 
 #ifdef USE_ZLIB
+    if (precompressed)
+    {
+        raw_write(data, len);
+        return;
+    }
+
     zs.next_in  = (Bytef*)data;
     zs.avail_in = len;
     while (zs.avail_in)
@@ -804,11 +1290,14 @@ void chunk_writer::write(const void *data, plen_t len)
 
 void chunk_reader::init(plen_t start)
 {
+    package_guard guard(pkg);
     ASSERT(!pkg->aborted);
     pkg->n_users++;
     pkg->reader_count[start]++;
     first_block = next_block = start;
     block_left = 0;
+    hash = CHUNK_HASH_START;
+    hashed_len = 0;
 
 #ifdef USE_ZLIB
     if (!start)
@@ -836,10 +1325,13 @@ chunk_reader::chunk_reader(package *parent, plen_t start)
 chunk_reader::chunk_reader(package *parent, const string &_name)
 {
     ASSERT(parent);
+    parent->wait_for_chunk(_name);
+    package_guard guard(parent);
     if (!parent->has_chunk(_name))
         corrupted("save file corrupted -- chunk \"%s\" missing", _name.c_str());
     dprintf("chunk_reader(%s): starting\n", _name.c_str());
     pkg = parent;
+    name = _name;
     init(parent->directory[_name]);
 }
 
@@ -851,6 +1343,7 @@ chunk_reader::~chunk_reader()
     if (inflateEnd(&zs) != Z_OK)
         fail("save file decompression failed during clean-up: %s", zs.msg);
 #endif
+    package_guard guard(pkg);
     ASSERT(pkg->reader_count[first_block] > 0);
     if (!--pkg->reader_count[first_block])
         pkg->reader_count.erase(first_block);
@@ -860,6 +1353,7 @@ chunk_reader::~chunk_reader()
 
 plen_t chunk_reader::raw_read(void *data, plen_t len)
 {
+    package_guard guard(pkg);
     void *buf = data;
     while (len)
     {
@@ -904,6 +1398,45 @@ plen_t chunk_reader::raw_read(void *data, plen_t len)
     return (char*)buf - (char*)data;
 }
 
+#ifdef MMAP_SAVE
+// Points *data at the rest of the current block, straight in the file
+// mapping, and moves past it. Leaves *data alone if there's nothing to map,
+// in which case raw_read() can carry on from where this left off.
+plen_t chunk_reader::raw_map(const unsigned char **data)
+{
+    package_guard guard(pkg);
+    if (!block_left)
+    {
+        if (!next_block)
+            return 0;
+
+        const unsigned char *header = pkg->map_range(next_block,
+                                                     sizeof(block_header));
+        if (!header)
+            return 0;
+
+        block_header bl;
+        memcpy(&bl, header, sizeof(block_header));
+        off = next_block + sizeof(block_header);
+        block_left = htole(bl.len);
+        next_block = htole(bl.next);
+        // This reeks of on-disk corruption (zeroed data).
+        if (!block_left)
+            corrupted("save file corrupted -- empty block");
+    }
+
+    const unsigned char *block = pkg->map_range(off, block_left);
+    if (!block)
+        return 0;
+
+    *data = block;
+    const plen_t s = block_left;
+    off += s;
+    block_left = 0;
+    return s;
+}
+#endif
+
 plen_t chunk_reader::read(void *data, plen_t len)
 {
     ASSERT(data);
@@ -922,8 +1455,18 @@ plen_t chunk_reader::read(void *data, plen_t len)
     {
         if (!zs.avail_in)
         {
-            zs.next_in  = z_buffer;
-            zs.avail_in = raw_read(z_buffer, sizeof(z_buffer));
+#ifdef MMAP_SAVE
+            // Inflate straight from the mapped block, without a copy.
+            const unsigned char *mapped = nullptr;
+            zs.avail_in = raw_map(&mapped);
+            if (mapped)
+                zs.next_in = (Bytef*)mapped;
+            else
+#endif
+            {
+                zs.next_in  = z_buffer;
+                zs.avail_in = raw_read(z_buffer, sizeof(z_buffer));
+            }
             if (!zs.avail_in)
                 corrupted("save file corrupted -- block truncated");
         }
@@ -931,15 +1474,45 @@ plen_t chunk_reader::read(void *data, plen_t len)
         if (res == Z_STREAM_END)
         {
             eof = true;
+            hash_read(data, zs.next_out - (Bytef*)data, true);
             return zs.next_out - (Bytef*)data;
         }
         if (res != Z_OK)
             corrupted("save file decompression failed: %s", zs.msg);
     }
-    return zs.next_out - (Bytef*)data;
+    hash_read(data, len, false);
+    return len;
 #else
-    return raw_read(data, len);
+    const plen_t got = raw_read(data, len);
+    hash_read(data, got, got < len);
+    return got;
+#endif
+}
+
+// Once a chunk has been read to the end, a write_async() of the same
+// contents can be skipped, just as if this session had written it. That
+// is what makes leaving an untouched level cheap after a restore.
+void chunk_reader::hash_read(const void *data, plen_t len, bool at_end)
+{
+    if (name.empty())
+        return;
+
+    hash = _chunk_hash_add(hash, data, len);
+    hashed_len += len;
+    if (!at_end)
+        return;
+
+    // Only if this is still what the chunk holds, and no newer write of it
+    // is on its way.
+    package_guard guard(pkg);
+    const plen_t *at = map_find(pkg->directory, name);
+    if (!at || *at != first_block)
+        return;
+#ifdef ASYNC_SAVE
+    if (pkg->pending_chunks.count(name))
+        return;
 #endif
+    pkg->chunk_hashes[name] = _chunk_hash_end(hash, hashed_len);
 }
 
 void chunk_reader::read_all(vector<char> &data)
@@ -2,6 +2,8 @@
 
 #define USE_ZLIB
 
+#include <deque>
+#include <exception>
 #include <map>
 #include <set>
 #include <string>
@@ -10,7 +12,9 @@
 #include <zlib.h>
 #endif
 
+using std::deque;
 using std::map;
+using std::multiset;
 using std::pair;
 using std::set;
 using std::string;
@@ -20,6 +24,34 @@ using std::vector;
 #define DO_FSYNC
 #endif
 
+// Compress and write chunks queued with write_async() on background
+// threads. Elsewhere, write_async() and commit_async() do the work
+// immediately.
+#if defined(UNIX) && !defined(__ANDROID__) && !defined(__HAIKU__)
+#define ASYNC_SAVE
+#include "threads.h"
+#endif
+
+// At most this many writer threads, and no more than there are CPUs.
+#ifndef ASYNC_SAVE_THREADS
+#define ASYNC_SAVE_THREADS 4
+#endif
+
+// zlib levels for chunks that are saved rarely, and for the ones written
+// on every level change (the level maps), where time matters more.
+#ifndef SAVE_COMPRESSION
+#define SAVE_COMPRESSION Z_DEFAULT_COMPRESSION
+#endif
+#ifndef SAVE_COMPRESSION_FAST
+#define SAVE_COMPRESSION_FAST Z_BEST_SPEED
+#endif
+
+// Read chunks straight out of a read-only mapping of the save file, rather
+// than copying each block in with read(). Writes still go through fd.
+#ifdef UNIX
+#define MMAP_SAVE
+#endif
+
 #define MAX_CHUNK_NAME_LENGTH 255
 
 typedef uint32_t plen_t;
@@ -38,10 +70,14 @@ private:
     z_stream zs;
     Bytef *z_buffer;
 #endif
+    bool precompressed;
     void raw_write(const void *data, plen_t len);
     void finish_block(plen_t next);
 public:
-    chunk_writer(package *parent, const string &_name);
+    // If _precompressed is set, write() takes a complete zlib stream rather
+    // than raw data.
+    chunk_writer(package *parent, const string &_name,
+                 bool _precompressed = false);
     ~chunk_writer();
     void write(const void *data, plen_t len);
     friend class package;
@@ -53,14 +89,21 @@ private:
     chunk_reader(package *parent, plen_t start);
     void init(plen_t start);
     package *pkg;
+    string name;                    // empty if opened by position
     plen_t first_block, next_block;
     plen_t off, block_left;
+    uint64_t hash;                  // of everything read so far
+    uint64_t hashed_len;
 #ifdef USE_ZLIB
     bool eof;
     z_stream zs;
     Bytef z_buffer[32768];
 #endif
     plen_t raw_read(void *data, plen_t len);
+    void hash_read(const void *data, plen_t len, bool at_end);
+#ifdef MMAP_SAVE
+    plen_t raw_map(const unsigned char **data);
+#endif
 public:
     chunk_reader(package *parent, const string &_name);
     ~chunk_reader();
@@ -78,6 +121,20 @@ public:
     chunk_writer* writer(const string &name);
     chunk_reader* reader(const string &name);
     void commit();
+    // Queue a chunk that has already been marshalled into memory, and
+    // a commit of everything queued so far. The data is compressed at
+    // the given zlib level and written by background threads; see
+    // flush_async(). Writes that wouldn't change a chunk are skipped.
+    void write_async(const string &name, vector<unsigned char> &&data,
+                     int level = SAVE_COMPRESSION);
+    void commit_async();
+    // Wait until everything queued has been written, or only until every
+    // queued commit is done, and rethrow any error the background thread
+    // ran into. Never call these with the package lock held. Do one of
+    // these (or commit()) before deleting the package: the destructor can
+    // only drop such errors.
+    void flush_async();
+    void wait_for_commit();
     void delete_chunk(const string &name);
     bool has_chunk(const string &name);
     vector<string> list_chunks();
@@ -90,6 +147,10 @@ public:
     plen_t get_size() const { return file_len; };
     plen_t get_chunk_fragmentation(const string &name);
     plen_t get_chunk_compressed_length(const string &name);
+
+    // A complete zlib stream of data, as write_async() would store it.
+    static vector<unsigned char> compress(const vector<unsigned char> &data,
+                                          int level = SAVE_COMPRESSION);
 private:
     string filename;
     bool rw;
@@ -107,6 +168,54 @@ private:
     map<plen_t, pair<plen_t, plen_t> > block_map;
     set<plen_t> new_chunks;
     map<plen_t, uint32_t> reader_count;
+    // Hashes of what each chunk holds, as last written by write_async() or
+    // read to the end by a chunk_reader.
+    map<string, uint64_t> chunk_hashes;
+#ifdef ASYNC_SAVE
+    struct async_job
+    {
+        string name;                // empty for a commit
+        vector<unsigned char> data;
+        int level;
+        uint64_t seq;
+    };
+    // Guards all of the package's state against the writer threads.
+    // Recursive, so public methods can call each other freely.
+    mutex_t lock;
+    cond_t job_queued;
+    cond_t job_done;
+    deque<async_job> jobs;
+    int jobs_pending;               // queued or being written
+    int jobs_running;               // chunks being compressed or written
+    int commits_pending;
+    multiset<string> pending_chunks;
+    // Chunks can finish out of order; don't let an older write of a chunk
+    // replace a newer one.
+    uint64_t last_job_seq;
+    map<string, uint64_t> written_seq;
+    std::exception_ptr async_error;
+    bool writer_running;
+    bool writer_quit;
+    vector<thread_t> writer_threads;
+    void init_async();
+    void start_async();
+    void wait_for_jobs(bool commits_only);
+    static void *_async_writer(void *pkg);
+    void run_async_jobs();
+    void stop_async(bool discard);
+#endif
+#ifdef MMAP_SAVE
+    // The current mapping, which may extend past the end of the file, and
+    // older ones that readers might still be pointing into.
+    const unsigned char *map_base;
+    plen_t map_len;
+    vector<pair<const unsigned char *, plen_t> > old_maps;
+    const unsigned char *map_range(plen_t at, plen_t len);
+    void unmap();
+#endif
+    void wait_for_chunk(const string &name);
+    void write_compressed(const string &name, const vector<unsigned char> &data);
+    void do_commit();
     plen_t extend_block(plen_t at, plen_t size, plen_t by);
     plen_t alloc_block(plen_t &size);
     void finish_chunk(const string &name, plen_t at);
@@ -123,4 +232,5 @@ private:
     void load_traces();
     friend class chunk_writer;
     friend class chunk_reader;
+    friend class package_guard;
 };
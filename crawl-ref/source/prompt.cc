@@ -55,7 +55,10 @@ int yesno(const char *str, bool allow_lowercase, int default_answer, bool clear_
 
     // Allow players to answer prompts via clua.
     // XXX: always not currently supported
-    maybe_bool res = clua.callmaybefn("c_answer_prompt", "s", str);
+    static const lua_hook<maybe_bool(const char *)>
+        answer_prompt("c_answer_prompt");
+    maybe_bool res = MB_MAYBE;
+    answer_prompt(clua, res, str);
     if (res == MB_TRUE)
         return true;
     if (res == MB_FALSE)
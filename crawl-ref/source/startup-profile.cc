@@ -0,0 +1,182 @@
+/**
+ * @file
+ * @brief Timing the phases of startup, for -startup-profile.
+ *
+ * The report is a JSON object, written once startup is over (or when the
+ * process ends before that, e.g. for -builddb):
+ *
+ *   {"version": "...", "total_ms": ..., "phases": [
+ *       {"name": "initialize", "parent": -1, "start_ms": ..., "wall_ms": ...,
+ *        "cpu_ms": ..., "alloc_bytes": ...}, ...]}
+ *
+ * Phases are listed in the order they started; "parent" is the index of
+ * the enclosing phase, or -1. "alloc_bytes" is the growth of the heap in
+ * use over the phase (allocations minus frees), or null where the C
+ * library can't tell us.
+**/
+
+#include "AppHdr.h"
+
+#include "startup-profile.h"
+
+#include <chrono>
+#include <ctime>
+#ifdef UNIX
+#include <sys/resource.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "json.h"
+#include "json-wrapper.h"
+#include "syscalls.h"
+#include "version.h"
+
+namespace
+{
+    struct usage_sample
+    {
+        chrono::steady_clock::time_point wall;
+        double cpu_ms;
+        int64_t heap_bytes;   // -1 if unknown
+    };
+
+    struct phase_record
+    {
+        string name;
+        int parent;
+        usage_sample start;
+        usage_sample stop;
+    };
+}
+
+static bool _profiling = false;
+static string _report_file;
+static usage_sample _epoch;
+static vector<phase_record> _phases;
+static int _open_phase = -1;
+
+static double _cpu_ms()
+{
+#ifdef UNIX
+    struct rusage usage;
+    if (!getrusage(RUSAGE_SELF, &usage))
+    {
+        return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0
+               + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+    }
+#endif
+    return clock() * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static int64_t _heap_bytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    const struct mallinfo2 info = mallinfo2();
+    return (int64_t) info.uordblks + (int64_t) info.hblkhd;
+#elif defined(__GLIBC__)
+    const struct mallinfo info = mallinfo();
+    return (int64_t) (unsigned int) info.uordblks
+           + (int64_t) (unsigned int) info.hblkhd;
+#else
+    return -1;
+#endif
+}
+
+static usage_sample _sample()
+{
+    return { chrono::steady_clock::now(), _cpu_ms(), _heap_bytes() };
+}
+
+static double _ms_between(const usage_sample &from, const usage_sample &to)
+{
+    return chrono::duration<double, milli>(to.wall - from.wall).count();
+}
+
+startup_phase::startup_phase(const char *name)
+    : m_index(-1)
+{
+    if (!_profiling)
+        return;
+
+    m_index = _phases.size();
+    _phases.push_back({ name, _open_phase, usage_sample(), usage_sample() });
+    _open_phase = m_index;
+    // Sample last, so that the bookkeeping isn't charged to the phase.
+    _phases[m_index].start = _sample();
+}
+
+startup_phase::startup_phase(const string &name)
+    : startup_phase(name.c_str())
+{
+}
+
+startup_phase::~startup_phase()
+{
+    if (m_index < 0)
+        return;
+
+    _phases[m_index].stop = _sample();
+    _open_phase = _phases[m_index].parent;
+}
+
+void startup_profile_enable(const string &file)
+{
+    _report_file = file;
+    _profiling = true;
+    _epoch = _sample();
+}
+
+static JsonNode *_phase_json(const phase_record &phase)
+{
+    JsonNode *node(json_mkobject());
+    json_append_member(node, "name", json_mkstring(phase.name));
+    json_append_member(node, "parent", json_mknumber(phase.parent));
+    json_append_member(node, "start_ms",
+                       json_mknumber(_ms_between(_epoch, phase.start)));
+    json_append_member(node, "wall_ms",
+                       json_mknumber(_ms_between(phase.start, phase.stop)));
+    json_append_member(node, "cpu_ms",
+                       json_mknumber(phase.stop.cpu_ms - phase.start.cpu_ms));
+    json_append_member(node, "alloc_bytes",
+        phase.start.heap_bytes < 0 ? json_mknull()
+        : json_mknumber(phase.stop.heap_bytes - phase.start.heap_bytes));
+    return node;
+}
+
+/**
+ * Write the report, if we're profiling and haven't already. Called at the
+ * end of the first startup_step(), and by end() in case we never get that
+ * far. Phases still open at that point are closed now.
+ */
+void startup_profile_finish()
+{
+    if (!_profiling)
+        return;
+    _profiling = false;
+
+    const usage_sample now = _sample();
+    for (phase_record &phase : _phases)
+        if (phase.stop.wall == chrono::steady_clock::time_point())
+            phase.stop = now;
+
+    JsonWrapper json(json_mkobject());
+    json_append_member(json.node, "version", json_mkstring(Version::Long));
+    json_append_member(json.node, "total_ms",
+                       json_mknumber(_ms_between(_epoch, now)));
+    JsonNode *phases(json_mkarray());
+    for (const phase_record &phase : _phases)
+        json_append_element(phases, _phase_json(phase));
+    json_append_member(json.node, "phases", phases);
+
+    FILE *f = fopen_u(_report_file.c_str(), "w");
+    if (!f)
+    {
+        fprintf(stderr, "Unable to write startup profile to %s\n",
+                _report_file.c_str());
+        return;
+    }
+    fprintf(f, "%s\n", json.to_string().c_str());
+    fclose(f);
+}
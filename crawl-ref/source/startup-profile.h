@@ -0,0 +1,27 @@
+/**
+ * @file
+ * @brief Timing the phases of startup, for -startup-profile.
+**/
+
+#pragma once
+
+// While profiling is on, measures the wall time, CPU time and net heap
+// allocation between its construction and destruction, as one phase of
+// startup. Phases opened inside another phase are recorded as its children.
+// When profiling is off this does nothing beyond checking a flag.
+class startup_phase
+{
+public:
+    explicit startup_phase(const char *name);
+    explicit startup_phase(const string &name);
+    ~startup_phase();
+
+    startup_phase(const startup_phase &) = delete;
+    startup_phase &operator=(const startup_phase &) = delete;
+
+private:
+    int m_index;
+};
+
+void startup_profile_enable(const string &file);
+void startup_profile_finish();
@@ -29,6 +29,7 @@
 #include "items.h"
 #include "libutil.h"
 #include "loading-screen.h"
+#include "los.h"
 #include "macro.h"
 #include "maps.h"
 #include "menu.h"
@@ -48,6 +49,7 @@
 #include "spl-book.h"
 #include "spl-util.h"
 #include "stairs.h"
+#include "startup-profile.h"
 #include "state.h"
 #include "status.h"
 #include "stringutil.h"
@@ -75,9 +77,74 @@ static void _loading_message(string m)
 #endif
 }
 
+static void _init_indices()
+{
+    startup_phase phase("indices");
+    init_spell_descs();        // This needs to be way up top. {dlb}
+    init_zap_index();
+    init_mut_index();
+    init_sac_index();
+    init_duration_index();
+    init_mon_name_cache();
+    init_mons_spells();
+}
+
+static void _init_databases_and_maps()
+{
+    // Initialise internal databases.
+    _loading_message("Loading databases...");
+    databaseSystemInit();
+
+    _loading_message("Loading spells and features...");
+    {
+        startup_phase phase("name_caches");
+        init_feat_desc_cache();
+        init_spell_name_cache();
+#ifdef DEBUG
+        validate_spellbooks();
+#endif
+    }
+
+    // Read special levels and vaults.
+    _loading_message("Loading maps...");
+    read_maps();
+    startup_phase phase("map_preludes");
+    run_map_global_preludes();
+}
+
+#ifdef USE_FORK_SERVER
+// Set when startup_preload() has done the first game's share of
+// _initialize().
+static bool _preloaded = false;
+
+/**
+ * Do the expensive part of startup that is the same for every player,
+ * before there is a player: the fork server does this once, and each game
+ * it forks skips it.
+ */
+void startup_preload()
+{
+    startup_phase phase("preload");
+    clua.init_libraries();
+    _init_indices();
+    init_dungeon_lua();
+    _init_databases_and_maps();
+    los_precompute();
+    _preloaded = true;
+}
+#endif
+
 // Initialise a whole lot of stuff...
 static void _initialize()
 {
+#ifdef USE_FORK_SERVER
+    const bool preloaded = _preloaded;
+    _preloaded = false; // a restart after this game does it all again
+#else
+    const bool preloaded = false;
+#endif
+    startup_phase phase("initialize");
+
     Options.fixup_options();
 
     you.symbol = MONS_PLAYER;
@@ -85,18 +152,17 @@ static void _initialize()
 
     rng::seed(); // don't use any chosen seed yet
 
-    clua.init_libraries();
+    if (!preloaded)
+    {
+        startup_phase lua_phase("lua_libraries");
+        clua.init_libraries();
+    }
 
     init_char_table(Options.char_set);
     init_show_table();
     init_monster_symbols();
-    init_spell_descs();        // This needs to be way up top. {dlb}
-    init_zap_index();
-    init_mut_index();
-    init_sac_index();
-    init_duration_index();
-    init_mon_name_cache();
-    init_mons_spells();
+    if (!preloaded)
+        _init_indices();
 
     // init_item_name_cache() needs to be redone after init_char_table()
     // and init_show_table() have been called, so that the glyphs will
@@ -121,7 +187,11 @@ static void _initialize()
     you.unique_items.init(UNIQ_NOT_EXISTS);
 
     // Set up the Lua interpreter for the dungeon builder.
-    init_dungeon_lua();
+    if (!preloaded)
+    {
+        startup_phase lua_phase("dungeon_lua");
+        init_dungeon_lua();
+    }
 
 #ifdef USE_TILE_LOCAL
     // Draw the splash screen before the database gets initialised as that
@@ -131,21 +201,8 @@ static void _initialize()
         loading_screen_open();
 #endif
 
-    // Initialise internal databases.
-    _loading_message("Loading databases...");
-    databaseSystemInit();
-
-    _loading_message("Loading spells and features...");
-    init_feat_desc_cache();
-    init_spell_name_cache();
-#ifdef DEBUG
-    validate_spellbooks();
-#endif
-
-    // Read special levels and vaults.
-    _loading_message("Loading maps...");
-    read_maps();
-    run_map_global_preludes();
+    if (!preloaded)
+        _init_databases_and_maps();
 
     if (crawl_state.build_db)
         end(0);
@@ -250,6 +307,7 @@ static void _zap_los_monsters()
 
 static void _post_init(bool newc)
 {
+    startup_phase phase("post_init");
     ASSERT(strwidth(you.your_name) <= MAX_NAME_LENGTH);
 
     // XXX: now that the player is loaded, do a layout.
@@ -1103,6 +1161,7 @@ bool startup_step()
         crawl_state.default_startup_name = you.your_name;
 
     _post_init(newchar);
+    startup_profile_finish();
 
     return newchar;
 }
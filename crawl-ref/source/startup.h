@@ -5,5 +5,8 @@
 
 #pragma once
 
+#ifdef USE_FORK_SERVER
+void startup_preload();
+#endif
 bool startup_step();
 void cio_init();
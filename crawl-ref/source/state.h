@@ -69,6 +69,8 @@ struct game_state
     bool map_stat_dump_disconnect; // Set if we dump disconnected maps and exit
                                    // under mapstat.
     bool obj_stat_gen;      // Set if we're generating object stats.
+    bool levelgen_bench;    // Set if we're benchmarking level generation
+                            // (implies map_stat_gen).
 
     string force_map;       // Set if we're forcing a specific map to generate.
 
@@ -90,6 +92,8 @@ struct game_state
 
     bool throttle;
     bool bypassed_startup_menu;
+    int lua_hook_budget;    // Instructions per turn for each clua hook.
+    int lua_max_memory;     // Kilobytes the clua VM may use.
 
     bool show_more_prompt;  // Set to false to disable --more-- prompts.
 
@@ -43,37 +43,48 @@ AAssetManager *_android_asset_manager = nullptr; // XXX
 #endif
 
 bool lock_file(int fd, bool write, bool wait)
+{
+    return lock_file_range(fd, write, wait, 0, 0);
+}
+
+bool unlock_file(int fd)
+{
+    return unlock_file_range(fd, 0, 0);
+}
+
+bool lock_file_range(int fd, bool write, bool wait, off_t start, off_t len)
 {
 #ifdef TARGET_OS_WINDOWS
     OVERLAPPED pos;
     pos.hEvent     = 0;
-    pos.Offset     = 0;
+    pos.Offset     = start;
     pos.OffsetHigh = 0;
     return !!LockFileEx((HANDLE)_get_osfhandle(fd),
                         (write ? LOCKFILE_EXCLUSIVE_LOCK : 0) |
                         (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY),
-                        0, -1, -1, &pos);
+                        0, len ? len : -1, len ? 0 : -1, &pos);
 #else
     struct flock fl;
     fl.l_type = write ? F_WRLCK : F_RDLCK;
     fl.l_whence = SEEK_SET;
-    fl.l_start = 0;
-    fl.l_len = 0;
+    fl.l_start = start;
+    fl.l_len = len;
 
     return !fcntl(fd, wait ? F_SETLKW : F_SETLK, &fl);
 #endif
 }
 
-bool unlock_file(int fd)
+bool unlock_file_range(int fd, off_t start, off_t len)
 {
 #ifdef TARGET_OS_WINDOWS
-    return !!UnlockFile((HANDLE)_get_osfhandle(fd), 0, 0, -1, -1);
+    return !!UnlockFile((HANDLE)_get_osfhandle(fd), start, 0,
+                        len ? len : -1, len ? 0 : -1);
 #else
     struct flock fl;
     fl.l_type = F_UNLCK;
     fl.l_whence = SEEK_SET;
-    fl.l_start = 0;
-    fl.l_len = 0;
+    fl.l_start = start;
+    fl.l_len = len;
 
     return !fcntl(fd, F_SETLK, &fl);
 #endif
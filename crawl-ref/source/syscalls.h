@@ -11,6 +11,9 @@
 
 bool lock_file(int fd, bool write, bool wait = false);
 bool unlock_file(int fd);
+// Lock only len bytes from start; a len of 0 means to the end of the file.
+bool lock_file_range(int fd, bool write, bool wait, off_t start, off_t len);
+bool unlock_file_range(int fd, off_t start, off_t len);
 
 bool read_urandom(char *buf, int len);
 
@@ -236,12 +236,18 @@ void reader::fail_if_not_eof(const string &name)
     char dummy;
     if (_chunk ? _chunk->read(&dummy, 1) :
         _file ? (fgetc(_file) != EOF) :
-        _read_offset >= _pbuf->size())
+        _read_offset < _pbuf->size())
     {
         fail("Incomplete read of \"%s\" - aborting.", name.c_str());
     }
 }
 
+writer::~writer()
+{
+    if (_save && !failed)
+        _save->write_async(_chunkname, move(_save_buf), _compression);
+}
+
 void writer::check_ok(bool ok)
 {
     if (!ok && !failed)
@@ -257,9 +263,7 @@ void writer::writeByte(unsigned char ch)
     if (failed)
         return;
 
-    if (_chunk)
-        _chunk->write(&ch, 1);
-    else if (_file)
+    if (_file)
         check_ok(fputc(ch, _file) != EOF);
     else
         _pbuf->push_back(ch);
@@ -270,9 +274,7 @@ void writer::write(const void *data, size_t size)
     if (failed)
         return;
 
-    if (_chunk)
-        _chunk->write(data, size);
-    else if (_file)
+    if (_file)
         check_ok(fwrite(data, 1, size, _file) == size);
     else
     {
@@ -283,7 +285,6 @@ void writer::write(const void *data, size_t size)
 
 long writer::tell()
 {
-    ASSERT(!_chunk);
     return _file? ftell(_file) : _pbuf->size();
 }
 
@@ -324,6 +325,13 @@ static void _tag_read_level(reader &th);
 static void _tag_read_level_items(reader &th);
 static void _tag_read_level_monsters(reader &th);
 static void _tag_read_level_tiles(reader &th);
+static void _tag_construct_level_band(writer &th, int band);
+static void _tag_read_level_band(reader &th, int band);
+#if TAG_MAJOR_VERSION == 34
+static void _tag_read_level_map(reader &th, int x_from, int x_to);
+static void _tag_read_tile_flavours(reader &th, int x_from, int x_to, int gy);
+#endif
+static void _tag_read_forgotten_map(reader &th, int x_from, int x_to);
 static void _regenerate_tile_flavour();
 static void _draw_tiles();
 
@@ -465,6 +473,66 @@ int64_t unmarshallSigned(reader& th)
         return (int64_t)(u >> 1);
 }
 
+// A run-length encoded block of values, each stored in width bytes. The
+// whole block is built in memory and handed to the writer in one go, and
+// read back the same way.
+void marshallRLEBlock(writer &th, const vector<uint32_t> &values, int width)
+{
+    ASSERT(width == 1 || width == 2 || width == 4);
+
+    vector<unsigned char> block;
+    block.reserve(values.size() / 4 * (width + 1) + width + 1);
+    for (size_t i = 0; i < values.size();)
+    {
+        const uint32_t value = values[i];
+        size_t run = 1;
+        while (run < 255 && i + run < values.size() && values[i + run] == value)
+            ++run;
+
+        block.push_back(run);
+        for (int b = width - 1; b >= 0; --b)
+            block.push_back((value >> (8 * b)) & 0xFF);
+        i += run;
+    }
+
+    marshallInt(th, values.size());
+    marshallInt(th, block.size());
+    th.write(block.data(), block.size());
+}
+
+void unmarshallRLEBlock(reader &th, vector<uint32_t> &values, int width)
+{
+    ASSERT(width == 1 || width == 2 || width == 4);
+
+    const int count = unmarshallInt(th);
+    const int size = unmarshallInt(th);
+    if (count < 0 || size < 0)
+        die("save corrupted: bad run-length block");
+
+    vector<unsigned char> block(size);
+    th.read(block.data(), size);
+
+    values.clear();
+    values.reserve(count);
+    for (size_t i = 0; i < block.size();)
+    {
+        if (block.size() - i < (size_t)width + 1)
+            die("save corrupted: truncated run-length block");
+
+        const int run = block[i++];
+        uint32_t value = 0;
+        for (int b = 0; b < width; ++b)
+            value = (value << 8) | block[i++];
+
+        if (!run || values.size() + run > (size_t)count)
+            die("save corrupted: bad run-length block");
+        values.insert(values.end(), run, value);
+    }
+
+    if (values.size() != (size_t)count)
+        die("save corrupted: short run-length block");
+}
+
 // Optimized for short vectors that have only the first few bits set, and
 // can have invalid length. For long ones you might want to do this
 // differently to not lose 1/8 bits and speed.
@@ -1255,6 +1323,33 @@ void tag_write(tag_type tagID, writer &outf)
     outf.write(&buf[0], buf.size());
 }
 
+void tag_write_level_band(int band, writer &outf)
+{
+    ASSERT_RANGE(band, 0, LEVEL_BANDS);
+
+    vector<unsigned char> buf;
+    writer th(&buf);
+    _tag_construct_level_band(th, band);
+
+    marshallInt(outf, buf.size());
+    outf.write(&buf[0], buf.size());
+}
+
+void tag_read_level_band(reader &inf, int band)
+{
+    ASSERT_RANGE(band, 0, LEVEL_BANDS);
+
+    vector<unsigned char> buf;
+    const int data_size = unmarshallInt(inf);
+    ASSERT(data_size >= 0);
+
+    buf.resize(data_size);
+    inf.read(&buf[0], buf.size());
+
+    reader th(buf, inf.getMinorVersion());
+    _tag_read_level_band(th, band);
+}
+
 static void _shunt_monsters_out_of_walls()
 {
     for (int i = 0; i < MAX_MONSTERS; ++i)
@@ -4766,23 +4861,7 @@ static void _tag_construct_level(writer &th)
 
     marshallInt(th, env.turns_on_level);
 
-    CANARY;
-
-    for (int count_x = 0; count_x < GXM; count_x++)
-        for (int count_y = 0; count_y < GYM; count_y++)
-        {
-            marshallByte(th, env.grid[count_x][count_y]);
-            marshallMapCell(th, env.map_knowledge[count_x][count_y]);
-            marshallInt(th, env.pgrid[count_x][count_y].flags);
-        }
-
-    marshallBoolean(th, !!env.map_forgotten);
-    if (env.map_forgotten)
-        for (int x = 0; x < GXM; x++)
-            for (int y = 0; y < GYM; y++)
-                marshallMapCell(th, (*env.map_forgotten)[x][y]);
-
-    _run_length_encode(th, marshallByte, env.grid_colours, GXM, GYM);
+    // The map grids themselves are in the level bands.
 
     CANARY;
 
@@ -6255,20 +6334,84 @@ void _tag_construct_level_tiles(writer &th)
     marshallShort(th, tile_env.default_flavour.floor);
     marshallShort(th, tile_env.default_flavour.special);
 
-    for (int count_x = 0; count_x < GXM; count_x++)
+    // Per-cell flavours are in the level bands.
+
+    marshallInt(th, TILE_WALL_MAX);
+}
+
+// Marshall one field of each cell in columns [x_from, x_to) of a map grid
+// as a single run-length encoded block.
+template <typename G, typename F>
+static void _marshall_grid_block(writer &th, const G &grid, int x_from,
+                                 int x_to, int width, F field)
+{
+    vector<uint32_t> values;
+    values.reserve((x_to - x_from) * GYM);
+    for (int x = x_from; x < x_to; x++)
+        for (int y = 0; y < GYM; y++)
+            values.push_back(field(grid[x][y]));
+    marshallRLEBlock(th, values, width);
+}
+
+template <typename G, typename F>
+static void _unmarshall_grid_block(reader &th, G &grid, int x_from, int x_to,
+                                   int width, F set_field)
+{
+    vector<uint32_t> values;
+    unmarshallRLEBlock(th, values, width);
+    if (values.size() != (size_t)((x_to - x_from) * GYM))
+        die("save corrupted: wrong size for grid block");
+
+    auto value = values.begin();
+    for (int x = x_from; x < x_to; x++)
+        for (int y = 0; y < GYM; y++)
+            set_field(grid[x][y], *value++);
+}
+
+// The per-cell flavour fields, in save order.
+static unsigned short tile_flavour::* const _flavour_fields[] =
+{
+    &tile_flavour::wall_idx, &tile_flavour::floor_idx, &tile_flavour::feat_idx,
+    &tile_flavour::wall, &tile_flavour::floor, &tile_flavour::feat,
+    &tile_flavour::special,
+};
+
+// A level band is a strip of LEVEL_BAND_WIDTH columns of the map. Each is
+// saved in a chunk of its own, so that saving a level the player has only
+// passed through leaves most of them byte-for-byte unchanged, and the
+// package doesn't have to rewrite them.
+static void _tag_construct_level_band(writer &th, int band)
+{
+    const int x_from = band * LEVEL_BAND_WIDTH;
+    const int x_to = min(x_from + LEVEL_BAND_WIDTH, GXM);
+
+    marshallShort(th, x_from);
+    marshallShort(th, x_to);
+    marshallShort(th, GYM);
+
+    _marshall_grid_block(th, env.grid, x_from, x_to, 1,
+        [](dungeon_feature_type feat) { return feat; });
+    for (int count_x = x_from; count_x < x_to; count_x++)
         for (int count_y = 0; count_y < GYM; count_y++)
-        {
-            marshallShort(th, tile_env.flv[count_x][count_y].wall_idx);
-            marshallShort(th, tile_env.flv[count_x][count_y].floor_idx);
-            marshallShort(th, tile_env.flv[count_x][count_y].feat_idx);
+            marshallMapCell(th, env.map_knowledge[count_x][count_y]);
+    _marshall_grid_block(th, env.pgrid, x_from, x_to, 4,
+        [](terrain_property_t prop) { return prop.flags; });
+    _marshall_grid_block(th, env.grid_colours, x_from, x_to, 1,
+        [](unsigned short colour) { return colour; });
 
-            marshallShort(th, tile_env.flv[count_x][count_y].wall);
-            marshallShort(th, tile_env.flv[count_x][count_y].floor);
-            marshallShort(th, tile_env.flv[count_x][count_y].feat);
-            marshallShort(th, tile_env.flv[count_x][count_y].special);
-        }
+    marshallBoolean(th, !!env.map_forgotten);
+    if (env.map_forgotten)
+        for (int x = x_from; x < x_to; x++)
+            for (int y = 0; y < GYM; y++)
+                marshallMapCell(th, (*env.map_forgotten)[x][y]);
 
-    marshallInt(th, TILE_WALL_MAX);
+    CANARY;
+
+    for (auto field : _flavour_fields)
+    {
+        _marshall_grid_block(th, tile_env.flv, x_from, x_to, 2,
+            [field](const tile_flavour &flv) { return flv.*field; });
+    }
 }
 
 static void _tag_read_level(reader &th)
@@ -6297,57 +6440,30 @@ static void _tag_read_level(reader &th)
 
     EAT_CANARY;
 
-    env.map_seen.reset();
 #if TAG_MAJOR_VERSION == 34
     vector<coord_def> transporters;
-#endif
-    for (int i = 0; i < gx; i++)
-        for (int j = 0; j < gy; j++)
-        {
-            dungeon_feature_type feat = unmarshallFeatureType(th);
-            env.grid[i][j] = feat;
-            ASSERT(feat < NUM_FEATURES);
+    if (th.getMinorVersion() < TAG_MINOR_LEVEL_BANDS)
+    {
+        // Older saves keep the map grids here, rather than in level bands.
+        _tag_read_level_map(th, 0, GXM);
 
-#if TAG_MAJOR_VERSION == 34
-            // Save these for potential destination clean up.
-            if (env.grid[i][j] == DNGN_TRANSPORTER)
-                transporters.push_back(coord_def(i, j));
-#endif
-            unmarshallMapCell(th, env.map_knowledge[i][j]);
-            // Fixup positions
-            if (env.map_knowledge[i][j].monsterinfo())
-                env.map_knowledge[i][j].monsterinfo()->pos = coord_def(i, j);
-            if (env.map_knowledge[i][j].cloudinfo())
-                env.map_knowledge[i][j].cloudinfo()->pos = coord_def(i, j);
+        // Save these for potential destination clean up.
+        for (int i = 0; i < GXM; i++)
+            for (int j = 0; j < GYM; j++)
+                if (env.grid[i][j] == DNGN_TRANSPORTER)
+                    transporters.push_back(coord_def(i, j));
 
-            env.map_knowledge[i][j].flags &= ~MAP_VISIBLE_FLAG;
-            if (env.map_knowledge[i][j].seen())
-                env.map_seen.set(i, j);
-            env.pgrid[i][j].flags = unmarshallInt(th);
+        if (th.getMinorVersion() < TAG_MINOR_FORGOTTEN_MAP)
+            env.map_forgotten.reset();
+        else
+            _tag_read_forgotten_map(th, 0, GXM);
 
-            env.mgrid[i][j] = NON_MONSTER;
-        }
+        env.grid_colours.init(BLACK);
+        _run_length_decode(th, unmarshallByte, env.grid_colours, GXM, GYM);
 
-#if TAG_MAJOR_VERSION == 34
-    if (th.getMinorVersion() < TAG_MINOR_FORGOTTEN_MAP)
-        env.map_forgotten.reset();
-    else
-#endif
-    if (unmarshallBoolean(th))
-    {
-        MapKnowledge *f = new MapKnowledge();
-        for (int x = 0; x < GXM; x++)
-            for (int y = 0; y < GYM; y++)
-                unmarshallMapCell(th, (*f)[x][y]);
-        env.map_forgotten.reset(f);
+        EAT_CANARY;
     }
-    else
-        env.map_forgotten.reset();
-
-    env.grid_colours.init(BLACK);
-    _run_length_decode(th, unmarshallByte, env.grid_colours, GXM, GYM);
-
-    EAT_CANARY;
+#endif
 
     env.cloud.clear();
     // how many clouds?
@@ -7287,6 +7403,125 @@ static void _debug_count_tiles()
 #endif
 }
 
+static void _tag_read_map_knowledge(reader &th, int i, int j)
+{
+    unmarshallMapCell(th, env.map_knowledge[i][j]);
+    // Fixup positions
+    if (env.map_knowledge[i][j].monsterinfo())
+        env.map_knowledge[i][j].monsterinfo()->pos = coord_def(i, j);
+    if (env.map_knowledge[i][j].cloudinfo())
+        env.map_knowledge[i][j].cloudinfo()->pos = coord_def(i, j);
+
+    env.map_knowledge[i][j].flags &= ~MAP_VISIBLE_FLAG;
+    env.map_seen.set(i, j, env.map_knowledge[i][j].seen());
+
+    env.mgrid[i][j] = NON_MONSTER;
+}
+
+#if TAG_MAJOR_VERSION == 34
+static void _tag_read_level_map(reader &th, int x_from, int x_to)
+{
+    for (int i = x_from; i < x_to; i++)
+        for (int j = 0; j < GYM; j++)
+        {
+            dungeon_feature_type feat = unmarshallFeatureType(th);
+            env.grid[i][j] = feat;
+            ASSERT(feat < NUM_FEATURES);
+
+            _tag_read_map_knowledge(th, i, j);
+            env.pgrid[i][j].flags = unmarshallInt(th);
+        }
+}
+#endif
+
+static void _tag_read_forgotten_map(reader &th, int x_from, int x_to)
+{
+    if (!unmarshallBoolean(th))
+    {
+        env.map_forgotten.reset();
+        return;
+    }
+
+    if (!env.map_forgotten)
+        env.map_forgotten.reset(new MapKnowledge());
+    for (int x = x_from; x < x_to; x++)
+        for (int y = 0; y < GYM; y++)
+            unmarshallMapCell(th, (*env.map_forgotten)[x][y]);
+}
+
+#if TAG_MAJOR_VERSION == 34
+static void _tag_read_tile_flavours(reader &th, int x_from, int x_to, int gy)
+{
+    for (int x = x_from; x < x_to; x++)
+        for (int y = 0; y < gy; y++)
+        {
+            tile_env.flv[x][y].wall_idx  = unmarshallShort(th);
+            tile_env.flv[x][y].floor_idx = unmarshallShort(th);
+            tile_env.flv[x][y].feat_idx  = unmarshallShort(th);
+
+            // These get overwritten by _regenerate_tile_flavour
+            tile_env.flv[x][y].wall    = unmarshallShort(th);
+            tile_env.flv[x][y].floor   = unmarshallShort(th);
+            tile_env.flv[x][y].feat    = unmarshallShort(th);
+            tile_env.flv[x][y].special = unmarshallShort(th);
+        }
+}
+#endif
+
+// Level bands are read before the level itself, which relies on the map
+// grids already being in place.
+static void _tag_read_level_band(reader &th, int band)
+{
+    const int x_from = unmarshallShort(th);
+    const int x_to = unmarshallShort(th);
+    const int gy = unmarshallShort(th);
+    ASSERT(x_from == band * LEVEL_BAND_WIDTH);
+    ASSERT(x_to == min(x_from + LEVEL_BAND_WIDTH, GXM));
+    ASSERT(gy == GYM);
+
+#if TAG_MAJOR_VERSION == 34
+    if (th.getMinorVersion() < TAG_MINOR_BULK_GRIDS)
+    {
+        _tag_read_level_map(th, x_from, x_to);
+        for (int x = x_from; x < x_to; x++)
+            for (int y = 0; y < GYM; y++)
+                env.grid_colours[x][y] = unmarshallByte(th);
+        _tag_read_forgotten_map(th, x_from, x_to);
+
+        EAT_CANARY;
+
+        _tag_read_tile_flavours(th, x_from, x_to, GYM);
+        return;
+    }
+#endif
+
+    const int minor = th.getMinorVersion();
+    _unmarshall_grid_block(th, env.grid, x_from, x_to, 1,
+        [minor](dungeon_feature_type &feat, uint32_t v)
+        {
+            feat = rewrite_feature(static_cast<dungeon_feature_type>(v),
+                                   minor);
+            ASSERT(feat < NUM_FEATURES);
+        });
+    for (int x = x_from; x < x_to; x++)
+        for (int y = 0; y < GYM; y++)
+            _tag_read_map_knowledge(th, x, y);
+    _unmarshall_grid_block(th, env.pgrid, x_from, x_to, 4,
+        [](terrain_property_t &prop, uint32_t v) { prop.flags = v; });
+    _unmarshall_grid_block(th, env.grid_colours, x_from, x_to, 1,
+        [](unsigned short &colour, uint32_t v) { colour = v; });
+    _tag_read_forgotten_map(th, x_from, x_to);
+
+    EAT_CANARY;
+
+    // The flavours themselves get overwritten by _regenerate_tile_flavour.
+    for (auto field : _flavour_fields)
+    {
+        _unmarshall_grid_block(th, tile_env.flv, x_from, x_to, 2,
+            [field](tile_flavour &flv, uint32_t v) { flv.*field = v; });
+    }
+}
+
 void _tag_read_level_tiles(reader &th)
 {
     // Map grids.
@@ -7315,19 +7550,14 @@ void _tag_read_level_tiles(reader &th)
     tile_env.default_flavour.floor     = unmarshallShort(th);
     tile_env.default_flavour.special   = unmarshallShort(th);
 
-    for (int x = 0; x < gx; x++)
-        for (int y = 0; y < gy; y++)
-        {
-            tile_env.flv[x][y].wall_idx  = unmarshallShort(th);
-            tile_env.flv[x][y].floor_idx = unmarshallShort(th);
-            tile_env.flv[x][y].feat_idx  = unmarshallShort(th);
-
-            // These get overwritten by _regenerate_tile_flavour
-            tile_env.flv[x][y].wall    = unmarshallShort(th);
-            tile_env.flv[x][y].floor   = unmarshallShort(th);
-            tile_env.flv[x][y].feat    = unmarshallShort(th);
-            tile_env.flv[x][y].special = unmarshallShort(th);
-        }
+#if TAG_MAJOR_VERSION == 34
+    // Older saves keep the per-cell flavours here, rather than in level bands.
+    if (th.getMinorVersion() < TAG_MINOR_LEVEL_BANDS)
+        _tag_read_tile_flavours(th, 0, gx, gy);
+#else
+    UNUSED(gx);
+    UNUSED(gy);
+#endif
 
     _debug_count_tiles();
 
@@ -45,6 +45,11 @@ enum tag_type   // used during save/load process to identify data blocks
     TAG_SKIP
 };
 
+// Besides its main chunk, each level is saved in LEVEL_BANDS chunks holding
+// the map grids and tile flavours of LEVEL_BAND_WIDTH columns each.
+#define LEVEL_BAND_WIDTH 10
+#define LEVEL_BANDS ((GXM + LEVEL_BAND_WIDTH - 1) / LEVEL_BAND_WIDTH)
+
 /* ***********************************************************************
  * writer API
  * *********************************************************************** */
@@ -53,23 +58,27 @@ class writer
 {
 public:
     writer(const string &filename, FILE* output, bool ignore_errors = false)
-        : _filename(filename), _file(output), _chunk(0),
+        : _filename(filename), _file(output), _save(0),
           _ignore_errors(ignore_errors), _pbuf(0), failed(false)
     {
         ASSERT(output);
     }
     writer(vector<unsigned char>* poutput)
-        : _filename(), _file(0), _chunk(0), _ignore_errors(false),
+        : _filename(), _file(0), _save(0), _ignore_errors(false),
           _pbuf(poutput), failed(false) { ASSERT(poutput); }
-    writer(package *save, const string &chunkname)
-        : _filename(), _file(0), _chunk(0), _ignore_errors(false),
-          failed(false)
+    // Save chunks are marshalled into memory, and handed to the package to
+    // compress and write (in the background, where possible) once the
+    // writer goes away.
+    writer(package *save, const string &chunkname,
+           int compression = SAVE_COMPRESSION)
+        : _filename(), _file(0), _save(save), _chunkname(chunkname),
+          _compression(compression), _ignore_errors(false),
+          _pbuf(&_save_buf), failed(false)
     {
         ASSERT(save);
-        _chunk = save->writer(chunkname);
     }
 
-    ~writer() { if (_chunk) delete _chunk; }
+    ~writer();
 
     void writeByte(unsigned char byte);
     void write(const void *data, size_t size);
@@ -83,7 +92,10 @@ private:
 private:
     string _filename;
     FILE* _file;
-    chunk_writer *_chunk;
+    package *_save;
+    string _chunkname;
+    int _compression;
+    vector<unsigned char> _save_buf;
     bool _ignore_errors;
 
     vector<unsigned char>* _pbuf;
@@ -180,6 +192,9 @@ static inline void unmarshallSigned(reader& th, T& v)
     v = (T)unmarshallSigned(th);
 }
 
+void marshallRLEBlock(writer &th, const vector<uint32_t> &values, int width);
+void unmarshallRLEBlock(reader &th, vector<uint32_t> &values, int width);
+
 void marshallMapCell (writer &, const map_cell &);
 void unmarshallMapCell (reader &, map_cell& cell);
 
@@ -204,6 +219,8 @@ void remove_removed_library_spells(FixedBitVector<NUM_SPELLS>& lib);
 
 void tag_read(reader &inf, tag_type tag_id);
 void tag_write(tag_type tagID, writer &outf);
+void tag_read_level_band(reader &inf, int band);
+void tag_write_level_band(int band, writer &outf);
 player_save_info tag_read_char_info(reader &th, uint8_t format, uint8_t major,
                                                                 uint8_t minor);
 void tag_read_char(reader &th, uint8_t format, uint8_t major, uint8_t minor);
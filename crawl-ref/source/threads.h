@@ -53,6 +53,7 @@ static inline int unix_pthread_create(pthread_t *th, int det,
 #define cond_destroy(x) pthread_cond_destroy(&x)
 #define cond_wait(x,m) pthread_cond_wait(&x, &m)
 #define cond_wake(x) pthread_cond_signal(&x)
+#define cond_wake_all(x) pthread_cond_broadcast(&x)
 
 
 #else
@@ -187,7 +187,9 @@ void WebTextArea::send(bool force)
             }
 
             tiles.json_write_comma();
-            tiles.write_message("\"%u\":\"%s\"", y, html.c_str());
+            tiles.write_message("\"%u\":\"", y);
+            tiles.write_message_raw(html);
+            tiles.write_message("\"");
         }
     }
     if (sending)
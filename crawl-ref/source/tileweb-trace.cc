@@ -0,0 +1,169 @@
+#include "AppHdr.h"
+
+#ifdef USE_TILE_WEB
+
+#include "tileweb-trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "files.h"
+#include "stringutil.h"
+
+// How many inputs the stats cover.
+static const size_t TRACE_SAMPLES = 500;
+// How many inputs to trace between writes of the stats file.
+static const unsigned int TRACE_WRITE_INTERVAL = 100;
+// Bucket i of the histogram holds times below 2^(i+1) microseconds; the
+// last one holds everything longer.
+static const int TRACE_BUCKETS = 24;
+
+// The stage that ends at each trace point; the first is the total.
+static const char * const trace_stage_names[NUM_TRACE_POINTS] =
+{
+    "total", "dispatch", "game", "view", "json", "send",
+};
+
+static uint64_t _now_us()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+WebLatencyTrace::WebLatencyTrace()
+    : m_tracing(false), m_next_sample(0), m_samples_since_write(0),
+      m_write_failed(false)
+{
+    fill(begin(m_marks), end(m_marks), 0);
+}
+
+void WebLatencyTrace::set_stats_file(const string &filename)
+{
+    m_stats_file = filename;
+    string dir = get_parent_directory(filename);
+    check_mkdir("Latency directory", &dir);
+}
+
+void WebLatencyTrace::mark(WebtilesTracePoint point)
+{
+    if (!enabled())
+        return;
+
+    if (point == TRACE_INPUT)
+    {
+        // Input that arrives while the last one is still being handled
+        // waits for that; it's timed from when it was first seen.
+        if (m_tracing)
+            return;
+        fill(begin(m_marks), end(m_marks), 0);
+        m_tracing = true;
+    }
+    else if (!m_tracing)
+        return;
+    // The time to the first command is the time it took to get going, but
+    // for later points (which may come several times, e.g. each turn of
+    // a rest) the last time counts.
+    else if (point == TRACE_DISPATCH && m_marks[point])
+        return;
+
+    m_marks[point] = _now_us();
+    if (point == TRACE_SEND)
+        finish_trace();
+}
+
+void WebLatencyTrace::finish_trace()
+{
+    m_tracing = false;
+
+    sample s;
+    uint64_t last = m_marks[TRACE_INPUT];
+    for (int i = TRACE_DISPATCH; i < NUM_TRACE_POINTS; ++i)
+    {
+        // A stage that was skipped (or happened out of order) took no
+        // time, and the next one runs from the last point passed.
+        if (m_marks[i] >= last)
+        {
+            s.stage[i] = m_marks[i] - last;
+            last = m_marks[i];
+        }
+        else
+            s.stage[i] = 0;
+    }
+    s.stage[0] = m_marks[TRACE_SEND] - m_marks[TRACE_INPUT];
+
+    if (m_samples.size() < TRACE_SAMPLES)
+        m_samples.push_back(s);
+    else
+        m_samples[m_next_sample] = s;
+    m_next_sample = (m_next_sample + 1) % TRACE_SAMPLES;
+
+    if (++m_samples_since_write >= TRACE_WRITE_INTERVAL)
+    {
+        write_stats_file();
+        m_samples_since_write = 0;
+    }
+}
+
+string WebLatencyTrace::stats_json() const
+{
+    string json = make_stringf("{\"samples\":%u,\"stages\":{",
+                               (unsigned int) m_samples.size());
+
+    for (int i = 0; i < NUM_TRACE_POINTS; ++i)
+    {
+        vector<uint32_t> times;
+        int hist[TRACE_BUCKETS] = {};
+        for (const sample &s : m_samples)
+        {
+            times.push_back(s.stage[i]);
+            int bucket = 0;
+            while (bucket < TRACE_BUCKETS - 1 && s.stage[i] >> (bucket + 1))
+                ++bucket;
+            ++hist[bucket];
+        }
+        sort(times.begin(), times.end());
+        auto percentile = [&times](int p) -> uint32_t
+        {
+            return times.empty() ? 0 : times[(times.size() - 1) * p / 100];
+        };
+
+        json += make_stringf("%s\"%s\":{\"p50\":%u,\"p90\":%u,\"p99\":%u,"
+                             "\"hist\":[",
+                             i ? "," : "", trace_stage_names[i],
+                             percentile(50), percentile(90), percentile(99));
+        for (int b = 0; b < TRACE_BUCKETS; ++b)
+            json += make_stringf("%s%d", b ? "," : "", hist[b]);
+        json += "]}";
+    }
+
+    json += "}}";
+    return json;
+}
+
+void WebLatencyTrace::write_stats_file() const
+{
+    if (!enabled())
+        return;
+
+    FILE *f = fopen_replace(m_stats_file.c_str());
+    if (!f)
+    {
+        // Once is enough; this is tried every hundred inputs.
+        if (!m_write_failed)
+        {
+            fprintf(stderr, "Can't write latency stats to %s: %s\n",
+                    m_stats_file.c_str(), strerror(errno));
+        }
+        m_write_failed = true;
+        return;
+    }
+    m_write_failed = false;
+    fprintf(f, "%s\n", stats_json().c_str());
+    fclose(f);
+}
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * @file
+ * @brief Tracing where the time goes between webtiles input and output.
+**/
+
+#pragma once
+
+#ifdef USE_TILE_WEB
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The points an input passes on the way to its response going out, in
+// order.
+enum WebtilesTracePoint
+{
+    TRACE_INPUT,    // input became available
+    TRACE_DISPATCH, // a command was dispatched
+    TRACE_WORLD,    // world_reacts() finished
+    TRACE_VIEW,     // the view was updated
+    TRACE_JSON,     // a message was built
+    TRACE_SEND,     // the messages were flushed to the socket
+    NUM_TRACE_POINTS
+};
+
+// Times each input from its arrival to the flush that sends the response,
+// split into the stages between the trace points, and keeps the last
+// few hundred of those for a histogram.
+class WebLatencyTrace
+{
+public:
+    WebLatencyTrace();
+
+    // Tracing is off until there's a file to write the stats to. Its
+    // directory is created if need be.
+    void set_stats_file(const string &filename);
+    bool enabled() const { return !m_stats_file.empty(); }
+
+    void mark(WebtilesTracePoint point);
+
+    // The stats as a JSON object: for each stage, some percentiles and a
+    // histogram of the samples in power-of-two buckets of microseconds.
+    string stats_json() const;
+    void write_stats_file() const;
+
+private:
+    string m_stats_file;
+
+    // The current input's trace; zero for points it hasn't passed.
+    uint64_t m_marks[NUM_TRACE_POINTS];
+    bool m_tracing;
+
+    // How long each stage took, for the last so many inputs. The stage
+    // ending at TRACE_INPUT doesn't exist, so stage[0] holds the total.
+    struct sample
+    {
+        uint32_t stage[NUM_TRACE_POINTS];
+    };
+    vector<sample> m_samples;
+    size_t m_next_sample;
+    unsigned int m_samples_since_write;
+    mutable bool m_write_failed;
+
+    void finish_trace();
+};
+
+#endif
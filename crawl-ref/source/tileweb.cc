@@ -6,10 +6,12 @@
 
 #include <cerrno>
 #include <cstdarg>
+#include <numeric>
 
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #if defined(UNIX) || defined(TARGET_COMPILER_MINGW)
 #include <unistd.h>
@@ -81,9 +83,46 @@ static unsigned int get_milliseconds()
     return ((unsigned int) tv.tv_sec) * 1000 + tv.tv_usec / 1000;
 }
 
+// Past this many bytes waiting for a receiver, it gets no more map
+// updates, just the next full map.
+static const size_t WEB_QUEUE_COALESCE = 256 * 1024;
+// Past this, a spectator is dropped, and the game waits for the player.
+static const size_t WEB_QUEUE_LIMIT = 4 * 1024 * 1024;
+// How long (in ms) a receiver may take nothing from its queue before a
+// spectator is dropped, or the game gives up on the player.
+static const unsigned int WEB_SPECTATOR_TIMEOUT = 10 * 1000;
+static const unsigned int WEB_PLAYER_TIMEOUT = 60 * 1000;
+// How long (in ms) to wait before trying to send more.
+static const int WEB_DRAIN_INTERVAL = 20;
+// How long (in ms) to keep trying to send the last messages on exit.
+static const unsigned int WEB_SHUTDOWN_WAIT = 5 * 1000;
+// Past this many bytes, a replay for new spectators is no cheaper than
+// sending everything again.
+static const size_t WEB_REPLAY_LIMIT = 1024 * 1024;
+
 TilesFramework tiles;
 
+// Append the decimal form of value, without going through printf.
+static void _append_int(string &buf, int value)
+{
+    char digits[12];
+    char *p = digits + sizeof(digits);
+    // Work with the magnitude as unsigned, so INT_MIN doesn't overflow.
+    unsigned int n = value < 0 ? 0u - (unsigned int) value : value;
+    do
+    {
+        *--p = '0' + n % 10;
+        n /= 10;
+    }
+    while (n);
+    if (value < 0)
+        *--p = '-';
+    buf.append(p, digits + sizeof(digits) - p);
+}
+
 TilesFramework::TilesFramework() :
+      m_replay_bytes(0),
+      m_replay_valid(false),
       m_controlled_from_web(false),
       _send_lock(false),
       m_last_ui_state(UI_INIT),
@@ -113,8 +152,17 @@ void TilesFramework::shutdown()
     if (m_sock_name.empty())
         return;
 
+    const unsigned int start = get_milliseconds();
+    while (_messages_queued()
+           && get_milliseconds() - start < WEB_SHUTDOWN_WAIT)
+    {
+        usleep(WEB_DRAIN_INTERVAL * 1000);
+        _drain_queues();
+    }
+
     close(m_sock);
     remove(m_sock_name.c_str());
+    m_latency.write_stats_file();
 }
 
 void TilesFramework::draw_doll_edit()
@@ -149,12 +197,6 @@ bool TilesFramework::initialise()
     // Need small maximum message size to avoid crashes in OS X
     m_max_msg_size = 2048;
 
-    struct timeval tv;
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    if (setsockopt(m_sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0)
-        die("Can't set send timeout!");
-
     if (m_await_connection)
         _await_connection();
 
@@ -171,23 +213,45 @@ string TilesFramework::get_message()
     return m_msg_buf;
 }
 
-void TilesFramework::write_message(const char *format, ...)
+// Format straight onto the end of the message buffer, growing it as needed.
+void TilesFramework::_write_vmessage(const char *format, va_list argp)
 {
-    char buf[2048];
-    int len;
+    const size_t start = m_msg_buf.size();
+    size_t room = 256;
 
+    while (true)
+    {
+        va_list args;
+        va_copy(args, argp);
+        m_msg_buf.resize(start + room);
+        const int len = vsnprintf(&m_msg_buf[start], room, format, args);
+        va_end(args);
+
+        if (len < 0)
+            die("Webtiles message format error! (%s)", format);
+        if ((size_t) len < room)
+        {
+            m_msg_buf.resize(start + len);
+            return;
+        }
+        room = len + 1;
+    }
+}
+
+void TilesFramework::write_message(const char *format, ...)
+{
     va_list argp;
     va_start(argp, format);
-    if ((len = vsnprintf(buf, sizeof(buf), format, argp)) < 0)
-        die("Webtiles message format error! (%s)", format);
-    else if (len >= (int)sizeof(buf))
-        die("Webtiles message too long! (%d)", len);
+    _write_vmessage(format, argp);
     va_end(argp);
+}
 
-    m_msg_buf.append(buf);
+void TilesFramework::write_message_raw(const string& s)
+{
+    m_msg_buf.append(s);
 }
 
-void TilesFramework::finish_message()
+void TilesFramework::finish_message(WebtilesMessageKind kind)
 {
     if (m_msg_buf.size() == 0)
         return;
@@ -202,108 +266,229 @@ void TilesFramework::finish_message()
         return;
     }
 
-    m_msg_buf.append("\n");
-    const char* fragment_start = m_msg_buf.data();
-    const char* data_end = m_msg_buf.data() + m_msg_buf.size();
-    int fragments = 0;
-    while (fragment_start < data_end)
-    {
-        int fragment_size = data_end - fragment_start;
-        if (fragment_size > m_max_msg_size)
-            fragment_size = m_max_msg_size;
-        fragments++;
+    m_latency.mark(TRACE_JSON);
+
+    shared_ptr<string> text = make_shared<string>(move(m_msg_buf));
+    m_msg_buf.clear();
+    for (Receiver &receiver : m_receivers)
+        _queue_message(receiver, text, kind);
+    _drain_queues();
 
-        for (unsigned int i = 0; i < m_dest_addrs.size(); ++i)
+    // Messages to the server itself are never replayed.
+    if (m_replay_valid && (*text)[0] != '*')
+    {
+        m_replay.push_back(text);
+        m_replay_bytes += text->size();
+        if (m_replay_bytes > WEB_REPLAY_LIMIT)
         {
-            int retries = 30;
-            ssize_t sent = 0;
-            while (sent < fragment_size)
-            {
-                ssize_t retval = sendto(m_sock, fragment_start + sent,
-                    fragment_size - sent, 0, (sockaddr*) &m_dest_addrs[i],
-                    sizeof(sockaddr_un));
+            m_replay.clear();
+            m_replay_bytes = 0;
+            m_replay_valid = false;
+        }
+    }
+
+    // If everybody has it already, keep the buffer for the next message.
+    if (text.use_count() == 1)
+    {
+        m_msg_buf.swap(*text);
+        m_msg_buf.clear();
+    }
+
+    m_need_flush = true;
 #ifdef DEBUG_WEBSOCKETS
-                fprintf(stderr,
-                            "    trying to send fragment to client %d...", i);
+    // should the game actually crash in this case?
+    if (m_controlled_from_web && m_receivers.empty())
+        fprintf(stderr, "No open websockets after finish_message!!\n");
+
+    fprintf(stderr, "websocket: Queued %d bytes.\n", initial_buf_size);
 #endif
-                if (retval <= 0)
-                {
-                    const char *errmsg = retval == 0 ? "No bytes sent"
-                                                     : strerror(errno);
-                    if (--retries <= 0)
-                        die("Socket write error: %s", errmsg);
+}
 
-                    if (retval == 0 || errno == ENOBUFS || errno == EWOULDBLOCK
-                        || errno == EINTR || errno == EAGAIN)
-                    {
-                        // Wait for half a second at first (up to five), then
-                        // try again.
-                        const int sleep_time = retries > 25 ? 2 * 1000
-                                             : retries > 10 ? 500 * 1000
-                                             : 5000 * 1000;
+void TilesFramework::_queue_message(Receiver &receiver,
+                                    shared_ptr<const string> text,
+                                    WebtilesMessageKind kind)
+{
+    // Map messages that haven't started going out yet can be dropped in
+    // favour of a full map.
+    auto drop_maps = [&receiver]()
+    {
+        auto unsent_map = [](const QueuedMessage &msg)
+        {
+            return msg.kind != WEB_MSG_OTHER && msg.sent == 0;
+        };
+        for (const QueuedMessage &msg : receiver.queue)
+            if (unsent_map(msg))
+                receiver.queued_bytes -= msg.text->size() + 1;
+        receiver.queue.erase(remove_if(receiver.queue.begin(),
+                                       receiver.queue.end(), unsent_map),
+                             receiver.queue.end());
+    };
+
+    if (kind == WEB_MSG_FULL_MAP)
+    {
+        drop_maps();
+        receiver.awaiting_full_map = false;
+    }
+    else if (kind == WEB_MSG_MAP)
+    {
+        if (receiver.awaiting_full_map)
+            return;
+        if (receiver.queued_bytes > WEB_QUEUE_COALESCE)
+        {
 #ifdef DEBUG_WEBSOCKETS
-                        fprintf(stderr, "failed (%s), sleeping for %dms.\n",
-                                                    errmsg, sleep_time / 1000);
+            fprintf(stderr, "websocket: Receiver lagging with %u bytes, "
+                            "coalescing map updates.\n",
+                    (unsigned int) receiver.queued_bytes);
 #endif
-                        usleep(sleep_time);
-                    }
-                    else if (errno == ECONNREFUSED || errno == ENOENT)
-                    {
-                        // the other side is dead
+            drop_maps();
+            receiver.awaiting_full_map = true;
+            m_need_full_map = true;
+            return;
+        }
+    }
+
+    if (receiver.queue.empty())
+        receiver.last_progress = get_milliseconds();
+    receiver.queued_bytes += text->size() + 1;
+    receiver.queue.push_back({move(text), 0, kind});
+}
+
+// Send as much of a receiver's queue as it will take right now. Returns
+// false if the receiver has gone away.
+bool TilesFramework::_drain_queue(Receiver &receiver)
+{
+    static const char newline = '\n';
+
+    while (!receiver.queue.empty())
+    {
+        QueuedMessage &msg = receiver.queue.front();
+        const size_t text_size = msg.text->size();
+        const size_t size = text_size + 1;
+        const size_t fragment_size = min(size - msg.sent,
+                                         (size_t) m_max_msg_size);
+
+        // Each fragment goes straight out of the shared message text, with
+        // the final newline gathered in separately.
+        iovec iov[2];
+        int iov_count = 0;
+        if (msg.sent < text_size)
+        {
+            iov[iov_count].iov_base =
+                const_cast<char *>(msg.text->data() + msg.sent);
+            iov[iov_count].iov_len = min(fragment_size, text_size - msg.sent);
+            ++iov_count;
+        }
+        if (msg.sent + fragment_size == size)
+        {
+            iov[iov_count].iov_base = const_cast<char *>(&newline);
+            iov[iov_count].iov_len = 1;
+            ++iov_count;
+        }
+
+        msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_name = &receiver.addr;
+        hdr.msg_namelen = sizeof(sockaddr_un);
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = iov_count;
+
+        const ssize_t retval = sendmsg(m_sock, &hdr, MSG_DONTWAIT);
+        if (retval <= 0)
+        {
+            if (retval == 0 || errno == ENOBUFS || errno == EWOULDBLOCK
+                || errno == EINTR || errno == EAGAIN)
+            {
+                // Try again later.
+                return true;
+            }
+            else if (errno == ECONNREFUSED || errno == ENOENT)
+            {
+                // the other side is dead
 #ifdef DEBUG_WEBSOCKETS
-                        fprintf(stderr,
-                            "failed (%s), breaking.\n", errmsg);
+                fprintf(stderr, "websocket: Receiver gone (%s).\n",
+                        strerror(errno));
 #endif
-                        m_dest_addrs.erase(m_dest_addrs.begin() + i);
-                        i--;
-                        break;
-                    }
-                    else
-                        die("Socket write error: %s", errmsg);
-                }
-                else
+                return false;
+            }
+            else
+                die("Socket write error: %s", strerror(errno));
+        }
+
+        msg.sent += retval;
+        receiver.queued_bytes -= retval;
+        receiver.last_progress = get_milliseconds();
+        if (msg.sent >= size)
+            receiver.queue.pop_front();
+    }
+    return true;
+}
+
+void TilesFramework::_drain_queues()
+{
+    for (unsigned int i = 0; i < m_receivers.size(); ++i)
+    {
+        Receiver &receiver = m_receivers[i];
+        bool keep = _drain_queue(receiver);
+
+        if (keep && !receiver.queue.empty())
+        {
+            const unsigned int stalled =
+                get_milliseconds() - receiver.last_progress;
+            if (!receiver.primary)
+            {
+                // Spectators that can't keep up are dropped rather than
+                // allowed to hold up the game.
+                if (receiver.queued_bytes > WEB_QUEUE_LIMIT
+                    || stalled > WEB_SPECTATOR_TIMEOUT)
                 {
 #ifdef DEBUG_WEBSOCKETS
-                    fprintf(stderr, "fragment size %d sent.\n", fragment_size);
+                    fprintf(stderr, "websocket: Dropping lagging spectator "
+                                    "(%u bytes queued, stalled for %ums).\n",
+                            (unsigned int) receiver.queued_bytes, stalled);
 #endif
-                    sent += retval;
+                    keep = false;
+                }
+            }
+            else
+            {
+                // The player has to see everything, so past the limit
+                // there's nothing for it but to wait.
+                while (keep && receiver.queued_bytes > WEB_QUEUE_LIMIT)
+                {
+                    if (get_milliseconds() - receiver.last_progress
+                        > WEB_PLAYER_TIMEOUT)
+                    {
+                        die("Socket write error: receiver not responding");
+                    }
+                    usleep(WEB_DRAIN_INTERVAL * 1000);
+                    keep = _drain_queue(receiver);
                 }
             }
         }
 
-        fragment_start += fragment_size;
+        if (!keep)
+        {
+            m_receivers.erase(m_receivers.begin() + i);
+            i--;
+        }
     }
-    m_msg_buf.clear();
-    m_need_flush = true;
-#ifdef DEBUG_WEBSOCKETS
-    // should the game actually crash in this case?
-    if (m_controlled_from_web && m_dest_addrs.size() == 0)
-        fprintf(stderr, "No open websockets after finish_message!!\n");
+}
 
-    fprintf(stderr, "websocket: Sent %d bytes in %d fragments.\n",
-                                                initial_buf_size, fragments);
-#endif
+bool TilesFramework::_messages_queued() const
+{
+    for (const Receiver &receiver : m_receivers)
+        if (!receiver.queue.empty())
+            return true;
+    return false;
 }
 
 void TilesFramework::send_message(const char *format, ...)
 {
-    char buf[2048];
-    int len;
-
     va_list argp;
     va_start(argp, format);
-    if ((len = vsnprintf(buf, sizeof(buf), format, argp)) >= (int)sizeof(buf)
-        || len == -1)
-    {
-        if (len == -1)
-            die("Webtiles message format error! (%s)", format);
-        else
-            die("Webtiles message too long! (%d)", len);
-    }
+    _write_vmessage(format, argp);
     va_end(argp);
 
-    m_msg_buf.append(buf);
-
     finish_message();
 }
 
@@ -317,6 +502,7 @@ void TilesFramework::flush_messages()
     {
         send_message("*{\"msg\":\"flush_messages\"}");
         m_need_flush = false;
+        m_latency.mark(TRACE_SEND);
     }
 }
 
@@ -325,7 +511,7 @@ void TilesFramework::_await_connection()
     if (m_sock_name.empty())
         return;
 
-    while (m_dest_addrs.size() == 0)
+    while (m_receivers.empty())
         _receive_control_message();
 }
 
@@ -334,24 +520,25 @@ wint_t TilesFramework::_receive_control_message()
     if (m_sock_name.empty())
         return 0;
 
-    char buf[4096]; // Should be enough for client->server messages
+    // Should be enough for client->server messages, and their terminator.
+    char buf[4097];
     sockaddr_un srcaddr;
     socklen_t srcaddr_len;
     memset(&srcaddr, 0, sizeof(struct sockaddr_un));
 
     srcaddr_len = sizeof(srcaddr);
 
-    int len = recvfrom(m_sock, buf, sizeof(buf),
+    int len = recvfrom(m_sock, buf, sizeof(buf) - 1,
                        0,
                        (sockaddr *) &srcaddr, &srcaddr_len);
 
     if (len == -1)
         die("Socket read error: %s", strerror(errno));
 
-    string data(buf, len);
+    buf[len] = 0;
     try
     {
-        return _handle_control_message(srcaddr, data);
+        return _handle_control_message(srcaddr, buf);
     }
     catch (JsonWrapper::MalformedException&)
     {
@@ -417,31 +604,48 @@ static int _handle_cell_click(const coord_def &gc, int button, bool force)
     return CK_MOUSE_CLICK;
 }
 
-wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
+wint_t TilesFramework::_handle_control_message(sockaddr_un addr, char *data)
 {
-    JsonWrapper obj = json_decode(data.c_str());
+#ifdef DEBUG_WEBSOCKETS
+    const int len = strlen(data); // before it's decoded in place
+#endif
+    // Handling a message can wait for more (in a prompt opened by a click,
+    // say), so only free what this one used.
+    const size_t arena_mark = m_control_arena.mark();
+    ON_UNWIND { m_control_arena.reset(arena_mark); };
+
+    JsonRef obj = json_decode_arena(&m_control_arena, data);
     obj.check(JSON_OBJECT);
 
-    JsonWrapper msg = json_find_member(obj.node, "msg");
+    JsonRef msg = json_find_member(obj.node, "msg");
     msg.check(JSON_STRING);
     string msgtype(msg->string_);
 #ifdef DEBUG_WEBSOCKETS
-    fprintf(stderr, "websocket: Received control message '%s' in %d byte.\n", msgtype.c_str(), (int) data.size());
+    fprintf(stderr, "websocket: Received control message '%s' in %d byte.\n", msgtype.c_str(), len);
 #endif
 
     int c = 0;
 
     if (msgtype == "attach")
     {
-        JsonWrapper primary = json_find_member(obj.node, "primary");
+        JsonRef primary = json_find_member(obj.node, "primary");
         primary.check(JSON_BOOL);
 
-        m_dest_addrs.push_back(addr);
+        Receiver receiver;
+        receiver.addr = addr;
+        receiver.primary = primary->bool_;
+        JsonRef replay = json_find_member(obj.node, "replay");
+        receiver.replay = replay.node && replay->tag == JSON_BOOL
+                          && replay->bool_;
+        receiver.queued_bytes = 0;
+        receiver.last_progress = get_milliseconds();
+        receiver.awaiting_full_map = false;
+        m_receivers.push_back(move(receiver));
         m_controlled_from_web = primary->bool_;
     }
     else if (msgtype == "key")
     {
-        JsonWrapper keycode = json_find_member(obj.node, "keycode");
+        JsonRef keycode = json_find_member(obj.node, "keycode");
         keycode.check(JSON_NUMBER);
 
         // TODO: remove this fixup call
@@ -450,14 +654,26 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     else if (msgtype == "spectator_joined")
     {
         flush_messages();
-        _send_everything();
+        if (!_replay_to_new_spectators())
+        {
+            _send_everything();
+            // The new spectators are up to date.
+            send_message("*{\"msg\":\"replay_end\"}");
+        }
         flush_messages();
     }
+    else if (msgtype == "latency_stats")
+    {
+        write_message_raw("*{\"msg\":\"latency_stats\",\"stats\":");
+        write_message_raw(m_latency.stats_json());
+        write_message_raw("}");
+        finish_message();
+    }
     else if (msgtype == "menu_hover")
     {
-        JsonWrapper hover = json_find_member(obj.node, "hover");
+        JsonRef hover = json_find_member(obj.node, "hover");
         hover.check(JSON_NUMBER);
-        JsonWrapper mouse = json_find_member(obj.node, "mouse");
+        JsonRef mouse = json_find_member(obj.node, "mouse");
         mouse.check(JSON_BOOL);
 
         if (!m_menu_stack.empty()
@@ -471,9 +687,9 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     }
     else if (msgtype == "menu_scroll")
     {
-        JsonWrapper first = json_find_member(obj.node, "first");
+        JsonRef first = json_find_member(obj.node, "first");
         first.check(JSON_NUMBER);
-        JsonWrapper hover = json_find_member(obj.node, "hover");
+        JsonRef hover = json_find_member(obj.node, "hover");
         hover.check(JSON_NUMBER);
         // last visible item is sent too, but currently unused
 
@@ -482,9 +698,9 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     }
     else if (msgtype == "*request_menu_range")
     {
-        JsonWrapper start = json_find_member(obj.node, "start");
+        JsonRef start = json_find_member(obj.node, "start");
         start.check(JSON_NUMBER);
-        JsonWrapper end = json_find_member(obj.node, "end");
+        JsonRef end = json_find_member(obj.node, "end");
         end.check(JSON_NUMBER);
 
         if (!m_menu_stack.empty() && m_menu_stack.back().type == UIStackFrame::MENU)
@@ -495,7 +711,7 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     }
     else if (msgtype == "note")
     {
-        JsonWrapper content = json_find_member(obj.node, "content");
+        JsonRef content = json_find_member(obj.node, "content");
         content.check(JSON_STRING);
 
         if (Options.note_chat_messages)
@@ -503,7 +719,7 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     }
     else if (msgtype == "server_announcement")
     {
-        JsonWrapper content = json_find_member(obj.node, "content");
+        JsonRef content = json_find_member(obj.node, "content");
         content.check(JSON_STRING);
         string m = "<red>Serverwide announcement:</red> ";
         m += content->string_;
@@ -516,14 +732,14 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     }
     else if (msgtype == "click_cell")
     {
-        JsonWrapper x = json_find_member(obj.node, "x");
-        JsonWrapper y = json_find_member(obj.node, "y");
-        JsonWrapper button = json_find_member(obj.node, "button");
+        JsonRef x = json_find_member(obj.node, "x");
+        JsonRef y = json_find_member(obj.node, "y");
+        JsonRef button = json_find_member(obj.node, "button");
         x.check(JSON_NUMBER);
         y.check(JSON_NUMBER);
         button.check(JSON_NUMBER);
         // XX force is currently unused
-        JsonWrapper force = json_find_member(obj.node, "force");
+        JsonRef force = json_find_member(obj.node, "force");
         coord_def gc = coord_def((int) x->number_, (int) y->number_) + m_origin;
 
         c = _handle_cell_click(gc, button->number_,
@@ -531,8 +747,8 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     }
     else if (msgtype == "target_cursor")
     {
-        JsonWrapper x = json_find_member(obj.node, "x");
-        JsonWrapper y = json_find_member(obj.node, "y");
+        JsonRef x = json_find_member(obj.node, "x");
+        JsonRef y = json_find_member(obj.node, "y");
         x.check(JSON_NUMBER);
         y.check(JSON_NUMBER);
         coord_def gc = coord_def((int) x->number_, (int) y->number_) + m_origin;
@@ -541,14 +757,14 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     }
     else if (msgtype == "formatted_scroller_scroll")
     {
-        JsonWrapper scroll = json_find_member(obj.node, "scroll");
+        JsonRef scroll = json_find_member(obj.node, "scroll");
         scroll.check(JSON_NUMBER);
         recv_formatted_scroller_scroll((int)scroll->number_);
     }
     else if (msgtype == "outer_menu_focus")
     {
-        JsonWrapper menu_id = json_find_member(obj.node, "menu_id");
-        JsonWrapper hotkey = json_find_member(obj.node, "hotkey");
+        JsonRef menu_id = json_find_member(obj.node, "menu_id");
+        JsonRef hotkey = json_find_member(obj.node, "hotkey");
         menu_id.check(JSON_STRING);
         hotkey.check(JSON_NUMBER);
         OuterMenu::recv_outer_menu_focus(menu_id->string_, (int)hotkey->number_);
@@ -558,7 +774,7 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     else if (msgtype == "inv_item_describe"
         && mouse_control::current_mode() == MOUSE_MODE_COMMAND)
     {
-        JsonWrapper slot = json_find_member(obj.node, "slot");
+        JsonRef slot = json_find_member(obj.node, "slot");
         slot.check(JSON_NUMBER);
         int inv_slot = (int) slot->number_;
         if (inv_slot >=0 && inv_slot < ENDOFPACK)
@@ -570,7 +786,7 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     else if (msgtype == "inv_item_action"
         && mouse_control::current_mode() == MOUSE_MODE_COMMAND)
     {
-        JsonWrapper slot = json_find_member(obj.node, "slot");
+        JsonRef slot = json_find_member(obj.node, "slot");
         slot.check(JSON_NUMBER);
         int inv_slot = (int) slot->number_;
         if (inv_slot >=0 && inv_slot < ENDOFPACK)
@@ -590,7 +806,7 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     else if (msgtype == "set_option")
     {
         // this is an extremely brute force approach...
-        JsonWrapper opt_line = json_find_member(obj.node, "line");
+        JsonRef opt_line = json_find_member(obj.node, "line");
         opt_line.check(JSON_STRING);
         Options.read_option_line(opt_line->string_, true);
         // XX only set this flag if a relevant option has actually changed
@@ -615,6 +831,8 @@ bool TilesFramework::await_input(wint_t& c, bool block)
 
     while (true)
     {
+        _drain_queues();
+
         do
         {
             FD_ZERO(&fds);
@@ -623,15 +841,17 @@ bool TilesFramework::await_input(wint_t& c, bool block)
                 FD_SET(m_sock, &fds);
 
             if (block)
-            {
                 tiles.flush_messages();
+
+            if (block && !_messages_queued())
                 result = select(maxfd + 1, &fds, nullptr, nullptr, nullptr);
-            }
             else
             {
+                // While anything is left to send, wake up now and then
+                // to send some more.
                 timeval timeout;
                 timeout.tv_sec = 0;
-                timeout.tv_usec = 0;
+                timeout.tv_usec = block ? WEB_DRAIN_INTERVAL * 1000 : 0;
 
                 result = select(maxfd + 1, &fds, nullptr, nullptr, &timeout);
             }
@@ -639,7 +859,11 @@ bool TilesFramework::await_input(wint_t& c, bool block)
         while (result == -1 && errno == EINTR);
 
         if (result == 0)
+        {
+            if (block)
+                continue;
             return false;
+        }
         else if (result > 0)
         {
             if (!m_sock_name.empty() && FD_ISSET(m_sock, &fds))
@@ -647,12 +871,16 @@ bool TilesFramework::await_input(wint_t& c, bool block)
                 c = _receive_control_message();
 
                 if (c != 0)
+                {
+                    m_latency.mark(TRACE_INPUT);
                     return true;
+                }
             }
 
             if (FD_ISSET(STDIN_FILENO, &fds))
             {
                 c = 0;
+                m_latency.mark(TRACE_INPUT);
                 return true;
             }
         }
@@ -720,7 +948,7 @@ void TilesFramework::send_milestone(const xlog_fields &xl)
     JsonWrapper j = xl.xlog_json();
     json_append_member(j.node, "msg", json_mkstring("milestone"));
     write_message("*");
-    write_message("%s", j.to_string().c_str());
+    write_message_raw(j.to_string());
     finish_message();
 }
 
@@ -1563,139 +1791,494 @@ void TilesFramework::write_tileidx(tileidx_t t)
     const int lo = t & 0xFFFFFFFF;
     const int hi = t >> 32;
     if (hi == 0)
-        tiles.write_message("%d", lo);
+        _append_int(m_msg_buf, lo);
     else
-        tiles.write_message("[%d,%d]", lo, hi);
-}
-
-void TilesFramework::_send_cell(const coord_def &gc,
-                                const screen_cell_t &current_sc, const screen_cell_t &next_sc,
-                                const map_cell &current_mc, const map_cell &next_mc,
-                                map<uint32_t, coord_def>& new_monster_locs,
-                                bool force_full)
+    {
+        m_msg_buf += '[';
+        _append_int(m_msg_buf, lo);
+        m_msg_buf += ',';
+        _append_int(m_msg_buf, hi);
+        m_msg_buf += ']';
+    }
+}
+
+// The plain fields of a cell update, which compact map messages send as
+// varints instead of JSON. The order is also the order of the values in a
+// packed record; merge_packed() in map_knowledge.js must agree with it.
+enum cell_field
+{
+    CF_FEAT           = 1 << 0,
+    CF_NO_MON         = 1 << 1,
+    CF_MF             = 1 << 2,
+    CF_GLYPH          = 1 << 3,
+    CF_COL            = 1 << 4,
+    CF_FG             = 1 << 5,
+    CF_BASE           = 1 << 6,
+    CF_BG             = 1 << 7,
+    CF_CLOUD          = 1 << 8,
+    CF_ICONS          = 1 << 9,
+    CF_FLAGS          = 1 << 10,
+    CF_HALO           = 1 << 11,
+    CF_ORB_GLOW       = 1 << 12,
+    CF_BLOOD_ROTATION = 1 << 13,
+    CF_TRAVEL_TRAIL   = 1 << 14,
+    CF_FLV            = 1 << 15,
+    CF_NO_DOLL        = 1 << 16,
+    CF_OV             = 1 << 17,
+};
+
+// Fields that live in the "t" object of a cell.
+static const uint32_t CF_TILE_FIELDS = ~(CF_FEAT | CF_NO_MON | CF_MF
+                                         | CF_GLYPH | CF_COL);
+
+// The boolean tile fields, sent together under CF_FLAGS as a mask of those
+// that changed and a mask of their new values.
+static const char * const cell_flag_names[] =
+{
+    "bloody", "old_blood", "silenced", "highlighted_summoner", "sanctuary",
+    "liquefied", "quad_glow", "disjunct", "mangrove_water", "awakened_forest",
+};
+
+static unsigned _cell_flags(const packed_cell &pc)
+{
+    const bool flags[] =
+    {
+        pc.is_bloody, pc.old_blood, pc.is_silenced,
+        pc.is_highlighted_summoner, pc.is_sanctuary, pc.is_liquefied,
+        pc.quad_glow, pc.disjunct != 0, pc.mangrove_water,
+        pc.awakened_forest,
+    };
+    COMPILE_CHECK(ARRAYSZ(flags) == ARRAYSZ(cell_flag_names));
+
+    unsigned mask = 0;
+    for (size_t i = 0; i < ARRAYSZ(flags); ++i)
+        if (flags[i])
+            mask |= 1 << i;
+    return mask;
+}
+
+struct cell_delta
+{
+    uint32_t fields = 0;
+    int feat = 0;
+    int mf = 0;
+    char32_t glyph = 0;
+    int col = 0;
+    tileidx_t fg = 0;
+    int base = 0;
+    tileidx_t bg = 0;
+    tileidx_t cloud = 0;
+    set<tileidx_t> icons;
+    unsigned flags_changed = 0;
+    unsigned flags = 0;
+    int halo = 0;
+    int orb_glow = 0;
+    int blood_rotation = 0;
+    int travel_trail = 0;
+    int flv_floor = 0;
+    int flv_special = 0;
+    vector<int> ov;
+};
+
+static void _diff_cell(const coord_def &gc,
+                       const screen_cell_t &current_sc,
+                       const screen_cell_t &next_sc,
+                       const map_cell &current_mc, const map_cell &next_mc,
+                       bool force_full, cell_delta &delta)
 {
     if (current_mc.feat() != next_mc.feat())
-        json_write_int("f", next_mc.feat());
+    {
+        delta.fields |= CF_FEAT;
+        delta.feat = next_mc.feat();
+    }
 
-    if (next_mc.monsterinfo())
-        _send_monster(gc, next_mc.monsterinfo(), new_monster_locs, force_full);
-    else if (current_mc.monsterinfo())
-        json_write_null("mon");
+    if (!next_mc.monsterinfo() && current_mc.monsterinfo())
+        delta.fields |= CF_NO_MON;
 
     map_feature mf = get_cell_map_feature(gc);
     if (get_cell_map_feature(current_mc) != mf)
-        json_write_int("mf", mf);
+    {
+        delta.fields |= CF_MF;
+        delta.mf = mf;
+    }
 
     // Glyph and colour
     char32_t glyph = next_sc.glyph;
     if (current_sc.glyph != glyph)
     {
-        char buf[5];
-        buf[wctoutf8(buf, glyph)] = 0;
-        json_write_string("g", buf);
+        delta.fields |= CF_GLYPH;
+        delta.glyph = glyph;
     }
     if ((current_sc.colour != next_sc.colour
          || current_sc.glyph == ' ') && glyph != ' ')
     {
         int col = next_sc.colour;
-        col = (_get_highlight(col) << 4) | macro_colour(col & 0xF);
-        json_write_int("col", col);
+        delta.fields |= CF_COL;
+        delta.col = (_get_highlight(col) << 4) | macro_colour(col & 0xF);
     }
 
-    json_open_object("t");
-    {
-        // Tile data
-        const packed_cell &next_pc = next_sc.tile;
-        const packed_cell &current_pc = current_sc.tile;
-
-        const tileidx_t fg_idx = next_pc.fg & TILE_FLAG_MASK;
+    // Tile data
+    const packed_cell &next_pc = next_sc.tile;
+    const packed_cell &current_pc = current_sc.tile;
 
-        const bool in_water = _in_water(next_pc);
-        bool fg_changed = false;
+    const tileidx_t fg_idx = next_pc.fg & TILE_FLAG_MASK;
 
-        if (next_pc.fg != current_pc.fg)
+    if (next_pc.fg != current_pc.fg)
+    {
+        delta.fields |= CF_FG;
+        delta.fg = next_pc.fg;
+        if (get_tile_texture(fg_idx) == TEX_DEFAULT)
         {
-            fg_changed = true;
-
-            json_write_name("fg");
-            write_tileidx(next_pc.fg);
-            if (get_tile_texture(fg_idx) == TEX_DEFAULT)
-                json_write_int("base", (int) tileidx_known_base_item(fg_idx));
+            delta.fields |= CF_BASE;
+            delta.base = tileidx_known_base_item(fg_idx);
         }
 
-        if (next_pc.bg != current_pc.bg)
+        // Monster and player tiles send their dolls themselves.
+        if (fg_idx < TILEP_MCACHE_START && fg_idx != TILEP_PLAYER
+            && get_tile_texture(fg_idx) != TEX_PLAYER)
         {
-            json_write_name("bg");
-            write_tileidx(next_pc.bg);
+            delta.fields |= CF_NO_DOLL;
         }
+    }
 
-        if (next_pc.cloud != current_pc.cloud)
-        {
-            json_write_name("cloud");
-            write_tileidx(next_pc.cloud);
-        }
+    if (next_pc.bg != current_pc.bg)
+    {
+        delta.fields |= CF_BG;
+        delta.bg = next_pc.bg;
+    }
+
+    if (next_pc.cloud != current_pc.cloud)
+    {
+        delta.fields |= CF_CLOUD;
+        delta.cloud = next_pc.cloud;
+    }
+
+    if (next_pc.icons != current_pc.icons)
+    {
+        delta.fields |= CF_ICONS;
+        delta.icons = next_pc.icons;
+    }
 
-        if (next_pc.icons != current_pc.icons)
-            json_write_icons(next_pc.icons);
+    const unsigned next_flags = _cell_flags(next_pc);
+    const unsigned changed_flags = next_flags ^ _cell_flags(current_pc);
+    if (changed_flags)
+    {
+        delta.fields |= CF_FLAGS;
+        delta.flags_changed = changed_flags;
+        delta.flags = next_flags & changed_flags;
+    }
+
+    if (next_pc.halo != current_pc.halo)
+    {
+        delta.fields |= CF_HALO;
+        delta.halo = next_pc.halo;
+    }
+
+    if (next_pc.orb_glow != current_pc.orb_glow)
+    {
+        delta.fields |= CF_ORB_GLOW;
+        delta.orb_glow = next_pc.orb_glow;
+    }
 
-        if (next_pc.is_bloody != current_pc.is_bloody)
-            json_write_bool("bloody", next_pc.is_bloody);
+    if (next_pc.blood_rotation != current_pc.blood_rotation)
+    {
+        delta.fields |= CF_BLOOD_ROTATION;
+        delta.blood_rotation = next_pc.blood_rotation;
+    }
 
-        if (next_pc.old_blood != current_pc.old_blood)
-            json_write_bool("old_blood", next_pc.old_blood);
+    if (next_pc.travel_trail != current_pc.travel_trail)
+    {
+        delta.fields |= CF_TRAVEL_TRAIL;
+        delta.travel_trail = next_pc.travel_trail;
+    }
 
-        if (next_pc.is_silenced != current_pc.is_silenced)
-            json_write_bool("silenced", next_pc.is_silenced);
+    if (_needs_flavour(next_pc) &&
+        (next_pc.flv.floor != current_pc.flv.floor
+         || next_pc.flv.special != current_pc.flv.special
+         || !_needs_flavour(current_pc)
+         || force_full))
+    {
+        delta.fields |= CF_FLV;
+        delta.flv_floor = next_pc.flv.floor;
+        delta.flv_special = next_pc.flv.special;
+    }
 
-        if (next_pc.halo != current_pc.halo)
-            json_write_int("halo", next_pc.halo);
+    bool overlays_changed = false;
 
-        if (next_pc.is_highlighted_summoner
-            != current_pc.is_highlighted_summoner)
+    if (next_pc.num_dngn_overlay != current_pc.num_dngn_overlay)
+        overlays_changed = true;
+    else
+    {
+        for (int i = 0; i < next_pc.num_dngn_overlay; i++)
         {
-            json_write_bool("highlighted_summoner",
-                            next_pc.is_highlighted_summoner);
+            if (next_pc.dngn_overlay[i] != current_pc.dngn_overlay[i])
+            {
+                overlays_changed = true;
+                break;
+            }
         }
+    }
+
+    if (overlays_changed)
+    {
+        delta.fields |= CF_OV;
+        for (int i = 0; i < next_pc.num_dngn_overlay; ++i)
+            delta.ov.push_back(next_pc.dngn_overlay[i]);
+    }
+}
+
+// Write the fields of delta that go in the current JSON object: either
+// those at the top level of the cell, or those in its "t" object.
+static void _write_cell_delta(const cell_delta &delta, bool tile_fields)
+{
+    const uint32_t fields = delta.fields
+                            & (tile_fields ? CF_TILE_FIELDS : ~CF_TILE_FIELDS);
 
-        if (next_pc.is_sanctuary != current_pc.is_sanctuary)
-            json_write_bool("sanctuary", next_pc.is_sanctuary);
+    if (fields & CF_FEAT)
+        tiles.json_write_int("f", delta.feat);
+    if (fields & CF_NO_MON)
+        tiles.json_write_null("mon");
+    if (fields & CF_MF)
+        tiles.json_write_int("mf", delta.mf);
+    if (fields & CF_GLYPH)
+    {
+        char buf[5];
+        buf[wctoutf8(buf, delta.glyph)] = 0;
+        tiles.json_write_string("g", buf);
+    }
+    if (fields & CF_COL)
+        tiles.json_write_int("col", delta.col);
+    if (fields & CF_FG)
+    {
+        tiles.json_write_name("fg");
+        tiles.write_tileidx(delta.fg);
+    }
+    if (fields & CF_BASE)
+        tiles.json_write_int("base", delta.base);
+    if (fields & CF_BG)
+    {
+        tiles.json_write_name("bg");
+        tiles.write_tileidx(delta.bg);
+    }
+    if (fields & CF_CLOUD)
+    {
+        tiles.json_write_name("cloud");
+        tiles.write_tileidx(delta.cloud);
+    }
+    if (fields & CF_ICONS)
+        tiles.json_write_icons(delta.icons);
+    if (fields & CF_FLAGS)
+    {
+        for (size_t i = 0; i < ARRAYSZ(cell_flag_names); ++i)
+            if (delta.flags_changed & (1 << i))
+                tiles.json_write_bool(cell_flag_names[i], delta.flags & (1 << i));
+    }
+    if (fields & CF_HALO)
+        tiles.json_write_int("halo", delta.halo);
+    if (fields & CF_ORB_GLOW)
+        tiles.json_write_int("orb_glow", delta.orb_glow);
+    if (fields & CF_BLOOD_ROTATION)
+        tiles.json_write_int("blood_rotation", delta.blood_rotation);
+    if (fields & CF_TRAVEL_TRAIL)
+        tiles.json_write_int("travel_trail", delta.travel_trail);
+    if (fields & CF_FLV)
+    {
+        tiles.json_open_object("flv");
+        tiles.json_write_int("f", delta.flv_floor);
+        if (delta.flv_special)
+            tiles.json_write_int("s", delta.flv_special);
+        tiles.json_close_object();
+    }
+    if (fields & CF_NO_DOLL)
+    {
+        tiles.json_write_null("doll");
+        tiles.json_write_null("mcache");
+    }
+    if (fields & CF_OV)
+    {
+        tiles.json_open_array("ov");
+        for (int ov : delta.ov)
+            tiles.json_write_int(ov);
+        tiles.json_close_array();
+    }
+}
 
-        if (next_pc.is_liquefied != current_pc.is_liquefied)
-            json_write_bool("liquefied", next_pc.is_liquefied);
+static void _pack_uint(string &out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
 
-        if (next_pc.orb_glow != current_pc.orb_glow)
-            json_write_int("orb_glow", next_pc.orb_glow);
+static void _pack_int(string &out, int value)
+{
+    _pack_uint(out, (static_cast<uint32_t>(value) << 1)
+                    ^ static_cast<uint32_t>(value >> 31));
+}
 
-        if (next_pc.quad_glow != current_pc.quad_glow)
-            json_write_bool("quad_glow", next_pc.quad_glow);
+static void _pack_tileidx(string &out, tileidx_t t)
+{
+    _pack_uint(out, t & 0xFFFFFFFF);
+    _pack_uint(out, t >> 32);
+}
 
-        if (next_pc.disjunct != current_pc.disjunct)
-            json_write_bool("disjunct", next_pc.disjunct);
+static string _pack_cell_delta(const cell_delta &delta)
+{
+    string out;
+    _pack_uint(out, delta.fields);
+    if (delta.fields & CF_FEAT)
+        _pack_int(out, delta.feat);
+    if (delta.fields & CF_MF)
+        _pack_int(out, delta.mf);
+    if (delta.fields & CF_GLYPH)
+        _pack_uint(out, delta.glyph);
+    if (delta.fields & CF_COL)
+        _pack_int(out, delta.col);
+    if (delta.fields & CF_FG)
+        _pack_tileidx(out, delta.fg);
+    if (delta.fields & CF_BASE)
+        _pack_int(out, delta.base);
+    if (delta.fields & CF_BG)
+        _pack_tileidx(out, delta.bg);
+    if (delta.fields & CF_CLOUD)
+        _pack_tileidx(out, delta.cloud);
+    if (delta.fields & CF_ICONS)
+    {
+        _pack_uint(out, delta.icons.size());
+        for (const tileidx_t icon : delta.icons)
+            _pack_tileidx(out, icon);
+    }
+    if (delta.fields & CF_FLAGS)
+    {
+        _pack_uint(out, delta.flags_changed);
+        _pack_uint(out, delta.flags);
+    }
+    if (delta.fields & CF_HALO)
+        _pack_int(out, delta.halo);
+    if (delta.fields & CF_ORB_GLOW)
+        _pack_int(out, delta.orb_glow);
+    if (delta.fields & CF_BLOOD_ROTATION)
+        _pack_int(out, delta.blood_rotation);
+    if (delta.fields & CF_TRAVEL_TRAIL)
+        _pack_int(out, delta.travel_trail);
+    if (delta.fields & CF_FLV)
+    {
+        _pack_int(out, delta.flv_floor);
+        _pack_int(out, delta.flv_special);
+    }
+    if (delta.fields & CF_OV)
+    {
+        _pack_uint(out, delta.ov.size());
+        for (int ov : delta.ov)
+            _pack_int(out, ov);
+    }
+    return out;
+}
 
-        if (next_pc.mangrove_water != current_pc.mangrove_water)
-            json_write_bool("mangrove_water", next_pc.mangrove_water);
+static string _base64_encode(const string &data)
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-        if (next_pc.awakened_forest != current_pc.awakened_forest)
-            json_write_bool("awakened_forest", next_pc.awakened_forest);
+    string out;
+    out.reserve((data.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < data.size(); i += 3)
+    {
+        uint32_t n = static_cast<uint8_t>(data[i]) << 16;
+        if (i + 1 < data.size())
+            n |= static_cast<uint8_t>(data[i + 1]) << 8;
+        if (i + 2 < data.size())
+            n |= static_cast<uint8_t>(data[i + 2]);
 
-        if (next_pc.blood_rotation != current_pc.blood_rotation)
-            json_write_int("blood_rotation", next_pc.blood_rotation);
+        out += digits[(n >> 18) & 0x3F];
+        out += digits[(n >> 12) & 0x3F];
+        out += i + 1 < data.size() ? digits[(n >> 6) & 0x3F] : '=';
+        out += i + 2 < data.size() ? digits[n & 0x3F] : '=';
+    }
+    return out;
+}
 
-        if (next_pc.travel_trail != current_pc.travel_trail)
-            json_write_int("travel_trail", next_pc.travel_trail);
+// Collects the packed records of a compact map message. Each record is the
+// number of cells (in row-major order over the whole level) skipped since
+// the end of the previous one, the number of further cells right after it
+// that changed in exactly the same way, and the packed delta itself. Runs
+// of identical changes, like a newly seen stretch of floor, thus cost one
+// record.
+class map_packer
+{
+public:
+    map_packer() : next_index(0), skip(0), repeat(0) {}
 
-        if (_needs_flavour(next_pc) &&
-            (next_pc.flv.floor != current_pc.flv.floor
-             || next_pc.flv.special != current_pc.flv.special
-             || !_needs_flavour(current_pc)
-             || force_full))
+    void add(const coord_def &gc, const cell_delta &delta)
+    {
+        const int index = gc.y * GXM + gc.x;
+        string record = _pack_cell_delta(delta);
+        if (!last.empty() && index == next_index && record == last)
+            ++repeat;
+        else
         {
-            json_open_object("flv");
-            json_write_int("f", next_pc.flv.floor);
-            if (next_pc.flv.special)
-                json_write_int("s", next_pc.flv.special);
-            json_close_object();
+            flush();
+            skip = index - next_index;
+            last = move(record);
         }
+        next_index = index + 1;
+    }
+
+    bool empty() const { return data.empty() && last.empty(); }
+
+    string finish()
+    {
+        flush();
+        return _base64_encode(data);
+    }
+
+private:
+    void flush()
+    {
+        if (last.empty())
+            return;
+        _pack_uint(data, skip);
+        _pack_uint(data, repeat);
+        data += last;
+        last.clear();
+        repeat = 0;
+    }
+
+    string data;
+    string last;
+    int next_index;
+    int skip;
+    int repeat;
+};
+
+void TilesFramework::_send_cell(const coord_def &gc,
+                                const screen_cell_t &current_sc, const screen_cell_t &next_sc,
+                                const map_cell &current_mc, const map_cell &next_mc,
+                                map<uint32_t, coord_def>& new_monster_locs,
+                                bool force_full, map_packer *packer)
+{
+    cell_delta delta;
+    _diff_cell(gc, current_sc, next_sc, current_mc, next_mc, force_full,
+               delta);
+
+    if (next_mc.monsterinfo())
+        _send_monster(gc, next_mc.monsterinfo(), new_monster_locs, force_full);
+
+    if (!packer)
+        _write_cell_delta(delta, false);
+
+    json_open_object("t");
+    {
+        const packed_cell &next_pc = next_sc.tile;
+        const tileidx_t fg_idx = next_pc.fg & TILE_FLAG_MASK;
+        const bool in_water = _in_water(next_pc);
+        const bool fg_changed = delta.fields & CF_FG;
+
+        if (!packer)
+            _write_cell_delta(delta, true);
 
         if (fg_idx >= TILEP_MCACHE_START)
         {
@@ -1763,41 +2346,11 @@ void TilesFramework::_send_cell(const coord_def &gc,
                 json_write_null("mcache");
             }
         }
-        else
-        {
-            if (fg_changed)
-            {
-                json_write_comma();
-                json_write_null("doll");
-                json_write_null("mcache");
-            }
-        }
-
-        bool overlays_changed = false;
-
-        if (next_pc.num_dngn_overlay != current_pc.num_dngn_overlay)
-            overlays_changed = true;
-        else
-        {
-            for (int i = 0; i < next_pc.num_dngn_overlay; i++)
-            {
-                if (next_pc.dngn_overlay[i] != current_pc.dngn_overlay[i])
-                {
-                    overlays_changed = true;
-                    break;
-                }
-            }
-        }
-
-        if (overlays_changed)
-        {
-            json_open_array("ov");
-            for (int i = 0; i < next_pc.num_dngn_overlay; ++i)
-                json_write_int(next_pc.dngn_overlay[i]);
-            json_close_array();
-        }
     }
     json_close_object(true);
+
+    if (packer && delta.fields)
+        packer->add(gc, delta);
 }
 
 void TilesFramework::_send_cursor(cursor_type type)
@@ -1818,22 +2371,23 @@ void TilesFramework::_mcache_ref(bool inc)
 {
     for (int y = 0; y < GYM; y++)
         for (int x = 0; x < GXM; x++)
-        {
-            coord_def gc(x, y);
+            _mcache_ref(coord_def(x, y), inc);
+}
 
-            int fg_idx = m_current_view(gc).tile.fg & TILE_FLAG_MASK;
-            if (fg_idx >= TILEP_MCACHE_START)
-            {
-                mcache_entry *entry = mcache.get(fg_idx);
-                if (entry)
-                {
-                    if (inc)
-                        entry->inc_ref();
-                    else
-                        entry->dec_ref();
-                }
-            }
+void TilesFramework::_mcache_ref(const coord_def &gc, bool inc)
+{
+    int fg_idx = m_current_view(gc).tile.fg & TILE_FLAG_MASK;
+    if (fg_idx >= TILEP_MCACHE_START)
+    {
+        mcache_entry *entry = mcache.get(fg_idx);
+        if (entry)
+        {
+            if (inc)
+                entry->inc_ref();
+            else
+                entry->dec_ref();
         }
+    }
 }
 
 void TilesFramework::_send_map(bool force_full)
@@ -1882,72 +2436,117 @@ void TilesFramework::_send_map(bool force_full)
     coord_def last_gc(0, 0);
     bool send_gc = true;
 
+    // With compact updates, the JSON cells only hold what the packed
+    // records can't, and so can't rely on following one another.
+    map_packer packer;
+    map_packer *cell_packer = Options.tile_web_compact_map ? &packer
+                                                           : nullptr;
+
+    // Visit the dirty cells in order, so that runs of them can leave out
+    // their coordinates.
+    vector<int> cells;
+    if (force_full)
+    {
+        cells.resize(GXM * GYM);
+        iota(cells.begin(), cells.end(), 0);
+    }
+    else
+    {
+        cells.swap(m_dirty_list);
+        sort(cells.begin(), cells.end());
+        cells.erase(unique(cells.begin(), cells.end()), cells.end());
+    }
+    m_dirty_list.clear();
+    vector<coord_def> sent;
+
     json_open_array("cells");
-    for (int y = 0; y < GYM; y++)
-        for (int x = 0; x < GXM; x++)
-        {
-            coord_def gc(x, y);
+    for (int i : cells)
+    {
+        const int x = i % GXM, y = i / GXM;
+        coord_def gc(x, y);
 
-            if (!is_dirty(gc) && !force_full)
-                continue;
+        if (!is_dirty(gc) && !force_full)
+            continue;
+        sent.push_back(gc);
 
-            if (cell_needs_redraw(gc))
-            {
-                screen_cell_t *cell = &m_next_view(gc);
+        if (cell_needs_redraw(gc))
+        {
+            screen_cell_t *cell = &m_next_view(gc);
 
-                draw_cell(cell, gc, false, m_current_flash_colour);
-                pack_cell_overlays(gc, m_next_view);
-            }
+            draw_cell(cell, gc, false, m_current_flash_colour);
+            pack_cell_overlays(gc, m_next_view);
+        }
 
-            mark_clean(gc);
+        mark_clean(gc);
 
-            if (m_origin.equals(-1, -1))
-                m_origin = gc;
+        if (m_origin.equals(-1, -1))
+            m_origin = gc;
 
-            json_open_object();
-            if (send_gc
-                || last_gc.x + 1 != gc.x
-                || last_gc.y != gc.y)
-            {
-                json_write_int("x", x - m_origin.x);
-                json_write_int("y", y - m_origin.y);
-                json_treat_as_empty();
-            }
+        json_open_object();
+        if (send_gc || cell_packer
+            || last_gc.x + 1 != gc.x
+            || last_gc.y != gc.y)
+        {
+            json_write_int("x", x - m_origin.x);
+            json_write_int("y", y - m_origin.y);
+            json_treat_as_empty();
+        }
 
-            const screen_cell_t& sc = force_full ? default_cell
-                : m_current_view(gc);
-            const map_cell& mc = force_full ? default_map_cell
-                : m_current_map_knowledge(gc);
-            _send_cell(gc,
-                       sc,
-                       m_next_view(gc),
-                       mc, env.map_knowledge(gc),
-                       new_monster_locs, force_full);
-
-            if (!json_is_empty())
-            {
-                send_gc = false;
-                last_gc = gc;
-            }
-            json_close_object(true);
+        const screen_cell_t& sc = force_full ? default_cell
+            : m_current_view(gc);
+        const map_cell& mc = force_full ? default_map_cell
+            : m_current_map_knowledge(gc);
+        _send_cell(gc,
+                   sc,
+                   m_next_view(gc),
+                   mc, env.map_knowledge(gc),
+                   new_monster_locs, force_full, cell_packer);
+
+        if (!json_is_empty())
+        {
+            send_gc = false;
+            last_gc = gc;
         }
+        json_close_object(true);
+    }
     json_close_array(true);
 
+    if (!packer.empty())
+    {
+        json_open_object("packed");
+        json_write_int("width", GXM);
+        json_write_int("x", -m_origin.x);
+        json_write_int("y", -m_origin.y);
+        json_write_string("data", packer.finish());
+        json_close_object();
+    }
+
     json_close_object(true);
 
-    finish_message();
+    finish_message(force_full ? WEB_MSG_FULL_MAP : WEB_MSG_MAP);
 
     if (force_full)
         _send_cursor(CURSOR_MAP);
 
-    if (m_mcache_ref_done)
-        _mcache_ref(false);
-
-    m_current_map_knowledge = env.map_knowledge;
-    m_current_view = m_next_view;
+    // Only the cells just sent can have changed since the last time, so
+    // only those need copying (monsters and items included) for the next
+    // diff. This has to wait until now, as monsters are diffed against
+    // where they were before.
+    for (const coord_def &gc : sent)
+    {
+        if (m_mcache_ref_done)
+            _mcache_ref(gc, false);
+        m_current_map_knowledge(gc) = env.map_knowledge(gc);
+        m_current_view(gc) = m_next_view(gc);
+        if (m_mcache_ref_done)
+            _mcache_ref(gc, true);
+    }
 
-    _mcache_ref(true);
-    m_mcache_ref_done = true;
+    if (!m_mcache_ref_done)
+    {
+        _mcache_ref(true);
+        m_mcache_ref_done = true;
+    }
 
     m_monster_locs = new_monster_locs;
 }
@@ -2018,6 +2617,20 @@ void TilesFramework::_send_monster(const coord_def &gc, const monster_info* m,
     json_close_object(true);
 }
 
+// Whether two cells look the same. Monsters and items always count as
+// changed, since a cell holds its own copy of them.
+static bool _same_cell(const screen_cell_t &a, const screen_cell_t &b)
+{
+    return a.glyph == b.glyph
+           && a.colour == b.colour
+           && a.flash_colour == b.flash_colour
+           && a.tile == b.tile
+           // Not covered by packed_cell's ==, but sent
+           && a.tile.icons == b.tile.icons
+           && a.tile.flv.floor == b.tile.flv.floor
+           && a.tile.flv.special == b.tile.flv.special;
+}
+
 void TilesFramework::load_dungeon(const crawl_view_buffer &vbuf,
                                   const coord_def &gc)
 {
@@ -2044,20 +2657,12 @@ void TilesFramework::load_dungeon(const crawl_view_buffer &vbuf,
                 mark_for_redraw(coord_def(x, y));
         }
 
-    // re-cache the map knowledge for the whole map, not just the updated portion
-    // fixes render bugs for out-of-LOS when transitioning levels in shoals/slime
-    for (int y = 0; y < GYM; y++)
-        for (int x = 0; x < GXM; x++)
-        {
-            const coord_def cache_gc(x, y);
-            screen_cell_t *cell = &m_next_view(cache_gc);
-            cell->tile.map_knowledge = map_bounds(cache_gc) ? env.map_knowledge(cache_gc) : map_cell();
-        }
-
     m_next_view_tl = view2grid(coord_def(1, 1));
     m_next_view_br = view2grid(crawl_view.viewsz);
 
-    // Copy vbuf into m_next_view
+    // Copy vbuf into m_next_view. Only the cells that actually change need
+    // sending, so that an idle turn sends (and visits) next to nothing.
+    bitset<GXM * GYM> loaded;
     for (int y = 0; y < vbuf.size().y; y++)
         for (int x = 0; x < vbuf.size().x; x++)
         {
@@ -2068,12 +2673,50 @@ void TilesFramework::load_dungeon(const crawl_view_buffer &vbuf,
                 continue;
 
             screen_cell_t *cell = &m_next_view(grid);
+            const screen_cell_t &next =
+                ((const screen_cell_t *) vbuf)[x + vbuf.size().x * y];
+
+            // The player's cell also shows their equipment, which isn't
+            // part of the cell.
+            bool changed = grid == you.pos() || !_same_cell(*cell, next);
+            const int num_overlays = cell->tile.num_dngn_overlay;
+            const FixedVector<int, packed_cell::MAX_DNGN_OVERLAY> overlays =
+                cell->tile.dngn_overlay;
 
-            *cell = ((const screen_cell_t *) vbuf)[x + vbuf.size().x * y];
+            *cell = next;
             pack_cell_overlays(grid, m_next_view);
 
-            mark_clean(grid); // Remove redraw flag
-            mark_dirty(grid);
+            if (!changed)
+            {
+                changed = cell->tile.num_dngn_overlay != num_overlays;
+                for (int i = 0; !changed && i < num_overlays; ++i)
+                    changed = cell->tile.dngn_overlay[i] != overlays[i];
+            }
+
+            loaded[grid.y * GXM + grid.x] = true;
+            // Remove the redraw flag, but leave a cell that's still
+            // waiting to be sent dirty.
+            m_cells_needing_redraw[grid.y * GXM + grid.x] = false;
+            if (changed)
+                mark_dirty(grid);
+        }
+
+    static const map_cell default_map_cell;
+    // re-cache the map knowledge for the whole map, not just the updated portion
+    // fixes render bugs for out-of-LOS when transitioning levels in shoals/slime
+    // (the cells from vbuf already have it)
+    for (int y = 0; y < GYM; y++)
+        for (int x = 0; x < GXM; x++)
+        {
+            if (loaded[y * GXM + x])
+                continue;
+            const coord_def cache_gc(x, y);
+            screen_cell_t *cell = &m_next_view(cache_gc);
+            const map_cell &mc = map_bounds(cache_gc) ? env.map_knowledge(cache_gc)
+                                                      : default_map_cell;
+            // Most of the map hasn't changed; don't copy it again.
+            if (cell->tile.map_knowledge != mc)
+                cell->tile.map_knowledge = mc;
         }
 
     m_next_gc = gc;
@@ -2110,8 +2753,35 @@ void TilesFramework::_send_messages()
 /*
   Send everything a newly joined spectator needs
  */
+// Send new spectators what the last _send_everything() sent, and all that
+// followed, in place of sending everything to everybody again. The server
+// passes what comes between replay_start and replay_end on to just the
+// spectators who joined since the last replay_end.
+bool TilesFramework::_replay_to_new_spectators()
+{
+    if (!m_replay_valid)
+        return false;
+    for (const Receiver &receiver : m_receivers)
+        if (!receiver.replay)
+            return false;
+
+    send_message("*{\"msg\":\"replay_start\"}");
+    // None of this is a live map update, so none of it can be coalesced
+    // away.
+    for (const shared_ptr<const string> &text : m_replay)
+        for (Receiver &receiver : m_receivers)
+            _queue_message(receiver, text, WEB_MSG_OTHER);
+    send_message("*{\"msg\":\"replay_end\"}");
+    return true;
+}
+
 void TilesFramework::_send_everything()
 {
+    // Start a new replay with this.
+    m_replay.clear();
+    m_replay_bytes = 0;
+    m_replay_valid = true;
+
     _send_version();
     send_options();
     _send_layout();
@@ -2413,7 +3083,12 @@ void TilesFramework::mark_for_redraw(const coord_def& gc)
 
 void TilesFramework::mark_dirty(const coord_def& gc)
 {
-    m_dirty_cells[gc.y * GXM + gc.x] = true;
+    const int i = gc.y * GXM + gc.x;
+    if (!m_dirty_cells[i])
+    {
+        m_dirty_cells[i] = true;
+        m_dirty_list.push_back(i);
+    }
 }
 
 void TilesFramework::mark_clean(const coord_def& gc)
@@ -2434,21 +3109,30 @@ bool TilesFramework::cell_needs_redraw(const coord_def& gc)
 
 void TilesFramework::write_message_escaped(const string& s)
 {
-    for (unsigned char c : s)
+    static const char hex[] = "0123456789abcdef";
+
+    // Copy runs of characters that need no escaping in one go.
+    size_t run = 0;
+    for (size_t i = 0; i < s.size(); ++i)
     {
+        const unsigned char c = s[i];
+        if (c != '"' && c != '\\' && c >= 0x20)
+            continue;
+
+        m_msg_buf.append(s, run, i - run);
+        run = i + 1;
         if (c == '"')
             m_msg_buf.append("\\\"");
         else if (c == '\\')
             m_msg_buf.append("\\\\");
-        else if (c < 0x20)
+        else
         {
-            char buf[7];
-            snprintf(buf, sizeof(buf), "\\u%04x", c);
-            m_msg_buf.append(buf);
+            const char esc[] = { '\\', 'u', '0', '0',
+                                 hex[c >> 4], hex[c & 0xF] };
+            m_msg_buf.append(esc, sizeof(esc));
         }
-        else
-            m_msg_buf.push_back(c);
     }
+    m_msg_buf.append(s, run, string::npos);
 }
 
 void TilesFramework::json_open(const string& name, char opener, char type)
@@ -2527,10 +3211,10 @@ void TilesFramework::json_write_comma()
 {
     if (m_msg_buf.empty())
         return;
-    char last = m_msg_buf[m_msg_buf.size() - 1];
+    char last = m_msg_buf.back();
     if (last == '{' || last == '[' || last == ',' || last == ':')
         return;
-    write_message(",");
+    m_msg_buf += ',';
 }
 
 void TilesFramework::json_write_icons(const set<tileidx_t> &icons)
@@ -2548,16 +3232,16 @@ void TilesFramework::json_write_name(const string& name)
 {
     json_write_comma();
 
-    write_message("\"");
+    m_msg_buf += '"';
     write_message_escaped(name);
-    write_message("\":");
+    m_msg_buf.append("\":");
 }
 
 void TilesFramework::json_write_int(int value)
 {
     json_write_comma();
 
-    write_message("%d", value);
+    _append_int(m_msg_buf, value);
 }
 
 void TilesFramework::json_write_int(const string& name, int value)
@@ -2572,10 +3256,7 @@ void TilesFramework::json_write_bool(bool value)
 {
     json_write_comma();
 
-    if (value)
-        write_message("true");
-    else
-        write_message("false");
+    m_msg_buf.append(value ? "true" : "false");
 }
 
 void TilesFramework::json_write_bool(const string& name, bool value)
@@ -2590,7 +3271,7 @@ void TilesFramework::json_write_null()
 {
     json_write_comma();
 
-    write_message("null");
+    m_msg_buf.append("null");
 }
 
 void TilesFramework::json_write_null(const string& name)
@@ -2605,9 +3286,9 @@ void TilesFramework::json_write_string(const string& value)
 {
     json_write_comma();
 
-    write_message("\"");
+    m_msg_buf += '"';
     write_message_escaped(value);
-    write_message("\"");
+    m_msg_buf += '"';
 }
 
 void TilesFramework::json_write_string(const string& name, const string& value)
@@ -8,13 +8,17 @@
 #ifdef USE_TILE_WEB
 
 #include <bitset>
+#include <cstdarg>
+#include <deque>
 #include <map>
+#include <memory>
 #include <vector>
 
 #include <sys/un.h>
 
 #include "cursor-type.h"
 #include "equipment-type.h"
+#include "json.h"
 #include "map-cell.h"
 #include "map-knowledge.h"
 #include "status.h"
@@ -22,12 +26,26 @@
 #include "tiledoll.h"
 #include "tilemcache.h"
 #include "tileweb-text.h"
+#include "tileweb-trace.h"
 #include "viewgeom.h"
 
+using std::deque;
+using std::shared_ptr;
 using std::vector;
 
 class xlog_fields;
 class Menu;
+class map_packer;
+
+// What the send queue of a lagging receiver may do with a message.
+enum WebtilesMessageKind
+{
+    WEB_MSG_OTHER,
+    // A map update, which can be dropped in favour of a later full map.
+    WEB_MSG_MAP,
+    // A full map, which makes every earlier map message redundant.
+    WEB_MSG_FULL_MAP,
+};
 
 enum WebtilesUIState
 {
@@ -149,11 +167,12 @@ public:
 
     string get_message();
     void write_message(PRINTF(1, ));
-    void finish_message();
+    void write_message_raw(const string& s);
+    void finish_message(WebtilesMessageKind kind = WEB_MSG_OTHER);
     void send_message(PRINTF(1, ));
     void flush_messages();
 
-    bool has_receivers() { return !m_dest_addrs.empty(); }
+    bool has_receivers() { return !m_receivers.empty(); }
     bool is_controlled_from_web() { return m_controlled_from_web; }
 
     /* Webtiles can receive input both via stdin, and on the
@@ -201,6 +220,7 @@ public:
 
     string m_sock_name;
     bool m_await_connection;
+    WebLatencyTrace m_latency;
 
     void set_text_cursor(bool enabled);
     void set_ui_state(WebtilesUIState state);
@@ -223,7 +243,44 @@ protected:
     int m_sock;
     int m_max_msg_size;
     string m_msg_buf;
-    vector<sockaddr_un> m_dest_addrs;
+
+    // A message on its way to one receiver. The text is shared between
+    // the queues of all receivers.
+    struct QueuedMessage
+    {
+        shared_ptr<const string> text;
+        size_t sent; // including the final newline, which isn't in text
+        WebtilesMessageKind kind;
+    };
+    // Everything sent to a receiver goes through its queue, which is
+    // drained without blocking, so a slow receiver can't hold up the game.
+    struct Receiver
+    {
+        sockaddr_un addr;
+        bool primary;
+        // Whether it can pass a replay on to just the new spectators.
+        bool replay;
+        deque<QueuedMessage> queue;
+        size_t queued_bytes;
+        unsigned int last_progress;
+        // Map updates were dropped, so skip them until the next full map.
+        bool awaiting_full_map;
+    };
+    vector<Receiver> m_receivers;
+
+    // What the last _send_everything() sent, and everything since: enough
+    // to bring a new spectator up to date without sending it all again.
+    vector<shared_ptr<const string>> m_replay;
+    size_t m_replay_bytes;
+    bool m_replay_valid;
+    bool _replay_to_new_spectators();
+
+    void _write_vmessage(const char *format, va_list argp);
+    void _queue_message(Receiver &receiver, shared_ptr<const string> text,
+                        WebtilesMessageKind kind);
+    bool _drain_queue(Receiver &receiver);
+    void _drain_queues();
+    bool _messages_queued() const;
 
     bool m_controlled_from_web;
     bool m_need_flush;
@@ -231,7 +288,8 @@ protected:
     bool _send_lock; // not thread safe
 
     void _await_connection();
-    wint_t _handle_control_message(sockaddr_un addr, string data);
+    JsonArena m_control_arena;
+    wint_t _handle_control_message(sockaddr_un addr, char *data);
     wint_t _receive_control_message();
 
     struct JsonFrame
@@ -277,6 +335,9 @@ protected:
     coord_def m_next_view_br;
 
     bitset<GXM * GYM> m_dirty_cells;
+    // The indices of the dirty cells, in no particular order and maybe
+    // with repeats, so that sending the map only visits those.
+    vector<int> m_dirty_list;
     bitset<GXM * GYM> m_cells_needing_redraw;
     void mark_dirty(const coord_def& gc);
     void mark_clean(const coord_def& gc);
@@ -316,6 +377,7 @@ protected:
 
     bool m_mcache_ref_done;
     void _mcache_ref(bool inc);
+    void _mcache_ref(const coord_def &gc, bool inc);
 
     void _send_cursor(cursor_type type);
     void _send_map(bool force_full = false);
@@ -323,7 +385,7 @@ protected:
                     const screen_cell_t &current_sc, const screen_cell_t &next_sc,
                     const map_cell &current_mc, const map_cell &next_mc,
                     map<uint32_t, coord_def>& new_monster_locs,
-                    bool force_full);
+                    bool force_full, map_packer *packer);
     void _send_monster(const coord_def &gc, const monster_info* m,
                        map<uint32_t, coord_def>& new_monster_locs,
                        bool force_full);
@@ -156,10 +156,9 @@ bool trap_def::is_safe(actor* act) const
         return true;
 
     // Let players specify traps as safe via lua.
-    if (clua.callbooleanfn(false, "c_trap_is_safe", "s", trap_name(type).c_str()))
-        return true;
-
-    return false;
+    static const lua_hook<bool(const string &)> trap_is_safe("c_trap_is_safe");
+    bool safe = false;
+    return trap_is_safe(clua, safe, trap_name(type)) && safe;
 }
 
 /**
@@ -641,14 +641,16 @@ static inline void _check_interesting_square(const coord_def pos,
 
 static void _userdef_run_stoprunning_hook()
 {
+    static const lua_hook<void(const char *)> stop_hook("ch_stop_running");
     if (you.running)
-        clua.callfn("ch_stop_running", "s", _run_mode_name(you.running));
+        stop_hook(clua, _run_mode_name(you.running));
 }
 
 static void _userdef_run_startrunning_hook()
 {
+    static const lua_hook<void(const char *)> start_hook("ch_start_running");
     if (you.running)
-        clua.callfn("ch_start_running", "s", _run_mode_name(you.running));
+        start_hook(clua, _run_mode_name(you.running));
 }
 
 bool is_resting()
@@ -4542,7 +4544,8 @@ bool runrest::diag_run_passes_door() const
 void runrest::stop(bool clear_delays)
 {
     bool need_redraw =
-        (runmode > 0 || runmode < 0 && Options.travel_delay == -1);
+        (runmode > 0 || runmode < 0 && Options.travel_delay == -1)
+        || viewwindow_frame_skipped();
     _userdef_run_stoprunning_hook();
     runmode = RMODE_NOT_RUNNING;
 
@@ -8,6 +8,7 @@
 #include "view.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <memory>
@@ -84,6 +85,11 @@
 static layers_type _layers = LAYERS_ALL;
 static layers_type _layers_saved = LAYERS_NONE;
 
+// For drawing fewer frames while running; see _skip_run_frame().
+static chrono::steady_clock::time_point _last_run_frame;
+static bool _run_frame_forced = false;
+static bool _run_frame_skipped = false;
+
 crawl_view_geometry crawl_view;
 
 bool handle_seen_interrupt(monster* mons, vector<string>* msgs_buf)
@@ -576,6 +582,9 @@ void update_monsters_in_view()
 
             if (mi->visible_to(&you))
             {
+                // Show it even if it doesn't stop us running.
+                if (!testbits(mi->flags, MF_WAS_IN_VIEW))
+                    _run_frame_forced = true;
                 if (handle_seen_interrupt(*mi, &msgs))
                     monsters.push_back(*mi);
                 seen_monster(*mi);
@@ -1371,6 +1380,42 @@ static bool _view_is_updating = false;
 
 crawl_view_buffer view_dungeon(animation *a, bool anim_updates, view_renderer *renderer);
 
+#ifndef USE_TILE_LOCAL
+// The pause between moves of the current run, as in _get_running_command().
+static int _run_delay()
+{
+    if (you.running.is_rest())
+        return Options.rest_delay;
+    if (you.running.is_explore() && Options.explore_delay > -1)
+        return Options.explore_delay;
+    return Options.travel_delay;
+}
+
+// Runs with no pause between moves would otherwise draw thousands of frames
+// that nobody gets to see (except, slowly, in ttyrecs and on the webtiles
+// spectator feed). Draw at most runrest_frame_rate of them a second. Local
+// tiles has tile_runrest_rate for this instead.
+static bool _skip_run_frame()
+{
+    if (!you.running || _run_frame_forced || Options.runrest_frame_rate <= 0
+        || _run_delay() != 0)
+    {
+        return false;
+    }
+    const auto interval = chrono::milliseconds(1000
+                                               / Options.runrest_frame_rate);
+    if (chrono::steady_clock::now() - _last_run_frame >= interval)
+        return false;
+    _run_frame_skipped = true;
+    return true;
+}
+#else
+static bool _skip_run_frame()
+{
+    return false;
+}
+#endif
+
 static bool _viewwindow_should_render()
 {
     if (you.asleep())
@@ -1378,10 +1423,19 @@ static bool _viewwindow_should_render()
     if (mouse_control::current_mode() != MOUSE_MODE_NORMAL)
         return true;
     if (you.running && you.running.is_rest())
-        return Options.rest_delay != -1;
+        return Options.rest_delay != -1 && !_skip_run_frame();
     const bool run_dont_draw = you.running && Options.travel_delay < 0
                 && (!you.running.is_explore() || Options.explore_delay < 0);
-    return !run_dont_draw;
+    return !run_dont_draw && !_skip_run_frame();
+}
+
+/**
+ * Has viewwindow() left out a frame of the current run? If so, the view is
+ * out of date and should be drawn once the run stops.
+ */
+bool viewwindow_frame_skipped()
+{
+    return _run_frame_skipped;
 }
 
 /**
@@ -1470,6 +1524,9 @@ void viewwindow(bool show_updates, bool tiles_only, animation *a, view_renderer
             const auto vbuf = view_dungeon(a, anim_updates, renderer);
 
             you.last_view_update = you.num_turns;
+            _last_run_frame = chrono::steady_clock::now();
+            _run_frame_forced = false;
+            _run_frame_skipped = false;
 #ifndef USE_TILE_LOCAL
             if (!tiles_only)
             {
@@ -1484,6 +1541,9 @@ void viewwindow(bool show_updates, bool tiles_only, animation *a, view_renderer
             tiles.load_dungeon(vbuf, crawl_view.vgrdc);
             tiles.update_tabs();
 #endif
+#ifdef USE_TILE_WEB
+            tiles.m_latency.mark(TRACE_VIEW);
+#endif
 
             // Leaving it this way because short flashes can occur in long ones,
             // and this simply works without requiring a stack.
@@ -90,6 +90,9 @@ function ($, comm, map_knowledge, view_data, monster_list, minimap,
         if (data.cells)
             map_knowledge.merge(data.cells);
 
+        if (data.packed)
+            map_knowledge.merge_packed(data.packed);
+
         // Mark cells overlapped by dirty cells as dirty
         $.each(map_knowledge.dirty().slice(), function (i, loc) {
             var cell = map_knowledge.get(loc.x, loc.y);
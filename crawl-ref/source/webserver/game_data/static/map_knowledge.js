@@ -207,9 +207,146 @@ define(["jquery", "./enums", "./util"], function ($, enums, util) {
         clean_monster_table();
     };
 
+    // Fields of packed cell records, in the order of their values; this
+    // must agree with cell_field in tileweb.cc.
+    var CF_FEAT = 1 << 0, CF_NO_MON = 1 << 1, CF_MF = 1 << 2,
+        CF_GLYPH = 1 << 3, CF_COL = 1 << 4, CF_FG = 1 << 5, CF_BASE = 1 << 6,
+        CF_BG = 1 << 7, CF_CLOUD = 1 << 8, CF_ICONS = 1 << 9,
+        CF_FLAGS = 1 << 10, CF_HALO = 1 << 11, CF_ORB_GLOW = 1 << 12,
+        CF_BLOOD_ROTATION = 1 << 13, CF_TRAVEL_TRAIL = 1 << 14,
+        CF_FLV = 1 << 15, CF_NO_DOLL = 1 << 16, CF_OV = 1 << 17;
+    var cell_flag_names = ["bloody", "old_blood", "silenced",
+                           "highlighted_summoner", "sanctuary", "liquefied",
+                           "quad_glow", "disjunct", "mangrove_water",
+                           "awakened_forest"];
+
+    function unpack_cell(read_uint, read_int, read_tileidx)
+    {
+        var val = {};
+        var t = {};
+        var fields = read_uint();
+        var i, n;
+
+        if (fields & CF_FEAT)
+            val.f = read_int();
+        if (fields & CF_NO_MON)
+            val.mon = null;
+        if (fields & CF_MF)
+            val.mf = read_int();
+        if (fields & CF_GLYPH)
+            val.g = String.fromCodePoint(read_uint());
+        if (fields & CF_COL)
+            val.col = read_int();
+        if (fields & CF_FG)
+            t.fg = read_tileidx();
+        if (fields & CF_BASE)
+            t.base = read_int();
+        if (fields & CF_BG)
+            t.bg = read_tileidx();
+        if (fields & CF_CLOUD)
+            t.cloud = read_tileidx();
+        if (fields & CF_ICONS)
+        {
+            t.icons = [];
+            for (n = read_uint(); n > 0; n--)
+                t.icons.push(read_tileidx());
+        }
+        if (fields & CF_FLAGS)
+        {
+            var changed = read_uint(), flags = read_uint();
+            for (i = 0; i < cell_flag_names.length; i++)
+                if (changed & (1 << i))
+                    t[cell_flag_names[i]] = !!(flags & (1 << i));
+        }
+        if (fields & CF_HALO)
+            t.halo = read_int();
+        if (fields & CF_ORB_GLOW)
+            t.orb_glow = read_int();
+        if (fields & CF_BLOOD_ROTATION)
+            t.blood_rotation = read_int();
+        if (fields & CF_TRAVEL_TRAIL)
+            t.travel_trail = read_int();
+        if (fields & CF_FLV)
+        {
+            t.flv = {f: read_int()};
+            var special = read_int();
+            if (special)
+                t.flv.s = special;
+        }
+        if (fields & CF_NO_DOLL)
+        {
+            t.doll = null;
+            t.mcache = null;
+        }
+        if (fields & CF_OV)
+        {
+            t.ov = [];
+            for (n = read_uint(); n > 0; n--)
+                t.ov.push(read_int());
+        }
+
+        if (!$.isEmptyObject(t))
+            val.t = t;
+        return val;
+    }
+
+    // Merge the binary cell records of a compact map message; see
+    // map_packer in tileweb.cc for the format.
+    function merge_packed(packed)
+    {
+        var data = atob(packed.data);
+        var pos = 0;
+
+        function read_uint()
+        {
+            var value = 0, mul = 1, b;
+            do
+            {
+                b = data.charCodeAt(pos++);
+                value += (b & 0x7F) * mul;
+                mul *= 128;
+            } while (b & 0x80);
+            return value;
+        }
+
+        function read_int()
+        {
+            var value = read_uint();
+            return value % 2 ? -(value + 1) / 2 : value / 2;
+        }
+
+        function read_tileidx()
+        {
+            // Same as the JSON form: a signed int, or [lo, hi]
+            var lo = read_uint() | 0, hi = read_uint() | 0;
+            return hi ? [lo, hi] : lo;
+        }
+
+        var vals = [];
+        var index = 0;
+        while (pos < data.length)
+        {
+            index += read_uint();
+            var repeat = read_uint();
+            var start = pos;
+            for (var i = 0; i <= repeat; i++, index++)
+            {
+                // Every cell needs its own copy of the values.
+                pos = start;
+                var val = unpack_cell(read_uint, read_int, read_tileidx);
+                val.x = index % packed.width + packed.x;
+                val.y = Math.floor(index / packed.width) + packed.y;
+                vals.push(val);
+            }
+        }
+
+        merge_diff(vals);
+    }
+
     return {
         get: get,
         merge: merge_diff,
+        merge_packed: merge_packed,
         clear: clear,
         touch: touch,
         visible: visible,
@@ -262,7 +262,8 @@ function ($, comm, client, ui, enums, cr, util, options, scroller) {
             var item = {
                 level: 2,
                 text: "...",
-                index: i
+                index: i,
+                placeholder: true
             };
             var elem = $("<li>...</li>");
             elem.data("item", item);
@@ -316,6 +317,8 @@ function ($, comm, client, ui, enums, cr, util, options, scroller) {
             $.extend(item, new_item);
             if (new_item.colour === undefined)
                 delete item.colour;
+            delete item.placeholder;
+            delete item.requested;
 
             set_item_contents(item, item.elem);
         }
@@ -613,6 +616,37 @@ function ($, comm, client, ui, enums, cr, util, options, scroller) {
         update_more();
     }
 
+    function request_missing_items()
+    {
+        // Big menus are only sent a chunk at a time: ask for whatever is
+        // visible, or a page either side of it, that we don't have yet.
+        // Spectators can't ask, but get what the player asks for.
+        if (!menu || client.is_watching())
+            return;
+        var page = menu.last_visible - menu.first_visible + 1;
+        var start = Math.max(0, menu.first_visible - page);
+        var end = Math.min(menu.items.length - 1, menu.last_visible + page);
+        while (start <= end && !(menu.items[start].placeholder
+                                 && !menu.items[start].requested))
+        {
+            start++;
+        }
+        while (end >= start && !(menu.items[end].placeholder
+                                 && !menu.items[end].requested))
+        {
+            end--;
+        }
+        if (start > end)
+            return;
+
+        for (var i = start; i <= end; ++i)
+            menu.items[i].requested = true;
+        comm.send_message("*request_menu_range", {
+            start: start,
+            end: end
+        });
+    }
+
     function update_server_scroll()
     {
         if (update_server_scroll_timeout)
@@ -785,7 +819,10 @@ function ($, comm, client, ui, enums, cr, util, options, scroller) {
 
         var old_length = menu.items.length;
         menu.items.length = menu.total_items;
-        if (menu.total_items < old_length)
+        // new items aren't sent until they're asked for
+        if (menu.total_items > old_length)
+            prepare_item_range(old_length, menu.total_items - 1);
+        else if (menu.total_items < old_length)
         {
             for (var i = old_length; i >= menu.total_items; --i)
                 delete menu.items[i];
@@ -798,6 +835,7 @@ function ($, comm, client, ui, enums, cr, util, options, scroller) {
         }
         update_title();
         update_more();
+        request_missing_items();
     }
 
     function update_menu_items(data)
@@ -857,6 +895,7 @@ function ($, comm, client, ui, enums, cr, util, options, scroller) {
             menu.following_player_scroll = false;
 
         update_visible_indices();
+        request_missing_items();
         schedule_server_scroll();
     }
 
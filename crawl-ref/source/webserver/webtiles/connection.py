@@ -71,7 +71,9 @@ class WebtilesSocketConnection(object):
 
         msg = json_encode({
                 "msg": "attach",
-                "primary": primary
+                "primary": primary,
+                # we can pass replays on to just the new spectators
+                "replay": True
                 })
 
         self.open = True
@@ -121,6 +121,7 @@ def validate_game_dict(game):
                 'morgue_path', 'inprogress_path', 'ttyrec_path',
                 'socket_path', 'client_path')
     optional = ('dir_path', 'cwd', 'morgue_url', 'milestone_path',
+                'latency_path', 'fork_server',
                 'send_json_options', 'options', 'env', 'separator',
                 'show_save_info', 'allowed_with_hold')
     boolean = ('send_json_options', 'show_save_info', 'allowed_with_hold')
@@ -117,6 +117,12 @@ class CrawlProcessHandlerBase(object):
             self.logger.process = lambda m,k: logger.process(*self._process_log_msg(m, k))
 
         self.queue_messages = False
+        # Spectators still waiting for crawl to bring them up to date, and
+        # the ones crawl is replaying the game state for right now. Anyone
+        # joining during a replay waits for the next one.
+        self._new_watchers = set()
+        self._replay_targets = set()
+        self._replaying = False
 
         self.process = None
         self.client_path = self.config_path("client_path")
@@ -467,6 +473,8 @@ class CrawlProcessHandlerBase(object):
 
     def remove_watcher(self, watcher):
         self._receivers.remove(watcher)
+        self._new_watchers.discard(watcher)
+        self._replay_targets.discard(watcher)
         self.update_watcher_description()
 
     def watcher_count(self):
@@ -631,6 +639,7 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
         self._stale_lockfile = None
         self._purging_timer = None
         self._process_hup_timeout = None
+        self._latency_poller = None
 
     def start(self):
         self._purge_locks_and_start(True)
@@ -773,6 +782,19 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
         call = self._base_call() + ["-webtiles-socket", self.socketpath,
                                     "-await-connection"]
 
+        fork_server = self.config_path("fork_server")
+        if fork_server:
+            call += ["-use-fork-server", fork_server]
+
+        latency_path = self.config_path("latency_path")
+        if latency_path:
+            call += ["-webtiles-latency",
+                     os.path.join(latency_path, self.username + ":" +
+                                  self.formatted_time + ".latency")]
+            # Besides the stats file, log the stats every five minutes.
+            self._latency_poller = PeriodicCallback(self._request_latency_stats,
+                                                    300000)
+
         ttyrec_path = self.config_path("ttyrec_path")
         if ttyrec_path:
             self.ttyrec_filename = os.path.join(ttyrec_path, self.lock_basename)
@@ -799,6 +821,8 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
             self.gen_inprogress_lock()
 
             self.connect(self.socketpath, True)
+            if self._latency_poller:
+                self._latency_poller.start()
 
             self.logger.debug("Crawl FDs: fd%s, fd%s.",
                              self.process.child_fd,
@@ -880,6 +904,10 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
         self.stop()
 
     def handle_process_end(self):
+        if self._latency_poller:
+            self._latency_poller.stop()
+            self._latency_poller = None
+
         if self.conn:
             self.conn.close_callback = None
             self.conn.close()
@@ -892,6 +920,7 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
         super(CrawlProcessHandler, self).add_watcher(watcher)
 
         if self.conn and self.conn.open:
+            self._new_watchers.add(watcher)
             self.conn.send_message('{"msg":"spectator_joined"}')
 
     def handle_input(self, msg): # type: (str) -> None
@@ -926,6 +955,10 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
                         "content": "%s: %s" % (username, text)
                         }))
 
+    def _request_latency_stats(self):
+        if self.conn and self.conn.open:
+            self.conn.send_message('{"msg":"latency_stats"}')
+
     def handle_announcement(self, text):
         if self.conn and self.conn.open:
             self.conn.send_message(json_encode({
@@ -988,6 +1021,14 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
                         self.crawl_version = msgobj["version"]
                         self.logger.info("Crawl version: %s.", self.crawl_version)
                     self.send_client_to_all()
+            elif msgobj["msg"] == "replay_start":
+                # What follows is the game so far, just for new spectators
+                self._replaying = True
+                self._replay_targets = self._new_watchers
+                self._new_watchers = set()
+            elif msgobj["msg"] == "replay_end":
+                self._replaying = False
+                self._replay_targets = set()
             elif msgobj["msg"] == "flush_messages":
                 # only queue, once we know the crawl process asks for flushes
                 self.queue_messages = True;
@@ -1010,6 +1051,9 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
                 # message
                 self.receiving_direct_milestones = True # no need for .where files
                 self.set_where_info(msgobj)
+            elif msgobj["msg"] == "latency_stats":
+                self.logger.info("Input latency: %s",
+                                 json_encode(msgobj["stats"]))
             else:
                 self.logger.warning("Unknown message from the crawl process: %s",
                                     msgobj["msg"])
@@ -1023,7 +1067,11 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
                 # want that to reset idle time.
                 self.note_activity()
 
-            self.write_to_all(msg, not self.queue_messages)
+            if self._replaying:
+                for watcher in self._replay_targets:
+                    watcher.append_message(msg, not self.queue_messages)
+            else:
+                self.write_to_all(msg, not self.queue_messages)
 
 
 
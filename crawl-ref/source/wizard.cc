@@ -135,7 +135,7 @@ static void _do_wizard_command(int wiz_command)
     case CONTROL('P'): wizard_list_props(); break;
 
     // case 'q': break;
-    // case 'Q': break;
+    case 'Q': wizard_list_lua_hooks(); break;
     case CONTROL('Q'): wizard_toggle_dprf(); break;
 
     case 'r': wizard_change_species(); break;
@@ -514,6 +514,7 @@ int list_wizard_commands(bool do_redraw_screen)
                        "<w>O</w>      measure exploration time\n"
                        "<w>Ctrl-T</w> dungeon (D)Lua interpreter\n"
                        "<w>Ctrl-U</w> client (C)Lua interpreter\n"
+                       "<w>Q</w>      client Lua hook costs\n"
                        "<w>Ctrl-X</w> Xom effect stats\n"
 #ifdef DEBUG_DIAGNOSTICS
                        "<w>Ctrl-Q</w> make some debug messages quiet\n"